@@ -0,0 +1,297 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include "archive.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+
+/**
+ * @return The month of an epoch millisecond date as YYYYMM, UTC.
+ */
+static int archive_month(int64_t date)
+{
+	const time_t seconds = date / 1000;
+	struct tm tm {};
+
+	gmtime_r(&seconds, &tm);
+
+	return (tm.tm_year + 1900) * 100 + tm.tm_mon + 1;
+}
+
+static bool table_exists(sqlite3* db, const char* name)
+{
+	sqlite3_stmt* stmt;
+	bool exists = false;
+
+	if (sqlite3_prepare_v2(db, 
+				"SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?1;",
+				-1, &stmt, nullptr) == SQLITE_OK)
+	{
+		sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+		exists = (sqlite3_step(stmt) == SQLITE_ROW);
+		sqlite3_finalize(stmt);
+	}
+
+	return exists;
+}
+
+/**
+ * Create the archive table for a month if needed,
+ * and prepare an insert into it.
+ *
+ * @param created Set if the table was created.
+ */
+static int prepare_archive(sqlite3* db, int month, sqlite3_stmt*& insert, bool& created)
+{
+	char name[32];
+	int rc;
+
+	snprintf(name, sizeof(name), "docking_log_%06d", month);
+
+	if (!table_exists(db, name))
+	{
+		std::ostringstream ss;
+		ss << "CREATE TABLE " << name 
+			<< "\n("
+			"\n    log_id INTEGER PRIMARY KEY,"
+			"\n    pad_id INTEGER NOT NULL,"
+			"\n    license TEXT NOT NULL,"
+			"\n    event TEXT NOT NULL,"
+			"\n    date INTEGER NOT NULL"
+			"\n);"
+			"\nCREATE INDEX " << name << "_pad ON " << name << " (pad_id, date);"
+			"\nCREATE INDEX " << name << "_license ON " << name << " (license);";
+
+		if ((rc = sqlite3_exec(db, ss.str().c_str(), nullptr, nullptr, nullptr)) != SQLITE_OK)
+			return rc;
+
+		created = true;
+	}
+
+	std::ostringstream ss;
+	ss << "INSERT INTO " << name << " (log_id, pad_id, license, event, date)"
+		" VALUES (?1, ?2, ?3, ?4, ?5);";
+
+	return sqlite3_prepare_v2(db, ss.str().c_str(), -1, &insert, nullptr);
+}
+
+/**
+ * Recreate the docking_log_all view over the archive tables and docking_log.
+ */
+static int rebuild_history_view(sqlite3* db)
+{
+	sqlite3_stmt* stmt;
+	int rc;
+
+	if ((rc = sqlite3_prepare_v2(db, 
+					"SELECT name FROM sqlite_master WHERE type = 'table' "
+					"AND name GLOB 'docking_log_[0-9][0-9][0-9][0-9][0-9][0-9]' ORDER BY name;",
+					-1, &stmt, nullptr)) != SQLITE_OK)
+		return rc;
+
+	std::ostringstream ss;
+	ss << "DROP VIEW IF EXISTS docking_log_all;"
+		"\nCREATE VIEW docking_log_all AS";
+
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		ss << "\n    SELECT log_id, pad_id, license, event, date FROM " 
+			<< sqlite3_column_text(stmt, 0) << " UNION ALL";
+	}
+
+	sqlite3_finalize(stmt);
+
+	ss << "\n    SELECT log_id, pad_id, license, event, date FROM docking_log;";
+
+	return sqlite3_exec(db, ss.str().c_str(), nullptr, nullptr, nullptr);
+}
+
+int archive_log(sqlite3*& db, char*& err, int64_t cutoff, size_t batch, size_t& moved)
+{
+	std::map<int, sqlite3_stmt*> inserts;
+	sqlite3_stmt* select = nullptr;
+	sqlite3_stmt* remove = nullptr;
+	bool created = false;
+	int64_t last = 0;
+	int rc;
+
+	moved = 0;
+
+	if ((rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, nullptr, &err)) != SQLITE_OK)
+		return rc;
+
+	// Entries are written in roughly date order, so the old ones are
+	// at the start of the table and found without an index on date.
+	if ((rc = sqlite3_prepare_v2(db,
+					"SELECT log_id, pad_id, license, event, date FROM docking_log "
+					"WHERE date < ?1 ORDER BY log_id LIMIT ?2;",
+					-1, &select, nullptr)) == SQLITE_OK)
+	{
+		sqlite3_bind_int64(select, 1, cutoff);
+		sqlite3_bind_int64(select, 2, batch);
+
+		while ((rc = sqlite3_step(select)) == SQLITE_ROW)
+		{
+			const int month = archive_month(sqlite3_column_int64(select, 4));
+			sqlite3_stmt*& insert = inserts[month];
+
+			if (!insert && (rc = prepare_archive(db, month, insert, created)) != SQLITE_OK)
+				break;
+
+			for (int i = 0; i < 5; i++)
+				sqlite3_bind_value(insert, i + 1, sqlite3_column_value(select, i));
+
+			rc = sqlite3_step(insert);
+			sqlite3_reset(insert);
+
+			if (rc != SQLITE_DONE)
+				break;
+
+			last = sqlite3_column_int64(select, 0);
+			moved++;
+		}
+	}
+
+	sqlite3_finalize(select);
+
+	for (auto& insert : inserts)
+		sqlite3_finalize(insert.second);
+
+	// The entries moved are exactly the old ones up to the last ID.
+	if (rc == SQLITE_DONE && moved > 0 
+			&& (rc = sqlite3_prepare_v2(db, 
+					"DELETE FROM docking_log WHERE log_id <= ?1 AND date < ?2;",
+					-1, &remove, nullptr)) == SQLITE_OK)
+	{
+		sqlite3_bind_int64(remove, 1, last);
+		sqlite3_bind_int64(remove, 2, cutoff);
+
+		rc = sqlite3_step(remove);
+		sqlite3_finalize(remove);
+	}
+
+	if (rc == SQLITE_DONE && created)
+		rc = (rebuild_history_view(db) == SQLITE_OK) ? SQLITE_DONE : SQLITE_ERROR;
+
+	if (rc == SQLITE_DONE || rc == SQLITE_OK)
+		rc = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, &err);
+	else
+		err = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+
+	if (rc != SQLITE_OK)
+	{
+		sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+		moved = 0;
+	}
+
+	return rc;
+}
+
+log_archiver::~log_archiver()
+{
+	if (_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			_stopping = true;
+		}
+
+		_stop.notify_all();
+		_thread.join();
+	}
+
+	sqlite3_close(_db);
+}
+
+int log_archiver::start(const char* path, int retention, size_t batch, 
+		std::chrono::seconds interval)
+{
+	int rc;
+
+	if ((rc = sqlite3_open_v2(path, &_db, 
+					SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, nullptr)) != SQLITE_OK)
+	{
+		fprintf(stderr, "Failed to open archive connection: %s\n", sqlite3_errmsg(_db));
+		return rc;
+	}
+
+	// Like the log writer, this competes with docking for the write lock.
+	sqlite3_busy_timeout(_db, 5000);
+
+	_retention = std::chrono::hours(24) * retention;
+	_batch = std::max<size_t>(1, batch);
+	_interval = interval;
+	_thread = std::thread(&log_archiver::run, this);
+
+	return SQLITE_OK;
+}
+
+void log_archiver::run()
+{
+	std::unique_lock<std::mutex> lock(_lock);
+
+	while (!_stopping)
+	{
+		archive(lock);
+		_stop.wait_for(lock, _interval, [this] { return _stopping; });
+	}
+}
+
+void log_archiver::archive(std::unique_lock<std::mutex>& lock)
+{
+	const auto now = std::chrono::system_clock::now().time_since_epoch();
+	const int64_t cutoff = std::chrono::duration_cast<std::chrono::milliseconds>(
+			now - _retention).count();
+
+	size_t moved;
+	size_t total = 0;
+	char* err;
+
+	do
+	{
+		lock.unlock();
+		int rc = archive_log(_db, err, cutoff, _batch, moved);
+		lock.lock();
+
+		if (rc != SQLITE_OK)
+		{
+			fprintf(stderr, "Failed to archive the docking log - %s\n", err);
+			sqlite3_free(err);
+			break;
+		}
+
+		total += moved;
+	}
+	// A short pause between batches lets waiting dockings take the lock.
+	while (moved == _batch 
+			&& !_stop.wait_for(lock, std::chrono::milliseconds(10), [this] { return _stopping; }));
+
+	if (total > 0)
+		fprintf(stdout, "Archived %lu docking log entries.\n", total);
+}
@@ -0,0 +1,112 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <sqlite3.h>
+
+/**
+ * Move docking log entries older than the cutoff out of docking_log,
+ * into one archive table per month (docking_log_YYYYMM, by UTC date),
+ * in a single transaction of at most batch entries. Archive tables are
+ * created as needed, indexed on (pad_id, date) and on license, and the
+ * docking_log_all view is recreated to cover every one of them.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @param cutoff Entries dated before this, in epoch milliseconds, are moved.
+ * @param batch The most entries to move.
+ * @param moved The number of entries moved.
+ * @return A SQLite response code.
+ */
+int archive_log(sqlite3*& db, char*& err, int64_t cutoff, size_t batch, size_t& moved);
+
+/**
+ * Keeps docking_log down to the most recent days from a background thread,
+ * archiving older entries in small batches so that the docking writer
+ * is never kept waiting for the write lock for long.
+ */
+class log_archiver
+{
+	public:
+
+		/**
+		 * Create a stopped archiver.
+		 */
+		log_archiver() = default;
+
+		/**
+		 * Stop the archiver thread, after the batch in progress.
+		 */
+		~log_archiver();
+
+		/**
+		 * Open a connection for archiving and start the archiver thread,
+		 * which archives right away and then on every interval.
+		 *
+		 * @param path The database file path.
+		 * @param retention The number of days of history to keep in docking_log.
+		 * @param batch The most entries to move per transaction.
+		 * @param interval How often to archive.
+		 * @return A SQLite response code.
+		 */
+		int start(const char* path, int retention, size_t batch, 
+				std::chrono::seconds interval);
+
+		/**
+		 * @return True if the archiver has been started.
+		 */
+		bool running() const { return _thread.joinable(); }
+
+	private:
+
+		/**
+		 * The archiver thread, which runs until the archiver is stopped.
+		 */
+		void run();
+
+		/**
+		 * Archive everything past the retention period, one batch at a time.
+		 * Called on the archiver thread with the lock held.
+		 */
+		void archive(std::unique_lock<std::mutex>& lock);
+
+		sqlite3* _db = nullptr;
+
+		std::chrono::milliseconds _retention { 0 };
+		std::chrono::seconds _interval { 3600 };
+		size_t _batch = 5000;
+
+		bool _stopping = false;
+
+		std::mutex _lock;
+		std::condition_variable _stop;
+		std::thread _thread;
+};
@@ -0,0 +1,776 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+// STL
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Relative
+#include "../histogram.h"
+#include "station.h"
+#include "../protocol.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+void print_usage()
+{
+	printf("SPACEPARK load generator\n"
+			"\nOpens many connections to a running server and sends it a mix of"
+			"\ndock queries, dock requests and undock requests, then reports"
+			"\nthroughput and latency percentiles per message type.\n"
+			"\nusage:\tspacepark-bench [-h] [-a <address>] [-p <port>] [-c <count>] [-t <count>]"
+			"\n\t\t[-d <seconds>] [-m <mix>] [-r <rate>] [-q <depth>] [-n <pads>] [-w <weight>] [-s <seed>] [-S]"
+		    "\noptions:"
+		    "\n\t-h:\t\tShows this help"
+			"\n\t-a <address>:\tServer IPv4 address (127.0.0.1)"
+			"\n\t-p <port>:\tServer port (5000)"
+			"\n\t-c <count>:\tNumber of connections (64)"
+			"\n\t-t <count>:\tNumber of client threads, sharing the connections (1)"
+			"\n\t-d <seconds>:\tHow long to run (10)"
+			"\n\t-m <mix>:\tShares of each message, as query:N,dock:N,undock:N (query:8,dock:1,undock:1)"
+			"\n\t-r <rate>:\tOpen loop: send this many requests per second in total,"
+			"\n\t\t\twhatever the responses. 0 for closed loop (0)"
+			"\n\t-q <depth>:\tClosed loop: requests outstanding per connection (1)"
+			"\n\t-n <pads>:\tDock and undock pads 1 to this number (1000)"
+			"\n\t-w <weight>:\tWeight of queried and docked ships (1)"
+			"\n\t-s <seed>:\tRandom seed (1)"
+			"\n\t-S:\t\tAsk the server for its own request statistics afterwards"
+			"\n"
+	      );
+}
+
+enum request_kind
+{
+	query,
+	dock,
+	undock,
+	kind_count
+};
+
+static const char* const kind_names[kind_count] = { "dock_query", "dock_request", "undock_request" };
+
+struct bench_options
+{
+	sockaddr_in address {};
+	int connections = 64;
+	int threads = 1;
+	int seconds = 10;
+	double mix[kind_count] = { 8, 1, 1 };
+	double rate = 0;
+	int depth = 1;
+	int pads = 1000;
+	float weight = 1;
+	uint64_t seed = 1;
+	bool server_stats = false;
+};
+
+/**
+ * What one thread (and then all of them) saw.
+ */
+struct bench_result
+{
+	latency_histogram latency[kind_count];
+
+	/// Responses with a non-zero result, or no free pad.
+	uint64_t failed[kind_count] = {};
+
+	uint64_t sent = 0;
+	uint64_t refused = 0;
+	uint64_t errors = 0;
+
+	void merge(const bench_result& other)
+	{
+		for (int i = 0; i < kind_count; i++)
+		{
+			latency[i].merge(other.latency[i]);
+			failed[i] += other.failed[i];
+		}
+
+		sent += other.sent;
+		refused += other.refused;
+		errors += other.errors;
+	}
+};
+
+/**
+ * A request waiting for its response.
+ */
+struct pending
+{
+	bench_clock::time_point sent;
+	request_kind kind;
+	int pad;
+};
+
+struct client_connection
+{
+	int fd = -1;
+	bool closed = false;
+	bool writing = false;
+
+	std::vector<char> rx;
+	std::vector<char> tx;
+	size_t tx_sent = 0;
+
+	std::unordered_map<unsigned, pending> in_flight;
+};
+
+/**
+ * One client thread, driving its share of the connections from its own epoll loop.
+ */
+class bench_thread
+{
+	public:
+
+		bench_thread(const bench_options& options, int index, int connections)
+			: _options(options), _index(index), _connections(connections),
+			_rng(options.seed * 0x100000001b3 + index)
+		{
+			for (int i = 0; i < kind_count; i++)
+				_mix_total += options.mix[i];
+		}
+
+		void run(bench_clock::time_point start, bench_clock::time_point end);
+
+		const bench_result& result() const { return _result; }
+
+	private:
+
+		bool connect_all();
+		void send_request(client_connection& con, bench_clock::time_point intended);
+		void flush(client_connection& con);
+		void receive(client_connection& con, bench_clock::time_point end);
+		void handle(client_connection& con, const msg_head& head, const char* data);
+
+		const bench_options& _options;
+		const int _index;
+
+		std::vector<client_connection> _connections;
+		station_rng _rng;
+		double _mix_total = 0;
+
+		int _epfd = -1;
+		unsigned _next_id = 1;
+		uint64_t _next_license = 0;
+
+		/// Pads this thread has docked a ship at, to undock from.
+		std::vector<int> _docked;
+
+		bench_result _result;
+};
+
+bool bench_thread::connect_all()
+{
+	for (auto& con : _connections)
+	{
+		if ((con.fd = socket(AF_INET, SOCK_STREAM, 0)) < 0
+				|| connect(con.fd, reinterpret_cast<const sockaddr*>(&_options.address),
+					sizeof(_options.address)) < 0)
+		{
+			perror("Failed to connect");
+			return false;
+		}
+
+		// Requests are small and must not wait for each other.
+		int flag = 1;
+		setsockopt(con.fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+		epoll_event ev {};
+		ev.events = EPOLLIN;
+		ev.data.ptr = &con;
+
+		if (epoll_ctl(_epfd, EPOLL_CTL_ADD, con.fd, &ev) < 0)
+		{
+			perror("Failed to add connection to epoll");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void bench_thread::send_request(client_connection& con, bench_clock::time_point intended)
+{
+	// Pick a message type by its share.
+	double share = _rng.uniform() * _mix_total;
+	request_kind kind = query;
+
+	for (int i = 0; i < kind_count; i++)
+	{
+		if ((share -= _options.mix[i]) < 0)
+		{
+			kind = static_cast<request_kind>(i);
+			break;
+		}
+	}
+
+	const unsigned id = _next_id++;
+	int pad = 1 + _rng.below(_options.pads);
+
+	// Undock ships this thread docked, when there are any.
+	if (kind == undock && !_docked.empty())
+	{
+		const size_t i = _rng.below(_docked.size());
+		pad = _docked[i];
+		_docked[i] = _docked.back();
+		_docked.pop_back();
+	}
+
+	const size_t offset = con.tx.size();
+
+	if (kind == query)
+	{
+		dock_query_msg msg { msg_head { sizeof(dock_query_msg), id, msg_type::dock_query },
+			_options.weight };
+
+		con.tx.resize(offset + sizeof(msg));
+		memcpy(con.tx.data() + offset, &msg, sizeof(msg));
+	}
+	else
+	{
+		dock_change_request_msg msg {};
+		msg.head = msg_head { sizeof(dock_change_request_msg), id,
+			(kind == dock) ? msg_type::dock_request : msg_type::undock_request };
+		msg.dock_id = pad;
+		msg.weight = _options.weight;
+		snprintf(msg.license, sizeof(msg.license), "BENCH-%d-%llu",
+				_index, (unsigned long long) _next_license++);
+
+		con.tx.resize(offset + sizeof(msg));
+		memcpy(con.tx.data() + offset, &msg, sizeof(msg));
+	}
+
+	con.in_flight.emplace(id, pending { intended, kind, pad });
+	_result.sent++;
+}
+
+void bench_thread::flush(client_connection& con)
+{
+	while (con.tx_sent < con.tx.size())
+	{
+		const ssize_t sent = send(con.fd, con.tx.data() + con.tx_sent,
+				con.tx.size() - con.tx_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+		if (sent < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				con.closed = true;
+				_result.errors++;
+			}
+
+			break;
+		}
+
+		con.tx_sent += sent;
+	}
+
+	if (con.tx_sent == con.tx.size())
+	{
+		con.tx.clear();
+		con.tx_sent = 0;
+	}
+
+	// Only wait for the socket to drain while something is left.
+	const bool writing = !con.tx.empty() && !con.closed;
+
+	if (writing != con.writing)
+	{
+		epoll_event ev {};
+		ev.events = writing ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+		ev.data.ptr = &con;
+		epoll_ctl(_epfd, EPOLL_CTL_MOD, con.fd, &ev);
+		con.writing = writing;
+	}
+}
+
+void bench_thread::handle(client_connection& con, const msg_head& head, const char* data)
+{
+	if (head.type == msg_type::connection_refused)
+	{
+		_result.refused++;
+		con.closed = true;
+		return;
+	}
+
+	auto it = con.in_flight.find(head.id);
+
+	if (it == con.in_flight.end())
+		return;
+
+	const pending request = it->second;
+	con.in_flight.erase(it);
+
+	const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			bench_clock::now() - request.sent).count();
+
+	_result.latency[request.kind].record(latency);
+
+	bool ok = false;
+
+	switch (head.type)
+	{
+		case msg_type::dock_query_response:
+		{
+			dock_query_response_msg rsp;
+			memcpy(&rsp, data, sizeof(rsp));
+			ok = (rsp.dock_id > 0);
+			break;
+		}
+		case msg_type::dock_response:
+		{
+			dock_response_msg rsp;
+			memcpy(&rsp, data, sizeof(rsp));
+
+			if ((ok = (rsp.response == 0)))
+				_docked.push_back(request.pad);
+
+			break;
+		}
+		case msg_type::undock_response:
+		{
+			undock_response_msg rsp;
+			memcpy(&rsp, data, sizeof(rsp));
+			ok = (rsp.response == 0);
+			break;
+		}
+		default:
+			break;
+	}
+
+	if (!ok)
+		_result.failed[request.kind]++;
+}
+
+void bench_thread::receive(client_connection& con, bench_clock::time_point end)
+{
+	char buffer[16 * 1024];
+	ssize_t length;
+
+	while ((length = recv(con.fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+		con.rx.insert(con.rx.end(), buffer, buffer + length);
+
+	if (length == 0 || (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+	{
+		con.closed = true;
+		_result.errors++;
+	}
+
+	size_t offset = 0;
+	size_t answered = 0;
+
+	while (con.rx.size() - offset >= sizeof(msg_head))
+	{
+		msg_head head;
+		memcpy(&head, con.rx.data() + offset, sizeof(head));
+
+		if (head.length < sizeof(msg_head) || head.length > max_message_len)
+		{
+			_result.errors++;
+			con.closed = true;
+			break;
+		}
+
+		if (con.rx.size() - offset < head.length)
+			break;
+
+		// Short responses are read as if zero-padded.
+		char data[max_message_len] = {};
+		memcpy(data, con.rx.data() + offset, head.length);
+
+		handle(con, head, data);
+		offset += head.length;
+		answered++;
+	}
+
+	con.rx.erase(con.rx.begin(), con.rx.begin() + offset);
+
+	// In a closed loop, every response makes room for the next request.
+	if (_options.rate == 0 && bench_clock::now() < end && !con.closed)
+	{
+		for (size_t i = 0; i < answered; i++)
+			send_request(con, bench_clock::now());
+
+		flush(con);
+	}
+}
+
+void bench_thread::run(bench_clock::time_point start, bench_clock::time_point end)
+{
+	if ((_epfd = epoll_create1(0)) < 0 || !connect_all())
+	{
+		_result.errors++;
+		return;
+	}
+
+	const double rate = _options.rate / _options.threads;
+	const auto interval = std::chrono::duration_cast<bench_clock::duration>(
+			std::chrono::duration<double>((rate > 0) ? 1 / rate : 0));
+
+	auto next_send = start;
+	size_t next_con = 0;
+
+	std::this_thread::sleep_until(start);
+
+	if (rate == 0)
+	{
+		for (auto& con : _connections)
+		{
+			for (int i = 0; i < _options.depth; i++)
+				send_request(con, bench_clock::now());
+
+			flush(con);
+		}
+	}
+
+	epoll_event events[64];
+
+	for (;;)
+	{
+		auto now = bench_clock::now();
+
+		if (now >= end)
+			break;
+
+		// In an open loop, requests go out on schedule, and their latency
+		// counts from when they should have been sent, so a slow server
+		// can't hide its stalls by holding back the requests.
+		if (rate > 0)
+		{
+			while (next_send <= now)
+			{
+				auto& con = _connections[next_con++ % _connections.size()];
+
+				if (!con.closed)
+				{
+					send_request(con, next_send);
+					flush(con);
+				}
+
+				next_send += interval;
+			}
+		}
+
+		const auto wake = (rate > 0) ? std::min(next_send, end) : end;
+		const int timeout = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(
+					wake - now).count());
+
+		const int ready = epoll_wait(_epfd, events, 64, timeout);
+
+		for (int i = 0; i < ready; i++)
+		{
+			auto& con = *static_cast<client_connection*>(events[i].data.ptr);
+
+			if (events[i].events & EPOLLOUT)
+				flush(con);
+
+			if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				receive(con, end);
+
+			if (con.closed && con.fd >= 0)
+			{
+				epoll_ctl(_epfd, EPOLL_CTL_DEL, con.fd, nullptr);
+				close(con.fd);
+				con.fd = -1;
+			}
+		}
+	}
+
+	for (auto& con : _connections)
+	{
+		if (con.fd >= 0)
+			close(con.fd);
+	}
+
+	close(_epfd);
+}
+
+/**
+ * Parse a message mix, as KIND:SHARE pairs separated by commas.
+ */
+static bool parse_mix(const char* arg, bench_options& options)
+{
+	char kind[16];
+	double share;
+	int length;
+
+	std::fill(std::begin(options.mix), std::end(options.mix), 0);
+
+	while (sscanf(arg, "%15[a-z]:%lf%n", kind, &share, &length) == 2 && share >= 0)
+	{
+		if (strcmp(kind, "query") == 0)
+			options.mix[query] = share;
+		else if (strcmp(kind, "dock") == 0)
+			options.mix[dock] = share;
+		else if (strcmp(kind, "undock") == 0)
+			options.mix[undock] = share;
+		else
+			return false;
+
+		arg += length;
+
+		if (*arg == '\0')
+			return true;
+
+		if (*arg++ != ',')
+			break;
+	}
+
+	return false;
+}
+
+static void report(const char* name, const latency_histogram& latency, uint64_t failed, double seconds)
+{
+	fprintf(stdout, "%-16s%10llu%12.0f%10llu%10.1f%10.1f%10.1f%10.1f\n", name,
+			(unsigned long long) latency.count(), latency.count() / seconds,
+			(unsigned long long) failed,
+			latency.percentile(0.5) / 1e3, latency.percentile(0.99) / 1e3,
+			latency.percentile(0.999) / 1e3, latency.max() / 1e3);
+}
+
+/**
+ * Ask the server for its request statistics, on a connection of its own,
+ * and print them next to what the client saw.
+ */
+static bool report_server(const bench_options& options)
+{
+	const int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&options.address), 
+				sizeof(options.address)) < 0)
+	{
+		fprintf(stderr, "Failed to connect for server statistics: %s\n", strerror(errno));
+
+		if (fd >= 0)
+			close(fd);
+
+		return false;
+	}
+
+	const msg_head request { sizeof(msg_head), 0, msg_type::stats_request };
+	stats_response_msg rsp {};
+	size_t received = 0;
+
+	if (send(fd, &request, sizeof(request), 0) == sizeof(request))
+	{
+		ssize_t n;
+
+		while (received < sizeof(rsp) 
+				&& (n = recv(fd, reinterpret_cast<char*>(&rsp) + received, sizeof(rsp) - received, 0)) > 0)
+			received += n;
+	}
+
+	close(fd);
+
+	if (received < sizeof(rsp) || rsp.head.type != msg_type::stats_response)
+	{
+		fprintf(stderr, "The server didn't answer the statistics request.\n");
+		return false;
+	}
+
+	fprintf(stdout, "\nServer side, over %.1f seconds of uptime:\n"
+			"%-16s%10s%12s%10s%10s%10s%10s%10s\n", rsp.uptime_ms / 1e3,
+			"message", "requests", "", "failed", "p50 us", "p99 us", "p999 us", "max us");
+
+	auto row = [](const char* name, uint64_t count, uint64_t failed, const latency_summary& s)
+	{
+		fprintf(stdout, "%-16s%10llu%12s%10llu%10.1f%10.1f%10.1f%10.1f\n", name,
+				(unsigned long long) count, "", (unsigned long long) failed,
+				s.p50 / 1e3, s.p99 / 1e3, s.p999 / 1e3, s.max / 1e3);
+	};
+
+	for (int i = 0; i < kind_count; i++)
+	{
+		const request_stats& k = rsp.kinds[i];
+
+		if (k.requests == 0)
+			continue;
+
+		row(kind_names[i], k.requests, k.failed, k.request);
+
+		if (k.sqlite.count > 0)
+			row("  sqlite", k.sqlite.count, 0, k.sqlite);
+	}
+
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	bench_options options;
+	const char* address = "127.0.0.1";
+	int port = 5000;
+	int c;
+
+	while ((c = getopt(argc, argv, "ha:p:c:t:d:m:r:q:n:w:s:S")) != -1)
+	{
+		switch (c)
+		{
+			case 'h':
+				print_usage();
+				return EXIT_SUCCESS;
+			case 'a':
+				address = optarg;
+				break;
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 'c':
+				options.connections = atoi(optarg);
+				break;
+			case 't':
+				options.threads = atoi(optarg);
+				break;
+			case 'd':
+				options.seconds = atoi(optarg);
+				break;
+			case 'm':
+				if (!parse_mix(optarg, options))
+				{
+					fprintf(stderr, "Invalid message mix '%s'.\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'r':
+				options.rate = atof(optarg);
+				break;
+			case 'q':
+				options.depth = atoi(optarg);
+				break;
+			case 'n':
+				options.pads = atoi(optarg);
+				break;
+			case 'w':
+				options.weight = atof(optarg);
+				break;
+			case 's':
+				options.seed = strtoull(optarg, nullptr, 10);
+				break;
+			case 'S':
+				options.server_stats = true;
+				break;
+			default:
+				print_usage();
+				return EXIT_FAILURE;
+		}
+	}
+
+	options.address.sin_family = AF_INET;
+	options.address.sin_port = htons(port);
+
+	if (inet_pton(AF_INET, address, &options.address.sin_addr) != 1)
+	{
+		fprintf(stderr, "Invalid address '%s'.\n", address);
+		return EXIT_FAILURE;
+	}
+
+	if (options.threads < 1 || options.connections < options.threads
+			|| options.seconds < 1 || options.depth < 1 || options.pads < 1 || options.rate < 0
+			|| options.mix[query] + options.mix[dock] + options.mix[undock] <= 0)
+	{
+		fprintf(stderr, "Specify at least one thread, connection per thread, second, "
+				"request in flight, pad and message type.\n");
+		return EXIT_FAILURE;
+	}
+
+	std::vector<bench_thread> clients;
+	std::vector<std::thread> threads;
+
+	clients.reserve(options.threads);
+
+	for (int i = 0; i < options.threads; i++)
+	{
+		const int share = options.connections / options.threads
+			+ (i < options.connections % options.threads);
+
+		clients.emplace_back(options, i, share);
+	}
+
+	fprintf(stdout, "%d connections on %d threads, %s loop",
+			options.connections, options.threads, (options.rate > 0) ? "open" : "closed");
+
+	if (options.rate > 0)
+		fprintf(stdout, " at %.0f requests/s", options.rate);
+	else
+		fprintf(stdout, " with %d requests in flight per connection", options.depth);
+
+	fprintf(stdout, ", for %d seconds.\n\n", options.seconds);
+
+	// Everybody connects first, then starts at the same time.
+	const auto start = bench_clock::now() + std::chrono::milliseconds(500);
+	const auto end = start + std::chrono::seconds(options.seconds);
+
+	for (auto& client : clients)
+		threads.emplace_back([&client, start, end] { client.run(start, end); });
+
+	for (auto& thread : threads)
+		thread.join();
+
+	bench_result total;
+	latency_histogram all;
+
+	for (auto& client : clients)
+		total.merge(client.result());
+
+	fprintf(stdout, "%-16s%10s%12s%10s%10s%10s%10s%10s\n",
+			"message", "responses", "per second", "failed", "p50 us", "p99 us", "p999 us", "max us");
+
+	uint64_t failed = 0;
+
+	for (int i = 0; i < kind_count; i++)
+	{
+		if (options.mix[i] > 0)
+			report(kind_names[i], total.latency[i], total.failed[i], options.seconds);
+
+		all.merge(total.latency[i]);
+		failed += total.failed[i];
+	}
+
+	report("all", all, failed, options.seconds);
+
+	fprintf(stdout, "\n%llu requests sent, %llu unanswered, %llu connections refused, %llu errors.\n",
+			(unsigned long long) total.sent, (unsigned long long) (total.sent - all.count()),
+			(unsigned long long) total.refused, (unsigned long long) total.errors);
+
+	if (options.server_stats && !report_server(options))
+		return EXIT_FAILURE;
+
+	return (total.errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
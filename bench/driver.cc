@@ -0,0 +1,204 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include "driver.h"
+#include "../db.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <new>
+#include <string>
+
+//
+// Allocation counting, of both C++ and SQLite allocations on every thread.
+//
+
+static std::atomic<bool> counting { false };
+static std::atomic<uint64_t> cxx_allocations { 0 };
+static std::atomic<uint64_t> cxx_bytes { 0 };
+static std::atomic<uint64_t> sqlite_allocations { 0 };
+static std::atomic<uint64_t> sqlite_bytes { 0 };
+
+void* operator new(size_t size)
+{
+	if (counting.load(std::memory_order_relaxed))
+	{
+		cxx_allocations.fetch_add(1, std::memory_order_relaxed);
+		cxx_bytes.fetch_add(size, std::memory_order_relaxed);
+	}
+
+	if (void* p = malloc(size ? size : 1))
+		return p;
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+static sqlite3_mem_methods sqlite_default_mem;
+
+static void* sqlite_counting_malloc(int size)
+{
+	sqlite_allocations.fetch_add(1, std::memory_order_relaxed);
+	sqlite_bytes.fetch_add(size, std::memory_order_relaxed);
+	return sqlite_default_mem.xMalloc(size);
+}
+
+static void* sqlite_counting_realloc(void* p, int size)
+{
+	sqlite_allocations.fetch_add(1, std::memory_order_relaxed);
+	sqlite_bytes.fetch_add(size, std::memory_order_relaxed);
+	return sqlite_default_mem.xRealloc(p, size);
+}
+
+bool count_allocations()
+{
+	sqlite3_mem_methods counted;
+
+	counting = true;
+
+	if (sqlite3_config(SQLITE_CONFIG_GETMALLOC, &sqlite_default_mem) != SQLITE_OK)
+		return false;
+
+	counted = sqlite_default_mem;
+	counted.xMalloc = sqlite_counting_malloc;
+	counted.xRealloc = sqlite_counting_realloc;
+
+	return sqlite3_config(SQLITE_CONFIG_MALLOC, &counted) == SQLITE_OK;
+}
+
+//
+// Benchmark driver
+//
+
+method_result measure(const char* name, int calls, const std::function<void(int)>& method)
+{
+	method_result result { name, calls, 0, {}, 0, 0, 0, 0 };
+
+	const uint64_t cxx_before = cxx_allocations.load();
+	const uint64_t cxx_bytes_before = cxx_bytes.load();
+	const uint64_t sqlite_before = sqlite_allocations.load();
+	const uint64_t sqlite_bytes_before = sqlite_bytes.load();
+
+	const auto start = bench_clock::now();
+	auto last = start;
+
+	for (int i = 0; i < calls; i++)
+	{
+		method(i);
+
+		const auto now = bench_clock::now();
+		result.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count());
+		last = now;
+	}
+
+	result.seconds = std::chrono::duration<double>(last - start).count();
+
+	// The histogram itself allocates nothing while recording.
+	result.cxx_allocations = cxx_allocations.load() - cxx_before;
+	result.cxx_bytes = cxx_bytes.load() - cxx_bytes_before;
+	result.sqlite_allocations = sqlite_allocations.load() - sqlite_before;
+	result.sqlite_bytes = sqlite_bytes.load() - sqlite_bytes_before;
+
+	return result;
+}
+
+void measure_docking(int count, const std::function<void(int, const char*)>& dock,
+		const std::function<void(int)>& undock, std::vector<method_result>& results)
+{
+	// Made up front, so they aren't part of the measurement.
+	std::vector<std::string> licenses(count);
+
+	for (int i = 0; i < count; i++)
+		licenses[i] = "BENCH " + std::to_string(i);
+
+	results.push_back(measure("dock_ship", count, [&](int i)
+	{
+		dock(i, licenses[i].c_str());
+	}));
+
+	results.push_back(measure("undock_ship", count, undock));
+}
+
+server_options serial_options()
+{
+	server_options options;
+
+	// Calls are made one at a time, so waiting for
+	// other writes to join a commit would only add latency.
+	options.commit_window = 0;
+
+	return options;
+}
+
+sqlite3* open_station(const station_spec& spec, const char* path)
+{
+	sqlite3* db;
+	char* err;
+
+	unlink(path);
+
+	if (sqlite3_open(path, &db))
+	{
+		fprintf(stderr, "Failed to open database: %s\n", sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return nullptr;
+	}
+
+	if (generate_station(db, err, spec, nullptr) || set_pragma(db, err, "foreign_keys", "ON"))
+	{
+		fprintf(stderr, "Failed to generate station - %s\n", err);
+		sqlite3_free(err);
+		sqlite3_close(db);
+		return nullptr;
+	}
+
+	return db;
+}
+
+bool split_pads(const parking_server& server, uint64_t pads,
+		std::vector<int>& occupied, std::vector<int>& vacant)
+{
+	for (uint64_t pad = 1; pad <= pads; pad++)
+		(server.dock_is_free(pad) ? vacant : occupied).push_back(pad);
+
+	if (occupied.empty() || vacant.empty())
+	{
+		fprintf(stderr, "The station needs both free and occupied pads.\n");
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,110 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <sqlite3.h>
+
+#include "station.h"
+#include "../histogram.h"
+#include "../parksrv.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+/**
+ * What was measured for one method.
+ */
+struct method_result
+{
+	const char* method;
+	int calls;
+	double seconds;
+	latency_histogram latency;
+	uint64_t cxx_allocations;
+	uint64_t cxx_bytes;
+	uint64_t sqlite_allocations;
+	uint64_t sqlite_bytes;
+
+	/**
+	 * @return The number of calls per second.
+	 */
+	double rate() const { return calls / seconds; }
+};
+
+/**
+ * Start counting C++ and SQLite allocations on every thread, since
+ * docking is committed on the writer thread. Until then, they're
+ * measured as 0. Must be called before SQLite is used.
+ *
+ * @return False if SQLite's allocations can't be counted.
+ */
+bool count_allocations();
+
+/**
+ * Time each of a number of calls to a method, and count its allocations.
+ *
+ * @param name The name of the method.
+ * @param calls The number of calls to make.
+ * @param method The method, called with the call index.
+ */
+method_result measure(const char* name, int calls, const std::function<void(int)>& method);
+
+/**
+ * Time docking a ship at each of a number of free pads, and then
+ * undocking them all again. Every free pad can take one ship,
+ * so docking is measured on distinct pads and undone by undocking.
+ *
+ * @param count The number of pads to dock at.
+ * @param dock Called with the call index and a license to dock.
+ * @param undock Called with the call index to undock.
+ * @param results Where the dock and undock results are added.
+ */
+void measure_docking(int count, const std::function<void(int, const char*)>& dock,
+		const std::function<void(int)>& undock, std::vector<method_result>& results);
+
+/**
+ * @return Server options for calls made one at a time.
+ */
+server_options serial_options();
+
+/**
+ * Generate a station in a new scratch database, replacing any old one.
+ *
+ * @param spec What the station looks like.
+ * @param path The path of the scratch database.
+ * @return The connection, or nullptr if it couldn't be generated.
+ */
+sqlite3* open_station(const station_spec& spec, const char* path);
+
+/**
+ * Sort the pads of a station into those with a ship docked and those without.
+ *
+ * @return False unless there are both.
+ */
+bool split_pads(const parking_server& server, uint64_t pads,
+		std::vector<int>& occupied, std::vector<int>& vacant);
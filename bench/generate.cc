@@ -0,0 +1,197 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <unistd.h>
+
+// STL
+#include <chrono>
+
+// Externals
+#include <sqlite3.h>
+
+// Relative
+#include "station.h"
+#include "../db.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+void print_usage()
+{
+	printf("SPACEPARK station generator\n"
+			"\nCreates a database with a synthetic station for load and scale testing."
+			"\nThe same options and seed always give the same database.\n"
+			"\nusage:\tspacepark-generate [-h] [-s <seed>] [-t <count>] [-p <count>]"
+			"\n\t\t[-w <weights>] [-o <ratio>] [-l <count>] [-y <days>] [-n <time>] <path>"
+		    "\noptions:"
+		    "\n\t-h:\t\tShows this help"
+			"\n\t-s <seed>:\tRandom seed (1)"
+			"\n\t-t <count>:\tNumber of terminals (10)"
+			"\n\t-p <count>:\tNumber of landing pads (1000)"
+			"\n\t-w <weights>:\tPad weight limits and their shares, as WEIGHT:SHARE,... (50:6,200:3,1000:1)"
+			"\n\t-o <ratio>:\tFraction of pads with a ship docked (0.5)"
+			"\n\t-l <count>:\tNumber of docking log rows (0)"
+			"\n\t-y <days>:\tDays of history in the log and docking times (90)"
+			"\n\t-n <time>:\tThe time to date back from, in epoch milliseconds"
+			"\n\t\t\t(1767225600000, the start of 2026)"
+			"\n"
+	      );
+}
+
+/**
+ * Parse weight classes, as WEIGHT:SHARE pairs separated by commas.
+ */
+static bool parse_weights(const char* arg, station_spec& spec)
+{
+	double weight, share;
+	int length;
+
+	spec.weights.clear();
+
+	while (sscanf(arg, "%lf:%lf%n", &weight, &share, &length) == 2 && weight > 0 && share >= 0)
+	{
+		spec.weights.emplace_back(weight, share);
+		arg += length;
+
+		if (*arg == '\0')
+			return true;
+
+		if (*arg++ != ',')
+			break;
+	}
+
+	return false;
+}
+
+int main(int argc, char* argv[])
+{
+	station_spec spec;
+	int c;
+
+	while ((c = getopt(argc, argv, "hs:t:p:w:o:l:y:n:")) != -1)
+	{
+		switch (c)
+		{
+			case 'h':
+				print_usage();
+				return EXIT_SUCCESS;
+			case 's':
+				spec.seed = strtoull(optarg, nullptr, 10);
+				break;
+			case 't':
+				spec.terminals = strtoull(optarg, nullptr, 10);
+				break;
+			case 'p':
+				spec.pads = strtoull(optarg, nullptr, 10);
+				break;
+			case 'w':
+				if (!parse_weights(optarg, spec))
+				{
+					fprintf(stderr, "Invalid weight classes '%s'.\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'o':
+				spec.occupancy = atof(optarg);
+				break;
+			case 'l':
+				spec.log_rows = strtoull(optarg, nullptr, 10);
+				break;
+			case 'y':
+				spec.history_days = atoi(optarg);
+				break;
+			case 'n':
+				spec.now = strtoll(optarg, nullptr, 10);
+				break;
+			default:
+				print_usage();
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	const char* db_path = argv[optind];
+
+	if (access(db_path, F_OK) == 0)
+	{
+		fprintf(stderr, "%s already exists.\n", db_path);
+		return EXIT_FAILURE;
+	}
+
+	sqlite3* db;
+
+	if (sqlite3_open(db_path, &db))
+	{
+		fprintf(stderr, "Failed to open database: %s\n", sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stdout, "Generating %llu terminals, %llu pads (%.0f%% occupied) and %llu log rows "
+			"from seed %llu...\n",
+			(unsigned long long) spec.terminals, (unsigned long long) spec.pads,
+			spec.occupancy * 100, (unsigned long long) spec.log_rows,
+			(unsigned long long) spec.seed);
+
+	const auto start = bench_clock::now();
+
+	auto progress = [start](const char* table, uint64_t rows)
+	{
+		const std::chrono::duration<double> elapsed = bench_clock::now() - start;
+
+		if (rows == 0)
+			fprintf(stdout, "%8.1f s\tbuilding %s\n", elapsed.count(), table);
+		else
+			fprintf(stdout, "%8.1f s\t%llu %s\n", elapsed.count(), (unsigned long long) rows, table);
+	};
+
+	char* err;
+	int rc = generate_station(db, err, spec, progress);
+
+	if (rc != SQLITE_OK)
+	{
+		fprintf(stderr, "Failed to generate station - %s\n", err);
+		sqlite3_free(err);
+		sqlite3_close(db);
+		unlink(db_path);
+		return EXIT_FAILURE;
+	}
+
+	sqlite3_close(db);
+
+	const std::chrono::duration<double> elapsed = bench_clock::now() - start;
+	const uint64_t rows = spec.terminals + spec.pads + spec.log_rows;
+
+	fprintf(stdout, "Generated %s in %.1f seconds (%.0f rows/s, not counting ships).\n",
+			db_path, elapsed.count(), rows / elapsed.count());
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,472 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+// STL
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Externals
+#include <sqlite3.h>
+
+// Relative
+#include "driver.h"
+#include "station.h"
+#include "../parksrv.h"
+#include "../protocol.h"
+
+void print_usage()
+{
+	printf("SPACEPARK event loop benchmark\n"
+			"\nCompares the cost of one server wakeup in the old select() loop and"
+			"\nthe server's epoll reactor, answering dock queries from one active"
+			"\nclient with 64, 1k and 10k idle connections open.\n"
+			"\nusage:\tspacepark-bench-loop [-h] [-i <count>] [-p <port>] [-d <path>]"
+		    "\noptions:"
+		    "\n\t-h:\t\tShows this help"
+			"\n\t-i <count>:\tNumber of wakeups to measure per run (20000)"
+			"\n\t-p <port>:\tPort to serve on (5100)"
+			"\n\t-d <path>:\tPath of the scratch database (removed afterwards)"
+			"\n"
+	      );
+}
+
+/**
+ * The select() loop as it was before the epoll reactor, from
+ * parking_server::open. Only the parts a dock query goes through
+ * are kept, and the client table is sized for the run instead of
+ * max_clients. Its log line per response is left out, since the
+ * reactor only logs responses when asked to.
+ *
+ * @param server Answers the dock queries.
+ * @param master_socket A listening socket.
+ * @param table The size of the client table.
+ * @param stopping Checked once per wakeup.
+ * @return False if a client's descriptor didn't fit in an fd_set.
+ */
+static bool select_loop(parking_server& server, int master_socket, size_t table, 
+		const std::atomic<bool>& stopping)
+{
+	std::vector<int> client_sockets(table, 0);
+	struct sockaddr_in address {};
+	socklen_t addrlen = sizeof(address);
+	char data[buffer_size];
+	int new_socket, valread, sd;
+	bool fits = true;
+
+	fd_set readfds;
+
+	while (!stopping)
+	{
+		// Clear socket set and add master socket.
+		FD_ZERO(&readfds);
+		FD_SET(master_socket, &readfds);
+		int max_sd = master_socket;
+
+		// Add client sockets to set.
+		for (size_t i = 0; i < table; i++)
+		{
+			sd = client_sockets[i];
+
+			if (sd > 0)
+				FD_SET(sd, &readfds);
+
+			if (sd > max_sd)
+				max_sd = sd;
+		}
+
+		// Select a FD ready for I/O
+		if (select(max_sd + 1, &readfds, nullptr, nullptr, nullptr) < 0 && errno != EINTR)
+			fprintf(stderr, "A non-fatal selector error occurred!\n");
+
+		if (FD_ISSET(master_socket, &readfds))
+		{
+			if ((new_socket = accept(master_socket, 
+							reinterpret_cast<struct sockaddr*>(&address), &addrlen)) < 0)
+				return fits;
+
+			// select() can't watch it, so the old loop can't be measured here.
+			if (new_socket >= FD_SETSIZE)
+			{
+				close(new_socket);
+				fits = false;
+			}
+
+			for (size_t i = 0; i < table && new_socket < FD_SETSIZE; i++)
+			{
+				if (client_sockets[i] == 0)
+				{
+					client_sockets[i] = new_socket;
+					break;
+				}
+			}
+		}
+
+		// Loop through all clients and act on those
+		// who are connected (i.e FD is set)
+		for (size_t i = 0; i < table; i++)
+		{
+			sd = client_sockets[i];
+
+			if (sd == 0 || !FD_ISSET(sd, &readfds))
+				continue;
+
+			if ((valread = read(sd, data, sizeof(data))) <= 0)
+			{
+				close(sd);
+				client_sockets[i] = 0;
+			}
+			else if (static_cast<size_t>(valread) >= sizeof(dock_query_msg))
+			{
+				dock_query_msg msg {};
+				memcpy(&msg, data, sizeof(msg)); 
+
+				if (msg.head.type != msg_type::dock_query)
+					continue;
+
+				const size_t rsp_bytes = sizeof(dock_query_response_msg);
+
+				dock_query_response_msg rsp 
+				{
+					msg_head { rsp_bytes, msg.head.id, msg_type::dock_query_response }, 
+					server.get_free_dock(msg.weight)
+				};
+
+				send(sd, &rsp, rsp_bytes, 0);
+			}
+		}
+	}
+
+	for (int sd : client_sockets)
+	{
+		if (sd > 0)
+			close(sd);
+	}
+
+	return fits;
+}
+
+/**
+ * @return A socket connected to the local port, or -1.
+ */
+static int connect_to(int port)
+{
+	struct sockaddr_in address {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+
+	const int sd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (sd > -1 && connect(sd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0)
+	{
+		close(sd);
+		return -1;
+	}
+
+	return sd;
+}
+
+/**
+ * Idle connections, held by a child process so the server
+ * process only spends one descriptor on each of them.
+ */
+struct idle_clients
+{
+	pid_t pid = -1;
+
+	/// Closed to make the child hang up and exit.
+	int release = -1;
+};
+
+/**
+ * Open idle connections from a child process, and wait for them.
+ *
+ * @return The number of connections opened.
+ */
+static int open_idle(int port, int count, idle_clients& idle)
+{
+	int ready[2], release[2];
+
+	if (pipe(ready) < 0 || pipe(release) < 0)
+		return 0;
+
+	if ((idle.pid = fork()) == 0)
+	{
+		close(ready[0]);
+		close(release[1]);
+
+		int opened = 0;
+
+		while (opened < count && connect_to(port) > -1)
+			opened++;
+
+		// Hold them until released, then exit with them.
+		char byte;
+
+		if (write(ready[1], &opened, sizeof(opened)) == sizeof(opened))
+			while (read(release[0], &byte, 1) > 0);
+
+		_exit(EXIT_SUCCESS);
+	}
+
+	close(ready[1]);
+	close(release[0]);
+	idle.release = release[1];
+
+	int opened = 0;
+
+	if (idle.pid < 0 || read(ready[0], &opened, sizeof(opened)) != sizeof(opened))
+		opened = 0;
+
+	close(ready[0]);
+	return opened;
+}
+
+static void close_idle(idle_clients& idle)
+{
+	close(idle.release);
+
+	if (idle.pid > 0)
+		waitpid(idle.pid, nullptr, 0);
+}
+
+/**
+ * Send dock queries one at a time and wait for each answer,
+ * so every query is one wakeup of the server loop.
+ *
+ * @return The mean round trip in nanoseconds, or -1 on failure.
+ */
+static double query_loop(int port, int iterations)
+{
+	int sd = -1;
+
+	// The server may still be getting ready.
+	for (int attempt = 0; attempt < 100 && (sd = connect_to(port)) < 0; attempt++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	if (sd < 0)
+		return -1;
+
+	const int one = 1;
+	setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	dock_query_msg msg { msg_head { sizeof(dock_query_msg), 0, msg_type::dock_query }, 1 };
+	dock_query_response_msg rsp {};
+
+	// The first queries warm up, and let the accepts settle.
+	const int warmup = iterations / 10;
+	auto start = bench_clock::now();
+
+	for (int i = 0; i < warmup + iterations; i++)
+	{
+		if (i == warmup)
+			start = bench_clock::now();
+
+		msg.head.id = i;
+
+		if (send(sd, &msg, sizeof(msg), 0) != sizeof(msg) 
+				|| recv(sd, &rsp, sizeof(rsp), MSG_WAITALL) != sizeof(rsp))
+		{
+			close(sd);
+			return -1;
+		}
+	}
+
+	const std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - start;
+	close(sd);
+
+	return elapsed.count() / iterations;
+}
+
+/**
+ * Measure the old select() loop with a number of idle clients.
+ *
+ * @return Nanoseconds per wakeup, or -1 if it can't watch that many.
+ */
+static double measure_select(sqlite3* db, int port, int idle, int iterations)
+{
+	parking_server server(db, serial_options());
+	const int listener = socket(AF_INET, SOCK_STREAM, 0);
+	const int opt = 1;
+
+	struct sockaddr_in address {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = INADDR_ANY;
+	address.sin_port = htons(port);
+
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+	if (!server.ready() || bind(listener, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0
+			|| listen(listener, SOMAXCONN) < 0)
+	{
+		fprintf(stderr, "Failed to listen on %d.\n", port);
+		close(listener);
+		return -1;
+	}
+
+	std::atomic<bool> stopping { false };
+	bool fits = true;
+
+	std::thread loop([&] { fits = select_loop(server, listener, idle + 1, stopping); });
+
+	idle_clients clients;
+	open_idle(port, idle, clients);
+
+	const double ns = query_loop(port, iterations);
+
+	// Hanging up wakes the loop to see it's stopping.
+	stopping = true;
+	close_idle(clients);
+	loop.join();
+	close(listener);
+
+	return fits ? ns : -1;
+}
+
+/**
+ * Measure the server's own event loop with a number of idle clients.
+ *
+ * @return Nanoseconds per wakeup, or -1 on failure.
+ */
+static double measure_epoll(sqlite3* db, int port, int idle, int iterations)
+{
+	server_options options = serial_options();
+	options.max_clients = idle + 16;
+
+	parking_server server(db, options);
+
+	if (!server.ready())
+		return -1;
+
+	std::thread loop([&] { server.open(port, port); });
+
+	idle_clients clients;
+	open_idle(port, idle, clients);
+
+	const double ns = query_loop(port, iterations);
+
+	close_idle(clients);
+	server.stop();
+	loop.join();
+
+	return ns;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* db_path = "spacepark-bench-loop.db";
+	int iterations = 20000;
+	int port = 5100;
+	int c;
+
+	while ((c = getopt(argc, argv, "hi:p:d:")) != -1)
+	{
+		switch (c)
+		{
+			case 'h':
+				print_usage();
+				return EXIT_SUCCESS;
+			case 'i':
+				iterations = atoi(optarg);
+				break;
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 'd':
+				db_path = optarg;
+				break;
+			default:
+				print_usage();
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (iterations < 1)
+	{
+		fprintf(stderr, "Specify at least one wakeup.\n");
+		return EXIT_FAILURE;
+	}
+
+	// 10k idle clients need more descriptors than the usual soft limit.
+	struct rlimit lim {};
+
+	if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+	{
+		lim.rlim_cur = lim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &lim);
+	}
+
+	station_spec spec;
+	sqlite3* db = open_station(spec, db_path);
+
+	if (db == nullptr)
+		return EXIT_FAILURE;
+
+	// The server reports every connection on stdout, the results go to the real one.
+	FILE* out = fdopen(dup(STDOUT_FILENO), "w");
+
+	if (out == nullptr || freopen("/dev/null", "w", stdout) == nullptr)
+	{
+		fprintf(stderr, "Failed to redirect the server output.\n");
+		sqlite3_close_v2(db);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(out, "%8s\t%12s\t%12s\n", "idle", "select ns", "epoll ns");
+
+	for (int idle : { 64, 1000, 10000 })
+	{
+		const double select_ns = measure_select(db, port, idle, iterations);
+		const double epoll_ns = measure_epoll(db, port, idle, iterations);
+
+		if (select_ns < 0)
+			fprintf(out, "%8d\t%12s\t%12.0f\n", idle, "n/a", epoll_ns);
+		else
+			fprintf(out, "%8d\t%12.0f\t%12.0f\n", idle, select_ns, epoll_ns);
+
+		fflush(out);
+	}
+
+	fclose(out);
+	sqlite3_close_v2(db);
+	unlink(db_path);
+
+	return EXIT_SUCCESS;
+}
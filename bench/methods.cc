@@ -0,0 +1,302 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <vector>
+
+// Externals
+#include <sqlite3.h>
+
+// Relative
+#include "driver.h"
+#include "station.h"
+#include "../parksrv.h"
+
+void print_usage()
+{
+	printf("SPACEPARK server method benchmark\n"
+			"\nMeasures requests per second for each parking_server query method,"
+			"\nbefore (SQL text built and executed on every call) and after"
+			"\n(prepared statements).\n"
+			"\nusage:\tspacepark-bench-methods [-h] [-n <count>] [-p <count>] [-d <path>]"
+		    "\noptions:"
+		    "\n\t-h:\t\tShows this help"
+			"\n\t-n <count>:\tNumber of calls per method"
+			"\n\t-p <count>:\tNumber of landing pads in the database"
+			"\n\t-d <path>:\tPath of the scratch database (removed afterwards)"
+			"\n"
+	      );
+}
+
+//
+// The methods as they were before the statement cache,
+// building the SQL text and executing it on every call.
+// Dates follow the current schema (INTEGER milliseconds).
+//
+
+/// The current time in epoch milliseconds, as SQL.
+#define LEGACY_NOW "CAST((JulianDay('NOW') - 2440587.5) * 86400000 AS INTEGER)"
+
+static int get_first_as_integer(void* var, int, char** argv, char**)
+{
+	*reinterpret_cast<int*>(var) = atoi(argv[0]);
+	return EXIT_SUCCESS;
+}
+
+static int get_first_as_integer_not_zero(void* var, int, char** argv, char**)
+{
+	return (*reinterpret_cast<int*>(var) = atoi(argv[0])) == 0;
+}
+
+static int row_exists_callback(void*, int, char**, char**)
+{
+	return EXIT_FAILURE;
+}
+
+static int legacy_exec(sqlite3* db, const char* statement,
+		sqlite3_callback callback, void* arg)
+{
+	char* err = nullptr;
+	int rc = sqlite3_exec(db, statement, callback, arg, &err);
+	sqlite3_free(err);
+	return rc;
+}
+
+static int legacy_get_free_dock(sqlite3* db, float weight)
+{
+	char* statement;
+	int dock = -1;
+
+	if (asprintf(&statement,
+			"SELECT pad_id FROM pads "
+			"WHERE pad_id NOT IN ("
+			"SELECT pad_id FROM ships) "
+			"AND max_weight > %f "
+			"LIMIT 1;", weight) > 0)
+	{
+		legacy_exec(db, statement, get_first_as_integer_not_zero, &dock);
+		free(statement);
+	}
+
+	return dock;
+}
+
+static bool legacy_dock_is_free(sqlite3* db, int id)
+{
+	char* statement;
+	int rc = -1;
+
+	if (asprintf(&statement, "SELECT pad_id FROM ships WHERE pad_id = %d;", id) > 0)
+	{
+		rc = legacy_exec(db, statement, row_exists_callback, nullptr);
+		free(statement);
+	}
+
+	return (rc == SQLITE_OK);
+}
+
+static int legacy_get_seconds_docked(sqlite3* db, int id)
+{
+	char* statement;
+	int seconds = -1;
+
+	if (asprintf(&statement,
+					"SELECT (" LEGACY_NOW " - date) / 1000 "
+					"FROM ships "
+					"WHERE pad_id = %d;", id) > 0)
+	{
+		legacy_exec(db, statement, get_first_as_integer, &seconds);
+		free(statement);
+	}
+
+	return seconds;
+}
+
+static int legacy_get_fee(sqlite3* db, int id)
+{
+	char* statement;
+	int fee = -1;
+
+	if (asprintf(&statement,
+					"WITH span AS ("
+					"\n    SELECT"
+					"\n    (" LEGACY_NOW " - date) / 86400000.0"
+					"\n    AS days"
+					"\n    FROM ships"
+					"\n    WHERE pad_id = %d"
+					"\n    )"
+					"\nSELECT"
+					"\nCASE"
+					"\n    WHEN days > 1 THEN"
+					"\n    ROUND(days + 0.5) * cost_day"
+					"\n    ELSE"
+					"\n    ROUND(days * 24 + 0.5) * cost_hour"
+					"\n    END fee"
+					"\nFROM pads, span"
+					"\nWHERE pad_id = %d", id, id) > 0)
+	{
+		legacy_exec(db, statement, get_first_as_integer, &fee);
+		free(statement);
+	}
+
+	return fee;
+}
+
+static int legacy_dock_ship(sqlite3* db, int id, float weight, const char* license)
+{
+	char* statement;
+	int rc = -1;
+
+	if (asprintf(&statement,
+					"INSERT INTO ships (pad_id, weight, license, date) "
+					"VALUES (%d, %f, '%s', " LEGACY_NOW ");", id, weight, license) > 0)
+	{
+		rc = legacy_exec(db, statement, nullptr, nullptr);
+		free(statement);
+	}
+
+	return rc;
+}
+
+static int legacy_undock_ship(sqlite3* db, int id)
+{
+	char* statement;
+
+	if (asprintf(&statement, "DELETE FROM ships WHERE pad_id = %d;", id) > 0)
+	{
+		legacy_exec(db, statement, nullptr, nullptr);
+		free(statement);
+	}
+
+	return (sqlite3_changes(db) > 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void report(const method_result& before, const method_result& after)
+{
+	fprintf(stdout, "%-20s\t%12.0f\t%12.0f\t%6.2fx\n", 
+			before.method, before.rate(), after.rate(), after.rate() / before.rate());
+}
+
+int main(int argc, char* argv[])
+{
+	const char* db_path = "spacepark-bench.db";
+	int calls = 10000;
+	int pads = 1000;
+	int c;
+
+	while ((c = getopt(argc, argv, "hn:p:d:")) != -1)
+	{
+		switch (c)
+		{
+			case 'h':
+				print_usage();
+				return EXIT_SUCCESS;
+			case 'n':
+				calls = atoi(optarg);
+				break;
+			case 'p':
+				pads = atoi(optarg);
+				break;
+			case 'd':
+				db_path = optarg;
+				break;
+			default:
+				print_usage();
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (calls < 1 || pads < 2)
+	{
+		fprintf(stderr, "Specify at least one call and two pads.\n");
+		return EXIT_FAILURE;
+	}
+
+	station_spec spec;
+	spec.pads = pads;
+
+	sqlite3* db = open_station(spec, db_path);
+
+	if (db == nullptr)
+		return EXIT_FAILURE;
+
+	parking_server server(db, serial_options());
+	std::vector<int> occupied, vacant;
+
+	if (!server.ready() || !split_pads(server, pads, occupied, vacant))
+	{
+		sqlite3_close_v2(db);
+		unlink(db_path);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(stdout, "%d pads, %d calls per method.\n\n", pads, calls);
+	fprintf(stdout, "%-20s\t%12s\t%12s\t%7s\n", "method", "before rps", "after rps", "speedup");
+
+	auto occupied_pad = [&](int i) { return occupied[i % occupied.size()]; };
+	std::vector<method_result> before, after;
+
+	before.push_back(measure("get_free_dock", calls, [&](int i) { legacy_get_free_dock(db, i % 500); }));
+	after.push_back(measure("get_free_dock", calls, [&](int i) { server.get_free_dock(i % 500); }));
+
+	before.push_back(measure("dock_is_free", calls, [&](int i) { legacy_dock_is_free(db, occupied_pad(i)); }));
+	after.push_back(measure("dock_is_free", calls, [&](int i) { server.dock_is_free(occupied_pad(i)); }));
+
+	before.push_back(measure("get_seconds_docked", calls, [&](int i) 
+	{ 
+		legacy_get_seconds_docked(db, occupied_pad(i)); 
+	}));
+
+	after.push_back(measure("get_seconds_docked", calls, [&](int i) 
+	{ 
+		server.get_seconds_docked(occupied_pad(i)); 
+	}));
+
+	before.push_back(measure("get_fee", calls, [&](int i) { legacy_get_fee(db, occupied_pad(i)); }));
+	after.push_back(measure("get_fee", calls, [&](int i) { server.get_fee(occupied_pad(i)); }));
+
+	const int changes = std::min<size_t>(calls, vacant.size());
+
+	measure_docking(changes, 
+			[&](int i, const char* license) { legacy_dock_ship(db, vacant[i], 1, license); },
+			[&](int i) { legacy_undock_ship(db, vacant[i]); }, before);
+
+	measure_docking(changes, 
+			[&](int i, const char* license) { server.dock_ship(vacant[i], 1, license); },
+			[&](int i) { server.undock_ship(vacant[i]); }, after);
+
+	for (size_t i = 0; i < before.size(); i++)
+		report(before[i], after[i]);
+
+	sqlite3_close_v2(db);
+	unlink(db_path);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,262 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+
+// STL
+#include <algorithm>
+#include <vector>
+
+// Externals
+#include <sqlite3.h>
+
+// Relative
+#include "driver.h"
+#include "station.h"
+#include "../parksrv.h"
+
+void print_usage()
+{
+	printf("SPACEPARK server method scaling benchmark\n"
+			"\nGenerates stations of increasing size, and measures the latency and"
+			"\nallocations per call of each parking_server method against each one."
+			"\nResults are written as JSON, progress to stderr.\n"
+			"\nusage:\tspacepark-bench-scale [-h] [-n <count>] [-p <sizes>] [-o <ratio>]"
+			"\n\t\t[-f <engine>] [-s <seed>] [-d <path>] [-j <path>]"
+		    "\noptions:"
+		    "\n\t-h:\t\tShows this help"
+			"\n\t-n <count>:\tNumber of calls per method and size (10000)"
+			"\n\t-p <sizes>:\tStation sizes in pads, comma separated (1000,10000,100000)"
+			"\n\t-o <ratio>:\tFraction of pads with a ship docked (0.5)"
+			"\n\t-f <engine>:\tFee engine, native or sql (native)"
+			"\n\t-s <seed>:\tRandom seed of the stations and calls (1)"
+			"\n\t-d <path>:\tPath of the scratch database (removed afterwards)"
+			"\n\t-j <path>:\tWrite the results here instead of stdout"
+			"\n"
+	      );
+}
+
+static void write_result(FILE* out, uint64_t pads, const method_result& r, bool first)
+{
+	fprintf(out, "%s\n\t\t{ \"pads\": %llu, \"method\": \"%s\", \"calls\": %d, "
+			"\"calls_per_second\": %.0f, \"mean_ns\": %.0f, "
+			"\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu, "
+			"\"allocations_per_call\": %.3f, \"bytes_per_call\": %.1f, "
+			"\"sqlite_allocations_per_call\": %.3f, \"sqlite_bytes_per_call\": %.1f }",
+			first ? "" : ",", (unsigned long long) pads, r.method, r.calls,
+			r.rate(), r.seconds * 1e9 / r.calls,
+			(unsigned long long) r.latency.percentile(0.5),
+			(unsigned long long) r.latency.percentile(0.99),
+			(unsigned long long) r.latency.percentile(0.999),
+			(unsigned long long) r.latency.max(),
+			double(r.cxx_allocations) / r.calls, double(r.cxx_bytes) / r.calls,
+			double(r.sqlite_allocations) / r.calls, double(r.sqlite_bytes) / r.calls);
+}
+
+/**
+ * Generate a station and measure every method against it.
+ *
+ * @return False if the station couldn't be generated or served.
+ */
+static bool run_station(const station_spec& spec, const server_options& options, int calls,
+		const char* db_path, std::vector<method_result>& results)
+{
+	sqlite3* db = open_station(spec, db_path);
+
+	if (db == nullptr)
+		return false;
+
+	parking_server server(db, options);
+
+	if (!server.ready())
+	{
+		sqlite3_close_v2(db);
+		return false;
+	}
+
+	// Sort the pads out before measuring anything.
+	std::vector<int> occupied, vacant;
+
+	if (!split_pads(server, spec.pads, occupied, vacant))
+	{
+		sqlite3_close_v2(db);
+		return false;
+	}
+
+	station_rng rng(spec.seed);
+	std::vector<int> random_pads(calls);
+
+	for (auto& pad : random_pads)
+		pad = 1 + rng.below(spec.pads);
+
+	const double heaviest = spec.weights.back().first;
+	auto occupied_pad = [&](int i) { return occupied[(i * 7919ull) % occupied.size()]; };
+
+	results.push_back(measure("get_free_dock", calls, [&](int i)
+	{
+		server.get_free_dock(heaviest * (i % 1000) / 1000);
+	}));
+
+	results.push_back(measure("dock_is_free", calls, [&](int i)
+	{
+		server.dock_is_free(random_pads[i]);
+	}));
+
+	results.push_back(measure("get_seconds_docked", calls, [&](int i)
+	{
+		server.get_seconds_docked(occupied_pad(i));
+	}));
+
+	results.push_back(measure("get_fee", calls, [&](int i)
+	{
+		server.get_fee(occupied_pad(i));
+	}));
+
+	measure_docking(std::min<size_t>(calls, vacant.size()), 
+			[&](int i, const char* license) { server.dock_ship(vacant[i], 1, license); },
+			[&](int i) { server.undock_ship(vacant[i]); }, results);
+
+	sqlite3_close_v2(db);
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* db_path = "spacepark-bench-scale.db";
+	const char* json_path = nullptr;
+	std::vector<uint64_t> sizes { 1000, 10000, 100000 };
+	station_spec spec;
+	server_options options = serial_options();
+	int calls = 10000;
+	int c;
+
+	// Before anything touches SQLite.
+	const bool sqlite_counted = count_allocations();
+
+	while ((c = getopt(argc, argv, "hn:p:o:f:s:d:j:")) != -1)
+	{
+		switch (c)
+		{
+			case 'h':
+				print_usage();
+				return EXIT_SUCCESS;
+			case 'n':
+				calls = atoi(optarg);
+				break;
+			case 'p':
+			{
+				char* p = optarg;
+				char* end;
+
+				sizes.clear();
+
+				while (sizes.push_back(strtoull(p, &end, 10)), end != p && *end == ',')
+					p = end + 1;
+
+				if (end == p || *end != '\0')
+					sizes.clear();
+
+				break;
+			}
+			case 'o':
+				spec.occupancy = atof(optarg);
+				break;
+			case 'f':
+				options.native_fees = (strcmp(optarg, "sql") != 0);
+				break;
+			case 's':
+				spec.seed = strtoull(optarg, nullptr, 10);
+				break;
+			case 'd':
+				db_path = optarg;
+				break;
+			case 'j':
+				json_path = optarg;
+				break;
+			default:
+				print_usage();
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (calls < 1 || sizes.empty() || std::find(sizes.begin(), sizes.end(), 0) != sizes.end())
+	{
+		fprintf(stderr, "Specify at least one call and station size.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!sqlite_counted)
+		fprintf(stderr, "Failed to count SQLite allocations, they will show as 0.\n");
+
+	spec.terminals = 10;
+
+	FILE* out = json_path ? fopen(json_path, "w") : stdout;
+
+	if (out == nullptr)
+	{
+		perror("Failed to open the results file");
+		return EXIT_FAILURE;
+	}
+
+	fprintf(out, "{\n\t\"benchmark\": \"spacepark-bench-scale\",\n"
+			"\t\"seed\": %llu,\n\t\"occupancy\": %.3f,\n\t\"fee_engine\": \"%s\",\n"
+			"\t\"results\":\n\t[",
+			(unsigned long long) spec.seed, spec.occupancy, options.native_fees ? "native" : "sql");
+
+	bool first = true;
+	int status = EXIT_SUCCESS;
+
+	for (uint64_t pads : sizes)
+	{
+		std::vector<method_result> results;
+
+		spec.pads = pads;
+		fprintf(stderr, "Measuring %llu pads...\n", (unsigned long long) pads);
+
+		if (!run_station(spec, options, calls, db_path, results))
+		{
+			status = EXIT_FAILURE;
+			break;
+		}
+
+		for (const auto& result : results)
+		{
+			write_result(out, pads, result, first);
+			first = false;
+		}
+	}
+
+	fprintf(out, "\n\t]\n}\n");
+
+	if (out != stdout)
+		fclose(out);
+
+	unlink(db_path);
+
+	return status;
+}
@@ -0,0 +1,245 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include "station.h"
+#include "../db.h"
+
+#include <stdio.h>
+
+#include <chrono>
+
+/// Rows per transaction, and between progress reports.
+static const uint64_t station_batch = 1 << 20;
+
+static const char* const manufacturers[] =
+{
+	"Tonto Turbo", "Weyland-Yutani", "Kuat Drive Yards", "Tyrell", "Blue Sun"
+};
+
+/**
+ * Commit and start a new transaction every batch rows.
+ */
+static int maybe_commit(sqlite3*& db, char*& err, uint64_t row, const char* table,
+		const std::function<void(const char*, uint64_t)>& progress)
+{
+	if (row % station_batch != 0)
+		return SQLITE_OK;
+
+	if (progress)
+		progress(table, row);
+
+	return sqlite3_exec(db, "COMMIT; BEGIN;", nullptr, nullptr, &err);
+}
+
+static int step(sqlite3*& db, char*& err, sqlite3_stmt* stmt)
+{
+	const int rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+
+	if (rc == SQLITE_DONE)
+		return SQLITE_OK;
+
+	err = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+	return rc;
+}
+
+/**
+ * Insert the terminals, and the pads with their ships.
+ */
+static int generate_pads(sqlite3*& db, char*& err, const station_spec& spec, station_rng& rng,
+		const std::function<void(const char*, uint64_t)>& progress)
+{
+	sqlite3_stmt* terminal = nullptr;
+	sqlite3_stmt* pad = nullptr;
+	sqlite3_stmt* ship = nullptr;
+	int rc;
+
+	if ((rc = sqlite3_prepare_v2(db, "INSERT INTO terminals (terminal_id, name) VALUES (?1, ?2);",
+					-1, &terminal, nullptr)) != SQLITE_OK
+			|| (rc = sqlite3_prepare_v2(db,
+					"INSERT INTO pads (pad_id, terminal_id, max_weight) VALUES (?1, ?2, ?3);",
+					-1, &pad, nullptr)) != SQLITE_OK
+			|| (rc = sqlite3_prepare_v2(db,
+					"INSERT INTO ships (pad_id, license, manufacturer, weight, date)"
+					" VALUES (?1, ?2, ?3, ?4, ?5);",
+					-1, &ship, nullptr)) != SQLITE_OK)
+	{
+		err = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+	}
+
+	double total_share = 0;
+
+	for (const auto& weight : spec.weights)
+		total_share += weight.second;
+
+	const int64_t history = int64_t(spec.history_days) * 86400000;
+	char text[32];
+
+	for (uint64_t i = 1; i <= spec.terminals && rc == SQLITE_OK; i++)
+	{
+		snprintf(text, sizeof(text), "Terminal %llu", (unsigned long long) i);
+
+		sqlite3_bind_int64(terminal, 1, i);
+		sqlite3_bind_text(terminal, 2, text, -1, SQLITE_TRANSIENT);
+		rc = step(db, err, terminal);
+	}
+
+	for (uint64_t i = 1; i <= spec.pads && rc == SQLITE_OK; i++)
+	{
+		// Pick a weight class by its share.
+		double share = rng.uniform() * total_share;
+		double max_weight = spec.weights.back().first;
+
+		for (const auto& weight : spec.weights)
+		{
+			if ((share -= weight.second) < 0)
+			{
+				max_weight = weight.first;
+				break;
+			}
+		}
+
+		sqlite3_bind_int64(pad, 1, i);
+		sqlite3_bind_int64(pad, 2, 1 + (i - 1) * spec.terminals / spec.pads);
+		sqlite3_bind_double(pad, 3, max_weight);
+
+		if ((rc = step(db, err, pad)) != SQLITE_OK)
+			break;
+
+		if (rng.uniform() < spec.occupancy)
+		{
+			snprintf(text, sizeof(text), "GEN-%09llu", (unsigned long long) i);
+
+			sqlite3_bind_int64(ship, 1, i);
+			sqlite3_bind_text(ship, 2, text, -1, SQLITE_TRANSIENT);
+			sqlite3_bind_text(ship, 3, manufacturers[rng.below(5)], -1, SQLITE_STATIC);
+			sqlite3_bind_double(ship, 4, max_weight * (0.1 + 0.9 * rng.uniform()));
+			sqlite3_bind_int64(ship, 5, spec.now - rng.below(history + 1));
+
+			if ((rc = step(db, err, ship)) != SQLITE_OK)
+				break;
+		}
+
+		rc = maybe_commit(db, err, i, "pads", progress);
+	}
+
+	sqlite3_finalize(terminal);
+	sqlite3_finalize(pad);
+	sqlite3_finalize(ship);
+
+	return rc;
+}
+
+/**
+ * Insert the docking log, as ships docking at random pads
+ * and undocking again half a step later.
+ */
+static int generate_log(sqlite3*& db, char*& err, const station_spec& spec, station_rng& rng,
+		const std::function<void(const char*, uint64_t)>& progress)
+{
+	sqlite3_stmt* log;
+	int rc;
+
+	if ((rc = sqlite3_prepare_v2(db,
+					"INSERT INTO docking_log (log_id, pad_id, license, event, date)"
+					" VALUES (?1, ?2, ?3, ?4, ?5);",
+					-1, &log, nullptr)) != SQLITE_OK)
+	{
+		err = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+		return rc;
+	}
+
+	const int64_t history = int64_t(spec.history_days) * 86400000;
+	const double interval = double(history) / (spec.log_rows + 1);
+	char license[32];
+
+	for (uint64_t i = 1; i <= spec.log_rows && rc == SQLITE_OK; i++)
+	{
+		const bool dock = (i % 2 == 1);
+
+		// The undocking ship is the one that just docked.
+		if (dock)
+		{
+			snprintf(license, sizeof(license), "HIST-%011llu", (unsigned long long) (i + 1) / 2);
+			sqlite3_bind_int64(log, 2, 1 + rng.below(spec.pads));
+			sqlite3_bind_text(log, 3, license, -1, SQLITE_TRANSIENT);
+		}
+
+		sqlite3_bind_int64(log, 1, i);
+		sqlite3_bind_text(log, 4, dock ? "dock" : "undock", -1, SQLITE_STATIC);
+		sqlite3_bind_int64(log, 5, spec.now - history + int64_t(interval * i));
+
+		if ((rc = step(db, err, log)) == SQLITE_OK)
+			rc = maybe_commit(db, err, i, "docking_log", progress);
+	}
+
+	sqlite3_finalize(log);
+
+	return rc;
+}
+
+int generate_station(sqlite3*& db, char*& err, const station_spec& spec,
+		const std::function<void(const char*, uint64_t)>& progress)
+{
+	station_rng rng(spec.seed);
+	int rc;
+
+	if (spec.pads == 0 || spec.terminals == 0 || spec.weights.empty())
+	{
+		err = sqlite3_mprintf("A station needs terminals, pads and weight classes");
+		return SQLITE_MISUSE;
+	}
+
+	// Nothing to roll back to in a new database, so skip the journal.
+	// The log index is built once at the end, instead of row by row,
+	// and the triggers are left out until everything is in.
+	if ((rc = set_pragma(db, err, "journal_mode", "OFF")) != SQLITE_OK
+			|| (rc = set_pragma(db, err, "synchronous", "OFF")) != SQLITE_OK
+			|| (rc = init_terminals(db, err)) != SQLITE_OK
+			|| (rc = init_pads(db, err)) != SQLITE_OK
+			|| (rc = init_ships(db, err)) != SQLITE_OK
+			|| (rc = init_log(db, err)) != SQLITE_OK
+			|| (rc = init_meta(db, err)) != SQLITE_OK
+			|| (rc = sqlite3_exec(db, "DROP INDEX docking_log_pad; BEGIN;",
+					nullptr, nullptr, &err)) != SQLITE_OK)
+		return rc;
+
+	if ((rc = generate_pads(db, err, spec, rng, progress)) != SQLITE_OK
+			|| (rc = generate_log(db, err, spec, rng, progress)) != SQLITE_OK
+			|| (rc = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, &err)) != SQLITE_OK)
+	{
+		sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+		return rc;
+	}
+
+	if (progress)
+		progress("indexes", 0);
+
+	if ((rc = init_log(db, err)) != SQLITE_OK
+			|| (rc = init_triggers(db, err)) != SQLITE_OK
+			|| (rc = set_schema_version(db, err)) != SQLITE_OK)
+		return rc;
+
+	return set_pragma(db, err, "journal_mode", "DELETE");
+}
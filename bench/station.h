@@ -0,0 +1,119 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+#include <sqlite3.h>
+
+/**
+ * A small, fast random number generator (splitmix64) whose sequence is
+ * the same on every platform and standard library, unlike the
+ * distributions of <random>, so that a seed always gives the same station.
+ */
+class station_rng
+{
+	public:
+
+		explicit station_rng(uint64_t seed) : _state(seed) { }
+
+		/**
+		 * @return The next 64 random bits.
+		 */
+		uint64_t next()
+		{
+			uint64_t z = (_state += 0x9e3779b97f4a7c15);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+			return z ^ (z >> 31);
+		}
+
+		/**
+		 * @return A number in [0, 1).
+		 */
+		double uniform() { return (next() >> 11) * 0x1.0p-53; }
+
+		/**
+		 * @return A number in [0, bound).
+		 */
+		uint64_t below(uint64_t bound) { return static_cast<uint64_t>(uniform() * bound); }
+
+	private:
+
+		uint64_t _state;
+};
+
+/**
+ * What a generated station looks like, see generate_station().
+ */
+struct station_spec
+{
+	/// Seeds everything random about the station.
+	uint64_t seed = 1;
+
+	uint64_t terminals = 10;
+	uint64_t pads = 1000;
+
+	/// Pairs of pad weight limit and its share of the pads (any scale).
+	std::vector<std::pair<double, double>> weights { { 50, 6 }, { 200, 3 }, { 1000, 1 } };
+
+	/// The fraction of pads with a ship docked.
+	double occupancy = 0.5;
+
+	/// The number of docking_log rows, in dock and undock pairs.
+	uint64_t log_rows = 0;
+
+	/// How many days back the docking log and docking times go.
+	int history_days = 90;
+
+	/// The time everything is dated back from, in epoch milliseconds.
+	/// Fixed by default rather than the current time, so that the same
+	/// spec always gives the same station. 2026-01-01 00:00 UTC.
+	int64_t now = 1767225600000;
+};
+
+/**
+ * Fill an empty database with a synthetic station, with the current schema
+ * and triggers. Pads are spread evenly over the terminals in blocks of
+ * consecutive IDs, with their weight limits drawn from the weight classes.
+ * Each pad has a ship docked with the occupancy probability, weighing
+ * between a tenth of and the whole weight limit, docked within the history.
+ * The docking log is spread evenly over the history, oldest first.
+ *
+ * The same spec always gives the same rows. The database is written without
+ * a rollback journal, so a failure leaves it unusable.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection to an empty database.
+ * @param err The error char string returned by SQLite.
+ * @param spec The station to generate.
+ * @param progress Called every million rows or so, with the table being filled
+ *                 and how many rows of it are done. May be empty.
+ * @return A SQLite response code.
+ */
+int generate_station(sqlite3*& db, char*& err, const station_spec& spec,
+		const std::function<void(const char*, uint64_t)>& progress);
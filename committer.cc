@@ -0,0 +1,205 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include "committer.h"
+
+#include <cstdio>
+
+#include <algorithm>
+
+#include "db.h"
+
+commit_queue::commit_queue(sqlite3* db, std::mutex& db_lock)
+	: _db(db), _db_lock(db_lock)
+{
+}
+
+commit_queue::~commit_queue()
+{
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		_stopping = true;
+	}
+
+	_arrived.notify_all();
+
+	if (_thread.joinable())
+		_thread.join();
+
+	sqlite3_finalize(_begin);
+	sqlite3_finalize(_commit);
+	sqlite3_finalize(_rollback);
+	sqlite3_finalize(_bump);
+}
+
+int commit_queue::start(std::chrono::microseconds window, size_t batch, uint64_t version)
+{
+	int rc;
+
+	// IMMEDIATE takes the write lock up front, so a batch never
+	// fails halfway through because another process got it first.
+	if ((rc = sqlite3_prepare_v2(_db, "BEGIN IMMEDIATE;", -1, &_begin, nullptr)) != SQLITE_OK
+			|| (rc = sqlite3_prepare_v2(_db, "COMMIT;", -1, &_commit, nullptr)) != SQLITE_OK
+			|| (rc = sqlite3_prepare_v2(_db, "ROLLBACK;", -1, &_rollback, nullptr)) != SQLITE_OK
+			|| (rc = sqlite3_prepare_v2(_db, 
+					"UPDATE meta SET value = value + 1 WHERE key = 'data_version' RETURNING value;", 
+					-1, &_bump, nullptr)) != SQLITE_OK)
+	{
+		fprintf(stderr, "SQL Error %d preparing transaction - %s\n", rc, sqlite3_errmsg(_db));
+		return rc;
+	}
+
+	_version = version;
+
+	_window = window;
+	_batch = std::max<size_t>(1, batch);
+	_thread = std::thread(&commit_queue::run, this);
+
+	return SQLITE_OK;
+}
+
+void commit_queue::submit(write_op&& op)
+{
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		_queue.push_back(std::move(op));
+	}
+
+	_arrived.notify_one();
+}
+
+void commit_queue::drain()
+{
+	std::unique_lock<std::mutex> lock(_lock);
+
+	_drained.wait(lock, [this] { return _queue.empty() && _running == 0; });
+}
+
+void commit_queue::run()
+{
+	std::vector<write_op> batch;
+	std::unique_lock<std::mutex> lock(_lock);
+
+	while (true)
+	{
+		_arrived.wait(lock, [this] { return _stopping || !_queue.empty(); });
+
+		if (_queue.empty())
+			break;
+
+		// Give other writes a moment to join the batch,
+		// unless it's already full or we're shutting down.
+		const auto deadline = std::chrono::steady_clock::now() + _window;
+
+		_arrived.wait_until(lock, deadline, [this] 
+		{ 
+			return _stopping || _queue.size() >= _batch; 
+		});
+
+		const size_t count = std::min(_queue.size(), _batch);
+
+		batch.assign(std::make_move_iterator(_queue.begin()), 
+				std::make_move_iterator(_queue.begin() + count));
+
+		_queue.erase(_queue.begin(), _queue.begin() + count);
+		_running = count;
+
+		lock.unlock();
+		commit(batch);
+		batch.clear();
+		lock.lock();
+
+		_running = 0;
+
+		if (_queue.empty())
+			_drained.notify_all();
+	}
+
+	_drained.notify_all();
+}
+
+void commit_queue::commit(std::vector<write_op>& batch)
+{
+	std::vector<int> results(batch.size());
+	uint64_t version = _version;
+	bool stale = false;
+	int rc;
+
+	{
+		std::lock_guard<std::mutex> db_lock(_db_lock);
+		const auto started = std::chrono::steady_clock::now();
+
+		rc = sqlite3_step(_begin);
+		sqlite3_reset(_begin);
+
+		if (rc == SQLITE_DONE)
+		{
+			// A failing write only undoes its own statement,
+			// the rest of the batch carries on.
+			for (size_t i = 0; i < batch.size(); i++)
+				results[i] = batch[i].execute();
+
+			// Only our own batches may have moved it on since the last one.
+			if (sqlite3_step(_bump) == SQLITE_ROW)
+				version = sqlite3_column_int64(_bump, 0);
+
+			stale = (version != _version + 1);
+
+			sqlite3_reset(_bump);
+
+			rc = sqlite3_step(_commit);
+			sqlite3_reset(_commit);
+
+			if (rc != SQLITE_DONE)
+			{
+				fprintf(stderr, "SQL Error %d committing %lu writes - %s\n", 
+						rc, batch.size(), sqlite3_errmsg(_db));
+
+				sqlite3_step(_rollback);
+				sqlite3_reset(_rollback);
+			}
+		}
+		else
+		{
+			fprintf(stderr, "SQL Error %d starting transaction - %s\n", rc, sqlite3_errmsg(_db));
+		}
+
+		_batch_time = std::chrono::steady_clock::now() - started;
+	}
+
+	// Nothing is reported until it's actually on disk.
+	for (size_t i = 0; i < batch.size(); i++)
+		batch[i].complete((rc == SQLITE_DONE) ? results[i] : rc);
+
+	if (rc != SQLITE_DONE)
+		return;
+
+	_version = version;
+
+	if (stale)
+		_stale = true;
+
+	if (_committed)
+		_committed(version);
+}
@@ -0,0 +1,166 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sqlite3.h>
+
+/**
+ * A database write, run by the commit queue.
+ */
+struct write_op
+{
+	/// Runs the write inside the batch transaction,
+	/// returning a result code for the caller.
+	std::function<int()> execute;
+
+	/// Called with the result code once the batch is committed,
+	/// or with the error code if the commit failed.
+	std::function<void(int)> complete;
+};
+
+/**
+ * Group commit for database writes.
+ * Writes are queued and run by a single writer thread, which gathers
+ * everything that arrives within a short window (or up to a batch size)
+ * into one transaction. That costs one journal sync per batch instead
+ * of one per write, while every caller still gets its own result.
+ * Every batch also bumps the data version of the database.
+ */
+class commit_queue
+{
+	public:
+
+		/**
+		 * Create a commit queue for the specified connection.
+		 *
+		 * @param db The writer connection.
+		 * @param db_lock Held while the connection is in use.
+		 */
+		commit_queue(sqlite3* db, std::mutex& db_lock);
+
+		/**
+		 * Commit everything still queued and stop the writer thread.
+		 */
+		~commit_queue();
+
+		/**
+		 * Start the writer thread.
+		 *
+		 * @param window How long to gather writes after the first one arrives.
+		 * @param batch The maximum number of writes per transaction.
+		 * @param version The data version the caller last read.
+		 * @return A SQLite response code.
+		 */
+		int start(std::chrono::microseconds window, size_t batch, uint64_t version);
+
+		/**
+		 * Queue a write. Its completion is called from the writer thread.
+		 *
+		 * @param op The write to queue.
+		 */
+		void submit(write_op&& op);
+
+		/**
+		 * Block until every queued write has completed.
+		 */
+		void drain();
+
+		/**
+		 * Set a function to call on the writer thread after every
+		 * committed batch, once all of its writes have completed.
+		 * Must be set before the queue is started.
+		 *
+		 * @param hook Called with the data version of the batch.
+		 */
+		void on_commit(std::function<void(uint64_t)> hook) { _committed = std::move(hook); }
+
+		/**
+		 * @return The data version of the last committed batch.
+		 */
+		uint64_t version() const { return _version; }
+
+		/**
+		 * @return Whether a batch found the data version bumped by someone
+		 * else, such as spacepark-config, since the caller last read it.
+		 * Anything kept in sync with the database may then be out of date.
+		 */
+		bool stale() const { return _stale; }
+
+		/**
+		 * @return How long the batch being completed spent in the database,
+		 * from BEGIN to COMMIT. Only meaningful from a completion.
+		 */
+		std::chrono::steady_clock::duration batch_time() const { return _batch_time; }
+
+	private:
+
+		/**
+		 * The writer thread, which runs until the queue is stopped.
+		 */
+		void run();
+
+		/**
+		 * Run a batch of writes in a single transaction.
+		 * Called on the writer thread with no locks held.
+		 */
+		void commit(std::vector<write_op>& batch);
+
+		sqlite3* _db;
+		std::mutex& _db_lock;
+
+		sqlite3_stmt* _begin = nullptr;
+		sqlite3_stmt* _commit = nullptr;
+		sqlite3_stmt* _rollback = nullptr;
+
+		/// Bumps the data version in every batch, see init_meta().
+		sqlite3_stmt* _bump = nullptr;
+
+		std::atomic<uint64_t> _version { 0 };
+		std::atomic<bool> _stale { false };
+		std::function<void(uint64_t)> _committed;
+
+		/// Only touched by the writer thread.
+		std::chrono::steady_clock::duration _batch_time { 0 };
+
+		std::chrono::microseconds _window { 0 };
+		size_t _batch = 1;
+
+		std::vector<write_op> _queue;
+		size_t _running = 0;
+		bool _stopping = false;
+
+		std::mutex _lock;
+		std::condition_variable _arrived;
+		std::condition_variable _drained;
+		std::thread _thread;
+};
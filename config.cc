@@ -26,15 +26,22 @@
 #include <getopt.h>
 #include <math.h>
 #include <ctype.h>
+#include <errno.h>
 #include <string.h>
 
 // STL
+#include <chrono>
 #include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
 
 // Externals
 #include <libconfig.h++>
 
+#include "archive.h"
 #include "db.h"
+#include "import.h"
 
 namespace fs = std::filesystem;
 using namespace libconfig;
@@ -52,9 +59,20 @@ void print_usage()
 			"\ncommands:\n"
 			"\n\tdefault\t\tCreate a default configuration file."
 			"\n\tinit\t\tInitialize (or re-initialize) the database"
+			"\n\tmigrate\t\tUpgrade the database to the current schema version"
 			"\n\tadd\t\tAdd an item to the database:"
 			"\n\t\tterminal <NAME> ... "
-			"\n\t\tpad <TERMID> <WEIGHT> <COUNT>"
+			"\n\t\tpad <TERMID> <WEIGHT> [COUNT] [COST_HOUR] [COST_DAY]"
+			"\n\timport\t\tStream terminals, pads and ships into the database, see import.h:"
+			"\n\t\t<PATH|-> [csv|binary] [BATCH]"
+			"\n\tlog\t\tChoose who writes the docking log:"
+			"\n\t\ttrigger\tThe database, in every docking transaction"
+			"\n\t\tasync\tThe server, buffered (set log_mode to \"async\" or \"journal\")"
+			"\n\tarchive\t\tMove old docking log entries to the monthly archive tables:"
+			"\n\t\t<DAYS>\tThe number of days of history to keep in docking_log"
+			"\n\tcompact\t\tRebuild the database file, returning unused space to the disk"
+			"\n\tshard\t\tSplit the docked ships into shard files, each with its own writer:"
+			"\n\t\t<COUNT> [<TERMID>:<SHARD> ...]"
 			"\n"
 	      );
 }
@@ -66,130 +84,95 @@ void create_default_config(fs::path& stream)
 	root.add("db_path", Setting::TypeString) = fs::current_path().append("park.db");
 	root.add("port_begin", Setting::TypeInt) = 5000;
 	root.add("port_end", Setting::TypeInt) = 5100;
+	root.add("max_clients", Setting::TypeInt) = 4096;
+	root.add("threads", Setting::TypeInt) = 1;
+	root.add("allocation", Setting::TypeString) = "first_fit";
+	root.add("read_connections", Setting::TypeInt) = 2;
+	root.add("fee_engine", Setting::TypeString) = "native";
+	root.add("commit_window", Setting::TypeInt) = 1000;
+	root.add("commit_batch", Setting::TypeInt) = 256;
+	root.add("log_mode", Setting::TypeString) = "trigger";
+	root.add("log_interval", Setting::TypeInt) = 1000;
+	root.add("log_buffer", Setting::TypeInt) = 65536;
+	root.add("log_durability", Setting::TypeString) = "normal";
+	root.add("journal_segment", Setting::TypeInt) = 64;
+	root.add("snapshot_interval", Setting::TypeInt) = 300;
+	root.add("log_retention", Setting::TypeInt) = 90;
+	root.add("archive_interval", Setting::TypeInt) = 3600;
+	root.add("archive_batch", Setting::TypeInt) = 5000;
+	root.add("request_log", Setting::TypeInt) = 0;
+	root.add("sql_profile", Setting::TypeInt) = 0;
 	cfg.writeFile(stream.c_str());
 }
 
-int init_terminals(sqlite3*& db, char*& err)
+/**
+ * Parse a whole argument as a number.
+ *
+ * @param arg The argument.
+ * @param value Set to the number, if it was one.
+ * @return True if the argument was a number.
+ */
+static bool parse_number(const char* arg, double& value)
 {
-	return sqlite3_exec(db,
-			"CREATE TABLE IF NOT EXISTS 'terminals'"
-			"\n("
-			"\n    terminal_id INTEGER PRIMARY KEY,"
-			"\n    name TEXT UNIQUE"
-			"\n);",
-			nullptr,
-			nullptr,
-			&err);
-}
+	char* end;
+	const double number = strtod(arg, &end);
 
-int init_pads(sqlite3*& db, char*& err)
-{
-	return sqlite3_exec(db, 
-			"CREATE TABLE IF NOT EXISTS 'pads'"
-			"\n("
-			"\n    pad_id INTEGER PRIMARY KEY,"
-			"\n    terminal_id INTEGER NOT NULL,"
-			"\n    max_weight REAL NOT NULL,"
-			"\n    cost_hour REAL DEFAULT 15,"
-			"\n    cost_day REAL DEFAULT 50,"
-			"\n    FOREIGN KEY (terminal_id) REFERENCES 'terminals'"
-			"\n    ON DELETE CASCADE ON UPDATE CASCADE"
-			"\n);",
-			nullptr, 
-			nullptr,
-			&err);
-}
+	if (end == arg || *end != '\0')
+		return false;
 
-int init_ships(sqlite3*& db, char*& err)
-{
-	return sqlite3_exec(db,
-			"CREATE TABLE IF NOT EXISTS 'ships'"
-			"\n("
-			"\n    ship_id INTEGER PRIMARY KEY,"
-			"\n    pad_id INTEGER UNIQUE NOT NULL,"
-			"\n    license TEXT UNIQUE NOT NULL,"
-			"\n    manufacturer TEXT,"
-			"\n    weight REAL NOT NULL,"
-			"\n    date TEXT NOT NULL,"
-			"\n    FOREIGN KEY (pad_id) REFERENCES 'pads'"
-			"\n    ON DELETE NO ACTION ON UPDATE NO ACTION"
-			"\n);",
-			nullptr,
-			nullptr,
-			&err);
+	value = number;
+	return true;
 }
 
-int init_log(sqlite3*& db, char*& err)
+/**
+ * Report how many rows were added, and how fast.
+ *
+ * @param what What the rows were.
+ * @param rows The number of rows added.
+ * @param start When adding started.
+ */
+static void report_rows(const char* what, int rows, std::chrono::steady_clock::time_point start)
 {
-	return sqlite3_exec(db, 
-			"CREATE TABLE IF NOT EXISTS 'docking_log'"
-			"\n("
-			"\n    log_id INTEGER PRIMARY KEY,"
-			"\n    pad_id INTEGER NOT NULL,"
-			"\n    license TEXT NOT NULL,"
-			"\n    event TEXT NOT NULL,"
-			"\n    date TEXT NOT NULL"
-			"\n);",
-			nullptr,
-			nullptr,
-			&err);
-}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
 
-int init_triggers(sqlite3*& db, char*& err)
-{
-	return sqlite3_exec(db, 
-			"CREATE TRIGGER IF NOT EXISTS check_before_dock"
-			"\nBEFORE INSERT ON ships"
-			"\nWHEN NOT EXISTS (SELECT 1 FROM pads WHERE pad_id = NEW.pad_id)"
-			"\nOR NEW.weight > (SELECT max_weight FROM pads WHERE pad_id = NEW.pad_id)"
-			"\nBEGIN"
-			"\n   SELECT RAISE(FAIL, 'The landing pad does not exist or weight limit exceeded.');" 
-			"\nEND;"
-			"\nCREATE TRIGGER IF NOT EXISTS log_docking"
-			"\nAFTER INSERT ON ships"
-			"\nBEGIN"
-			"\n    INSERT INTO docking_log"
-			"\n        (pad_id, license, event, date)"
-			"\n    VALUES"
-			"\n        (NEW.pad_id, NEW.license, 'dock', DATETIME('NOW'));"
-			"\nEND;"
-			"\nCREATE TRIGGER IF NOT EXISTS log_undocking"
-			"\nAFTER DELETE ON ships"
-			"\nBEGIN"
-			"\n    INSERT INTO docking_log"
-			"\n        (pad_id, license, event, date)"
-			"\n    VALUES"
-			"\n        (OLD.pad_id, OLD.license, 'undock', DATETIME('NOW'));"
-			"\nEND;",
-			nullptr,
-			nullptr,
-			&err);
+	fprintf(stdout, "Added %d %s in %.3f seconds (%.0f rows/s).\n", 
+			rows, what, elapsed.count(), rows / elapsed.count());
 }
 
-static int callback(void*, int argc, char** argv, char** azColName)
+/**
+ * Run an operation on every shard of a sharded database, see split_shards().
+ *
+ * @param db The database connection.
+ * @param op The operation, returning a SQLite response code.
+ * @return The number of shards the operation failed on.
+ */
+static int for_each_shard(sqlite3*& db, const std::function<int(sqlite3*&, char*&)>& op)
 {
-	for (int i = 0; i < argc; i++)
-		fprintf(stdout, "%s = %s\n", azColName[i], argv[i] ? argv[i] : "NULL");
-
-	fprintf(stdout, "\n");
-	return EXIT_SUCCESS;
-}
+	const int count = get_shard_count(db);
+	int errc = 0;
 
-int add_terminal(sqlite3*& db, char*& err, char*& name)
-{
-	std::ostringstream ss;
-	ss << "INSERT INTO terminals (name) VALUES ('" << name << "');";
+	for (int i = 0; i < count; i++)
+	{
+		const std::string path = shard_path(db, i);
+		sqlite3* shard;
+		char* err;
 
-	return sqlite3_exec(db, ss.str().c_str(), callback, nullptr, &err);
-}
+		if (sqlite3_open_v2(path.c_str(), &shard, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK)
+		{
+			fprintf(stderr, "Failed to open shard %s: %s\n", path.c_str(), sqlite3_errmsg(shard));
+			errc++;
+		}
+		else if (op(shard, err) != SQLITE_OK)
+		{
+			fprintf(stderr, "Failed on shard %s - %s\n", path.c_str(), err);
+			sqlite3_free(err);
+			errc++;
+		}
 
-int add_pad(sqlite3*& db, char*& err, int terminal_id, float max_weight)
-{
-	std::ostringstream ss;
-	ss << "INSERT INTO pads (terminal_id, max_weight)"
-		"VALUES (" << terminal_id << ", " << max_weight << ");";
+		sqlite3_close(shard);
+	}
 
-	return sqlite3_exec(db, ss.str().c_str(), callback, nullptr, &err);
+	return errc;
 }
 
 int main(int argc, char* argv[])
@@ -261,6 +244,17 @@ int main(int argc, char* argv[])
 		else if (strcmp(argv[index], "init") == 0)
 		{
 			int errc = 0;
+
+			// Creating tables that already exist does nothing,
+			// so an old database would keep its old schema.
+			if (get_schema_version(db) == 1)
+			{
+				fprintf(stderr, "The database has an old schema, "
+						"run spacepark-config migrate to upgrade it.\n");
+				no_input = false;
+				break;
+			}
+
 			if (init_terminals(db, err))
 			{
 				fprintf(stderr, "Failed to init terminals table - %s\n", err);
@@ -291,6 +285,18 @@ int main(int argc, char* argv[])
 				sqlite3_free(err);
 				errc++;
 			}
+			if (init_meta(db, err))
+			{
+				fprintf(stderr, "Failed to init meta table - %s\n", err);
+				sqlite3_free(err);
+				errc++;
+			}
+			if (errc == 0 && set_schema_version(db, err))
+			{
+				fprintf(stderr, "Failed to set schema version - %s\n", err);
+				sqlite3_free(err);
+				errc++;
+			}
 
 			fprintf(stdout, (errc == 0) ? 
 					"Database initialized successfully!\n" : "%i error(s) occurred.\n", errc);
@@ -313,16 +319,20 @@ int main(int argc, char* argv[])
 					break;
 				}
 
-				while (++index < argc)
+				const auto start = std::chrono::steady_clock::now();
+				const int count = argc - index - 1;
+				int added;
+
+				// All remaining arguments are terminal names.
+				if (add_terminals(db, err, argv + index + 1, count, added))
 				{
-					if (add_terminal(db, err, argv[index]))
-					{
-						fprintf(stderr, "Failed to add terminal - %s\n", err);
-						sqlite3_free(err);
-					}
-					else 
-						fprintf(stdout, "Successfully added terminal %s!\n", argv[index]);
+					fprintf(stderr, "Failed to add terminals - %s\n", err);
+					sqlite3_free(err);
 				}
+				else
+					report_rows("terminals", added, start);
+
+				index = argc;
 			}
 			else if (strcmp(argv[index], "pad") == 0)
 			{
@@ -335,21 +345,256 @@ int main(int argc, char* argv[])
 				int terminal_id = atoi(argv[++index]);
 				float max_weight = atof(argv[++index]);
 
-
 				int c = (index + 1 < argc) ? atoi(argv[++index]) : 1;
-				int sc = 0;
+				double cost_hour = -1;
+				double cost_day = -1;
+
+				// The tariffs are optional, and only taken if they're numbers.
+				if (index + 1 < argc && parse_number(argv[index + 1], cost_hour))
+					index++;
+
+				if (index + 1 < argc && parse_number(argv[index + 1], cost_day))
+					index++;
+
+				const auto start = std::chrono::steady_clock::now();
+
+				if (add_pads(db, err, terminal_id, max_weight, c, cost_hour, cost_day))
+				{
+					fprintf(stderr, "Failed to add pads - %s\n", err);
+					sqlite3_free(err);
+				}
+				else
+				{
+					const std::string what = "pads to terminal " + std::to_string(terminal_id);
+					report_rows(what.c_str(), c, start);
+				}
+			}
+
+			// Tell the server its pad snapshot is out of date.
+			if (bump_data_version(db, err))
+			{
+				fprintf(stderr, "Failed to bump data version - %s\n", err);
+				sqlite3_free(err);
+			}
+
+			if (sync_shards(db, err))
+			{
+				fprintf(stderr, "Failed to copy new pads to the shards - %s\n", err);
+				sqlite3_free(err);
+			}
+		}
+		else if (strcmp(argv[index], "import") == 0)
+		{
+			if (argc <= index + 1)
+			{
+				fprintf(stderr, "Specify a file to import, or - for stdin.\n");
+				break;
+			}
+
+			const char* path = argv[++index];
+			import_format format = import_format::csv;
+			size_t batch = 10000;
+
+			if (index + 1 < argc && strcmp(argv[index + 1], "csv") == 0)
+				index++;
+			else if (index + 1 < argc && strcmp(argv[index + 1], "binary") == 0)
+			{
+				format = import_format::binary;
+				index++;
+			}
+
+			if (index + 1 < argc && atoi(argv[index + 1]) > 0)
+				batch = atoi(argv[++index]);
+
+			FILE* in = (strcmp(path, "-") == 0) ? stdin : fopen(path, "rb");
+
+			if (in == nullptr)
+			{
+				fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+				break;
+			}
+
+			double reported = 0;
+			import_stats stats;
 
-				for (int i = 0; i < c; i++)
+			// At most one progress line a second.
+			const auto progress = [&reported](const import_stats& stats)
+			{
+				if (stats.seconds - reported < 1)
+					return;
+
+				reported = stats.seconds;
+				fprintf(stdout, "%lu records read, %lu rows imported (%.0f rows/s)...\n", 
+						stats.records, stats.rows(), stats.rows() / stats.seconds);
+			};
+
+			if (import_rows(db, err, in, format, batch, progress, stats))
+			{
+				fprintf(stderr, "Import stopped - %s\n", err);
+				sqlite3_free(err);
+			}
+
+			if (in != stdin)
+				fclose(in);
+
+			fprintf(stdout, "Imported %lu terminals, %lu pads and %lu ships in %.3f seconds "
+					"(%.0f rows/s), %lu records rejected.\n", 
+					stats.terminals, stats.pads, stats.ships, stats.seconds, 
+					stats.rows() / stats.seconds, stats.rejected);
+
+			if (sync_shards(db, err))
+			{
+				fprintf(stderr, "Failed to copy new pads to the shards - %s\n", err);
+				sqlite3_free(err);
+			}
+		}
+		else if (strcmp(argv[index], "migrate") == 0)
+		{
+			const int version = get_schema_version(db);
+
+			if (version == 0)
+				fprintf(stderr, "The database is empty, run spacepark-config init instead.\n");
+			else if (version >= schema_version)
+				fprintf(stdout, "The database schema is up to date (version %d).\n", version);
+			else if (migrate_schema(db, err))
+			{
+				fprintf(stderr, "Failed to migrate database - %s\n", err);
+				sqlite3_free(err);
+			}
+			else if (for_each_shard(db, migrate_schema) == 0)
+				fprintf(stdout, "Database migrated from schema version %d to %d.\n", 
+						version, schema_version);
+		}
+		else if (strcmp(argv[index], "log") == 0)
+		{
+			if (argc <= index + 1)
+			{
+				fprintf(stderr, "Specify a log mode, 'trigger' or 'async'.\n");
+				break;
+			}
+
+			index++;
+
+			// Docking is logged wherever the ships are.
+			if (strcmp(argv[index], "trigger") == 0)
+			{
+				if (init_triggers(db, err))
 				{
-					if (add_pad(db, err, terminal_id, max_weight))
-					{
-						fprintf(stderr, "Failed to add pad - %s\n", err);
-						sqlite3_free(err);
-					}
-					else sc++;
+					fprintf(stderr, "Failed to create log triggers - %s\n", err);
+					sqlite3_free(err);
 				}
+				else if (for_each_shard(db, init_triggers) == 0)
+					fprintf(stdout, "Docking log is written by triggers.\n");
+			}
+			else if (strcmp(argv[index], "async") == 0)
+			{
+				if (drop_log_triggers(db, err))
+				{
+					fprintf(stderr, "Failed to drop log triggers - %s\n", err);
+					sqlite3_free(err);
+				}
+				else if (for_each_shard(db, drop_log_triggers) == 0)
+					fprintf(stdout, "Log triggers dropped, the server must run with "
+							"log_mode = \"async\" for docking to be logged.\n");
+			}
+			else
+				fprintf(stderr, "Unknown log mode '%s'!\n", argv[index]);
+		}
+		else if (strcmp(argv[index], "archive") == 0)
+		{
+			if (argc <= index + 1 || atoi(argv[index + 1]) < 0)
+			{
+				fprintf(stderr, "Specify the number of days of history to keep.\n");
+				break;
+			}
+
+			const int days = atoi(argv[++index]);
+			const auto start = std::chrono::system_clock::now();
+			const int64_t cutoff = std::chrono::duration_cast<std::chrono::milliseconds>(
+					(start - std::chrono::hours(24) * days).time_since_epoch()).count();
+
+			size_t total = 0;
+
+			// Batches keep each transaction short if a server is running.
+			const auto archive = [cutoff, &total](sqlite3*& db, char*& err)
+			{
+				size_t moved;
+				int rc;
+
+				while ((rc = archive_log(db, err, cutoff, 10000, moved)) == SQLITE_OK && moved > 0)
+					total += moved;
+
+				return rc;
+			};
+
+			if (archive(db, err))
+			{
+				fprintf(stderr, "Failed to archive the docking log - %s\n", err);
+				sqlite3_free(err);
+			}
+
+			for_each_shard(db, archive);
+
+			const std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
+
+			fprintf(stdout, "Archived %lu docking log entries in %.2f seconds.\n", 
+					total, elapsed.count());
+		}
+		else if (strcmp(argv[index], "compact") == 0)
+		{
+			const auto before = fs::file_size(db_path);
+
+			// Archiving leaves free pages behind, which VACUUM gives back.
+			if (sqlite3_exec(db, "VACUUM;", nullptr, nullptr, &err) != SQLITE_OK)
+			{
+				fprintf(stderr, "Failed to compact database - %s\n", err);
+				sqlite3_free(err);
+			}
+			else
+				fprintf(stdout, "Database compacted from %lu to %lu bytes.\n", 
+						before, fs::file_size(db_path));
+
+			for_each_shard(db, [](sqlite3*& shard, char*& err)
+			{
+				return sqlite3_exec(shard, "VACUUM;", nullptr, nullptr, &err);
+			});
+		}
+		else if (strcmp(argv[index], "shard") == 0)
+		{
+			if (argc <= index + 1 || atoi(argv[index + 1]) < 1 || atoi(argv[index + 1]) > 256)
+			{
+				fprintf(stderr, "Specify a number of shards, from 1 to 256.\n");
+				break;
+			}
+
+			const int count = atoi(argv[++index]);
+			std::vector<std::pair<int, int>> groups;
+			int terminal, shard;
+
+			// Terminals can be placed explicitly, to group them.
+			while (index + 1 < argc && sscanf(argv[index + 1], "%d:%d", &terminal, &shard) == 2)
+			{
+				if (shard < 0 || shard >= count)
+					fprintf(stderr, "Ignoring terminal %d, there is no shard %d.\n", terminal, shard);
+				else
+					groups.emplace_back(terminal, shard);
+
+				index++;
+			}
+
+			const auto start = std::chrono::steady_clock::now();
+
+			if (split_shards(db, err, count, groups))
+			{
+				fprintf(stderr, "Failed to split the database - %s\n", err);
+				sqlite3_free(err);
+			}
+			else
+			{
+				const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
 
-				fprintf(stdout, "Added %d pads to terminal %d.\n", sc, terminal_id);
+				fprintf(stdout, "Split the database into %d shards in %.2f seconds.\n", 
+						count, elapsed.count());
 			}
 		}
 		else 
@@ -0,0 +1,93 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include "connection.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+
+connection_table::connection_table(size_t limit, std::atomic<size_t>& total)
+	: _total(total), _count(0), _limit(limit)
+{
+}
+
+connection_table::~connection_table()
+{
+	for (const connection& con : _slots)
+	{
+		if (con.fd > -1)
+			close(con.fd);
+	}
+}
+
+connection* connection_table::open(int fd, const struct sockaddr_in& address)
+{
+	if (fd < 0)
+		return nullptr;
+
+	// Reserve a place under the shared limit first,
+	// so concurrent event loops can't overshoot it.
+	if (_total.fetch_add(1) >= _limit)
+	{
+		_total.fetch_sub(1);
+		return nullptr;
+	}
+
+	// Descriptors are allocated lowest-first by the kernel,
+	// so doubling keeps the slab close to the number of clients.
+	if (static_cast<size_t>(fd) >= _slots.size())
+		_slots.resize(std::max(static_cast<size_t>(fd) + 1, _slots.size() * 2));
+
+	connection& con = _slots[fd];
+	con.fd = fd;
+	con.serial = _next_serial++;
+	con.address = address;
+
+	_count++;
+
+	return &con;
+}
+
+connection* connection_table::get(int fd)
+{
+	if (fd < 0 || static_cast<size_t>(fd) >= _slots.size() || _slots[fd].fd < 0)
+		return nullptr;
+
+	return &_slots[fd];
+}
+
+void connection_table::close(int fd)
+{
+	connection* con = get(fd);
+
+	if (con == nullptr)
+		return;
+
+	::close(fd);
+
+	*con = connection {};
+	_count--;
+	_total.fetch_sub(1);
+}
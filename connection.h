@@ -0,0 +1,143 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <netinet/in.h>
+
+/// The default maximum number of clients connected at once.
+constexpr int default_max_clients = 4096;
+
+/**
+ * Per-connection state of a connected client.
+ */
+struct connection
+{
+	/// The client socket, or -1 if the slot is unused.
+	int fd = -1;
+
+	/// Unique for every accepted connection, so a late response
+	/// can tell whether the descriptor has been reused since.
+	uint64_t serial = 0;
+
+	/// The remote address of the client.
+	struct sockaddr_in address {};
+
+	/// Received bytes not yet making up a complete message.
+	std::vector<char> rx;
+
+	/// Queued response bytes not yet sent.
+	std::vector<char> tx;
+
+	/// Number of bytes at the front of the send queue already sent.
+	size_t tx_sent = 0;
+
+	/// True if the connection is waiting to be flushed this iteration.
+	bool flush_pending = false;
+
+	/// True if the socket is full and we're waiting for it to drain.
+	bool wait_writable = false;
+
+	/// True if reading was paused until the send queue drains.
+	bool read_paused = false;
+
+	/**
+	 * @return The number of queued bytes not yet sent.
+	 */
+	size_t tx_pending() const { return tx.size() - tx_sent; }
+};
+
+/**
+ * A growable registry of connected clients.
+ * Connections are stored in a slab indexed by their socket descriptor,
+ * so lookups are a single array access and the slab only grows
+ * as far as the highest descriptor in use.
+ *
+ * Several tables (one per event loop) may share a connection count,
+ * in which case the limit applies to all of them together.
+ */
+class connection_table
+{
+	public:
+
+		/**
+		 * Create an empty connection table.
+		 *
+		 * @param limit The maximum number of connections at once.
+		 * @param total The connection count shared with other tables.
+		 */
+		connection_table(size_t limit, std::atomic<size_t>& total);
+
+		/**
+		 * Close all remaining connections.
+		 */
+		~connection_table();
+
+		/**
+		 * Register a newly accepted client.
+		 *
+		 * @param fd The client socket.
+		 * @param address The remote address of the client.
+		 * @return The new connection, or nullptr if the table is full.
+		 */
+		connection* open(int fd, const struct sockaddr_in& address);
+
+		/**
+		 * Look up the connection registered for a socket.
+		 * The pointer is valid until the next call to open().
+		 *
+		 * @param fd The client socket.
+		 * @return The connection, or nullptr if none is registered.
+		 */
+		connection* get(int fd);
+
+		/**
+		 * Unregister a connection and close its socket.
+		 *
+		 * @param fd The client socket.
+		 */
+		void close(int fd);
+
+		/**
+		 * @return The number of clients connected to this table.
+		 */
+		size_t size() const { return _count; }
+
+		/**
+		 * @return The maximum number of connections at once.
+		 */
+		size_t limit() const { return _limit; }
+
+	private:
+
+		std::vector<connection> _slots;
+		std::atomic<size_t>& _total;
+		uint64_t _next_serial = 1;
+		size_t _count;
+		size_t _limit;
+};
@@ -11,3 +11,634 @@ int set_pragma(sqlite3*& db, char*& err, const char* pragma, const char* value)
 
 	return sqlite3_exec(db, ss.str().c_str(), nullptr, nullptr, &err);
 }
+
+int get_schema_version(sqlite3*& db)
+{
+	sqlite3_stmt* stmt;
+	int version = 0;
+
+	if (sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, nullptr) == SQLITE_OK)
+	{
+		if (sqlite3_step(stmt) == SQLITE_ROW)
+			version = sqlite3_column_int(stmt, 0);
+
+		sqlite3_finalize(stmt);
+	}
+
+	if (version != 0)
+		return version;
+
+	// Nothing recorded, so either empty or from before versions.
+	if (sqlite3_prepare_v2(db, 
+				"SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'ships';", 
+				-1, &stmt, nullptr) == SQLITE_OK)
+	{
+		if (sqlite3_step(stmt) == SQLITE_ROW)
+			version = 1;
+
+		sqlite3_finalize(stmt);
+	}
+
+	return version;
+}
+
+int set_schema_version(sqlite3*& db, char*& err)
+{
+	std::ostringstream ss;
+	ss << schema_version;
+
+	return set_pragma(db, err, "user_version", ss.str().c_str());
+}
+
+/**
+ * Convert text dates to INTEGER epoch milliseconds, see migrate_schema().
+ * Runs inside the migration transaction.
+ */
+static int migrate_dates(sqlite3*& db, char*& err)
+{
+	const bool log_triggers = has_log_triggers(db);
+	int rc;
+
+	// Move the old tables aside (which takes their triggers along),
+	// create the new ones and copy the rows over with converted dates.
+	if ((rc = sqlite3_exec(db,
+					"ALTER TABLE ships RENAME TO ships_v1;"
+					"\nALTER TABLE docking_log RENAME TO docking_log_v1;",
+					nullptr, nullptr, &err)) != SQLITE_OK
+			|| (rc = init_ships(db, err)) != SQLITE_OK
+			|| (rc = init_log(db, err)) != SQLITE_OK
+			|| (rc = sqlite3_exec(db,
+					"INSERT INTO ships (ship_id, pad_id, license, manufacturer, weight, date)"
+					"\n    SELECT ship_id, pad_id, license, manufacturer, weight,"
+					"\n    CAST(ROUND((JulianDay(date) - 2440587.5) * 86400000) AS INTEGER)"
+					"\n    FROM ships_v1;"
+					"\nINSERT INTO docking_log (log_id, pad_id, license, event, date)"
+					"\n    SELECT log_id, pad_id, license, event,"
+					"\n    CAST(ROUND((JulianDay(date) - 2440587.5) * 86400000) AS INTEGER)"
+					"\n    FROM docking_log_v1;"
+					"\nDROP TABLE ships_v1;"
+					"\nDROP TABLE docking_log_v1;",
+					nullptr, nullptr, &err)) != SQLITE_OK
+			|| (rc = init_triggers(db, err)) != SQLITE_OK
+			|| (!log_triggers && (rc = drop_log_triggers(db, err)) != SQLITE_OK))
+		return rc;
+
+	return SQLITE_OK;
+}
+
+int migrate_schema(sqlite3*& db, char*& err)
+{
+	const int version = get_schema_version(db);
+	int rc;
+
+	if ((rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, nullptr, &err)) != SQLITE_OK)
+		return rc;
+
+	// Each step takes the schema one version further.
+	if ((version < 2 && (rc = migrate_dates(db, err)) != SQLITE_OK)
+			|| (version < 3 && (rc = init_meta(db, err)) != SQLITE_OK)
+			|| (version < 4 && (rc = init_log(db, err)) != SQLITE_OK)
+			|| (rc = bump_data_version(db, err)) != SQLITE_OK
+			|| (rc = set_schema_version(db, err)) != SQLITE_OK
+			|| (rc = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, &err)) != SQLITE_OK)
+	{
+		sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+		return rc;
+	}
+
+	return SQLITE_OK;
+}
+
+int init_meta(sqlite3*& db, char*& err)
+{
+	return sqlite3_exec(db, 
+			"CREATE TABLE IF NOT EXISTS 'meta'"
+			"\n("
+			"\n    key TEXT PRIMARY KEY,"
+			"\n    value INTEGER NOT NULL"
+			"\n);"
+			"\nINSERT OR IGNORE INTO meta (key, value) VALUES ('data_version', 1);",
+			nullptr,
+			nullptr,
+			&err);
+}
+
+uint64_t get_data_version(sqlite3*& db)
+{
+	sqlite3_stmt* stmt;
+	uint64_t version = 0;
+
+	if (sqlite3_prepare_v2(db, "SELECT value FROM meta WHERE key = 'data_version';",
+				-1, &stmt, nullptr) == SQLITE_OK)
+	{
+		if (sqlite3_step(stmt) == SQLITE_ROW)
+			version = sqlite3_column_int64(stmt, 0);
+
+		sqlite3_finalize(stmt);
+	}
+
+	return version;
+}
+
+int bump_data_version(sqlite3*& db, char*& err)
+{
+	return sqlite3_exec(db, 
+			"UPDATE meta SET value = value + 1 WHERE key = 'data_version';",
+			nullptr,
+			nullptr,
+			&err);
+}
+
+int init_terminals(sqlite3*& db, char*& err)
+{
+	return sqlite3_exec(db,
+			"CREATE TABLE IF NOT EXISTS 'terminals'"
+			"\n("
+			"\n    terminal_id INTEGER PRIMARY KEY,"
+			"\n    name TEXT UNIQUE"
+			"\n);",
+			nullptr,
+			nullptr,
+			&err);
+}
+
+int init_pads(sqlite3*& db, char*& err)
+{
+	return sqlite3_exec(db, 
+			"CREATE TABLE IF NOT EXISTS 'pads'"
+			"\n("
+			"\n    pad_id INTEGER PRIMARY KEY,"
+			"\n    terminal_id INTEGER NOT NULL,"
+			"\n    max_weight REAL NOT NULL,"
+			"\n    cost_hour REAL DEFAULT 15,"
+			"\n    cost_day REAL DEFAULT 50,"
+			"\n    FOREIGN KEY (terminal_id) REFERENCES 'terminals'"
+			"\n    ON DELETE CASCADE ON UPDATE CASCADE"
+			"\n);",
+			nullptr, 
+			nullptr,
+			&err);
+}
+
+int init_ships(sqlite3*& db, char*& err)
+{
+	return sqlite3_exec(db,
+			"CREATE TABLE IF NOT EXISTS 'ships'"
+			"\n("
+			"\n    ship_id INTEGER PRIMARY KEY,"
+			"\n    pad_id INTEGER UNIQUE NOT NULL,"
+			"\n    license TEXT UNIQUE NOT NULL,"
+			"\n    manufacturer TEXT,"
+			"\n    weight REAL NOT NULL,"
+			"\n    date INTEGER NOT NULL,"
+			"\n    FOREIGN KEY (pad_id) REFERENCES 'pads'"
+			"\n    ON DELETE NO ACTION ON UPDATE NO ACTION"
+			"\n);",
+			nullptr,
+			nullptr,
+			&err);
+}
+
+int init_log(sqlite3*& db, char*& err)
+{
+	return sqlite3_exec(db, 
+			"CREATE TABLE IF NOT EXISTS 'docking_log'"
+			"\n("
+			"\n    log_id INTEGER PRIMARY KEY,"
+			"\n    pad_id INTEGER NOT NULL,"
+			"\n    license TEXT NOT NULL,"
+			"\n    event TEXT NOT NULL,"
+			"\n    date INTEGER NOT NULL"
+			"\n);"
+			"\nCREATE INDEX IF NOT EXISTS docking_log_pad ON docking_log (pad_id, date);"
+			"\nCREATE INDEX IF NOT EXISTS docking_log_license ON docking_log (license);"
+			"\nCREATE VIEW IF NOT EXISTS docking_log_all AS"
+			"\n    SELECT log_id, pad_id, license, event, date FROM docking_log;",
+			nullptr,
+			nullptr,
+			&err);
+}
+
+int init_triggers(sqlite3*& db, char*& err)
+{
+	return sqlite3_exec(db, 
+			"CREATE TRIGGER IF NOT EXISTS check_before_dock"
+			"\nBEFORE INSERT ON ships"
+			"\nWHEN NOT EXISTS (SELECT 1 FROM pads WHERE pad_id = NEW.pad_id)"
+			"\nOR NEW.weight > (SELECT max_weight FROM pads WHERE pad_id = NEW.pad_id)"
+			"\nBEGIN"
+			"\n   SELECT RAISE(FAIL, 'The landing pad does not exist or weight limit exceeded.');" 
+			"\nEND;"
+			"\nCREATE TRIGGER IF NOT EXISTS log_docking"
+			"\nAFTER INSERT ON ships"
+			"\nBEGIN"
+			"\n    INSERT INTO docking_log"
+			"\n        (pad_id, license, event, date)"
+			"\n    VALUES"
+			"\n        (NEW.pad_id, NEW.license, 'dock', "
+			"\n        CAST((JulianDay('NOW') - 2440587.5) * 86400000 AS INTEGER));"
+			"\nEND;"
+			"\nCREATE TRIGGER IF NOT EXISTS log_undocking"
+			"\nAFTER DELETE ON ships"
+			"\nBEGIN"
+			"\n    INSERT INTO docking_log"
+			"\n        (pad_id, license, event, date)"
+			"\n    VALUES"
+			"\n        (OLD.pad_id, OLD.license, 'undock', "
+			"\n        CAST((JulianDay('NOW') - 2440587.5) * 86400000 AS INTEGER));"
+			"\nEND;",
+			nullptr,
+			nullptr,
+			&err);
+}
+
+int drop_log_triggers(sqlite3*& db, char*& err)
+{
+	return sqlite3_exec(db, 
+			"DROP TRIGGER IF EXISTS log_docking;"
+			"\nDROP TRIGGER IF EXISTS log_undocking;",
+			nullptr,
+			nullptr,
+			&err);
+}
+
+bool has_log_triggers(sqlite3*& db)
+{
+	sqlite3_stmt* stmt;
+	bool exists = false;
+
+	if (sqlite3_prepare_v2(db, 
+				"SELECT 1 FROM sqlite_master WHERE type = 'trigger' "
+				"AND name IN ('log_docking', 'log_undocking');",
+				-1, &stmt, nullptr) == SQLITE_OK)
+	{
+		exists = (sqlite3_step(stmt) == SQLITE_ROW);
+		sqlite3_finalize(stmt);
+	}
+
+	return exists;
+}
+
+static int callback(void*, int argc, char** argv, char** azColName)
+{
+	for (int i = 0; i < argc; i++)
+		fprintf(stdout, "%s = %s\n", azColName[i], argv[i] ? argv[i] : "NULL");
+
+	fprintf(stdout, "\n");
+	return EXIT_SUCCESS;
+}
+
+int add_terminal(sqlite3*& db, char*& err, char*& name)
+{
+	std::ostringstream ss;
+	ss << "INSERT INTO terminals (name) VALUES ('" << name << "');";
+
+	return sqlite3_exec(db, ss.str().c_str(), callback, nullptr, &err);
+}
+
+int add_pad(sqlite3*& db, char*& err, int terminal_id, float max_weight)
+{
+	return add_pads(db, err, terminal_id, max_weight, 1);
+}
+
+int add_terminals(sqlite3*& db, char*& err, char** names, int count, int& added)
+{
+	sqlite3_stmt* stmt;
+	int rc;
+
+	added = 0;
+
+	if ((rc = sqlite3_exec(db, "BEGIN;", nullptr, nullptr, &err)) != SQLITE_OK)
+		return rc;
+
+	if ((rc = sqlite3_prepare_v2(db, "INSERT INTO terminals (name) VALUES (?1);", 
+					-1, &stmt, nullptr)) != SQLITE_OK)
+	{
+		err = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+		sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+		return rc;
+	}
+
+	// A failing insert only undoes itself, the others carry on.
+	for (int i = 0; i < count; i++)
+	{
+		sqlite3_bind_text(stmt, 1, names[i], -1, SQLITE_STATIC);
+
+		if (sqlite3_step(stmt) == SQLITE_DONE)
+			added++;
+		else
+			fprintf(stderr, "Failed to add terminal %s - %s\n", names[i], sqlite3_errmsg(db));
+
+		sqlite3_reset(stmt);
+	}
+
+	sqlite3_finalize(stmt);
+
+	if ((rc = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, &err)) != SQLITE_OK)
+	{
+		sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+		added = 0;
+	}
+
+	return rc;
+}
+
+int add_pads(sqlite3*& db, char*& err, int terminal_id, float max_weight, int count,
+		double cost_hour, double cost_day)
+{
+	sqlite3_stmt* stmt;
+	int rc;
+
+	if ((rc = sqlite3_exec(db, "BEGIN;", nullptr, nullptr, &err)) != SQLITE_OK)
+		return rc;
+
+	// Tariffs left out take the column defaults.
+	std::ostringstream ss;
+	ss << "INSERT INTO pads (terminal_id, max_weight"
+		<< ((cost_hour >= 0) ? ", cost_hour" : "") << ((cost_day >= 0) ? ", cost_day" : "")
+		<< ") VALUES (?1, ?2" 
+		<< ((cost_hour >= 0) ? ", ?3" : "") << ((cost_day >= 0) ? ", ?4" : "") << ");";
+
+	if ((rc = sqlite3_prepare_v2(db, ss.str().c_str(), -1, &stmt, nullptr)) != SQLITE_OK)
+	{
+		err = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+		sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+		return rc;
+	}
+
+	sqlite3_bind_int(stmt, 1, terminal_id);
+	sqlite3_bind_double(stmt, 2, max_weight);
+
+	if (cost_hour >= 0)
+		sqlite3_bind_double(stmt, 3, cost_hour);
+
+	if (cost_day >= 0)
+		sqlite3_bind_double(stmt, 4, cost_day);
+
+	// The bindings stay the same, only the row ID changes.
+	for (int i = 0; i < count && rc == SQLITE_OK; i++)
+	{
+		if ((rc = sqlite3_step(stmt)) == SQLITE_DONE)
+			rc = SQLITE_OK;
+
+		sqlite3_reset(stmt);
+	}
+
+	if (rc != SQLITE_OK)
+		err = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+
+	sqlite3_finalize(stmt);
+
+	if (rc == SQLITE_OK && (rc = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, &err)) == SQLITE_OK)
+		return SQLITE_OK;
+
+	sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+	return rc;
+}
+
+int get_shard_count(sqlite3*& db)
+{
+	sqlite3_stmt* stmt;
+	int count = 0;
+
+	if (sqlite3_prepare_v2(db, "SELECT value FROM meta WHERE key = 'shards';",
+				-1, &stmt, nullptr) == SQLITE_OK)
+	{
+		if (sqlite3_step(stmt) == SQLITE_ROW)
+			count = sqlite3_column_int(stmt, 0);
+
+		sqlite3_finalize(stmt);
+	}
+
+	return count;
+}
+
+std::string shard_path(sqlite3*& db, int shard)
+{
+	std::ostringstream ss;
+	ss << sqlite3_db_filename(db, "main") << ".shard" << shard;
+
+	return ss.str();
+}
+
+/**
+ * Delete a shard file, along with its write-ahead log.
+ */
+static void remove_shard(const std::string& path)
+{
+	remove(path.c_str());
+	remove((path + "-wal").c_str());
+	remove((path + "-shm").c_str());
+}
+
+/**
+ * Create an empty shard file, with every table but no triggers yet,
+ * so that copying ships in doesn't log them as docking.
+ */
+static int init_shard(const std::string& path, char*& err)
+{
+	sqlite3* shard;
+	int rc;
+
+	// Never fill in a shard left over from somewhere else.
+	if (sqlite3_open_v2(path.c_str(), &shard, SQLITE_OPEN_READONLY, nullptr) == SQLITE_OK)
+	{
+		sqlite3_close(shard);
+		err = sqlite3_mprintf("%s already exists", path.c_str());
+		return SQLITE_CANTOPEN;
+	}
+
+	sqlite3_close(shard);
+
+	if ((rc = sqlite3_open_v2(path.c_str(), &shard, 
+					SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr)) != SQLITE_OK)
+	{
+		err = sqlite3_mprintf("%s: %s", path.c_str(), sqlite3_errmsg(shard));
+		sqlite3_close(shard);
+		return rc;
+	}
+
+	if ((rc = set_pragma(shard, err, "journal_mode", "WAL")) == SQLITE_OK
+			&& (rc = init_terminals(shard, err)) == SQLITE_OK
+			&& (rc = init_pads(shard, err)) == SQLITE_OK
+			&& (rc = init_ships(shard, err)) == SQLITE_OK
+			&& (rc = init_log(shard, err)) == SQLITE_OK
+			&& (rc = init_meta(shard, err)) == SQLITE_OK)
+		rc = set_schema_version(shard, err);
+
+	sqlite3_close(shard);
+
+	if (rc != SQLITE_OK)
+		remove_shard(path);
+
+	return rc;
+}
+
+/**
+ * Create the docking triggers of a shard, with or without the log triggers.
+ */
+static int init_shard_triggers(const std::string& path, bool log_triggers, char*& err)
+{
+	sqlite3* shard;
+	int rc;
+
+	if ((rc = sqlite3_open_v2(path.c_str(), &shard, SQLITE_OPEN_READWRITE, nullptr)) != SQLITE_OK)
+	{
+		err = sqlite3_mprintf("%s: %s", path.c_str(), sqlite3_errmsg(shard));
+		sqlite3_close(shard);
+		return rc;
+	}
+
+	if ((rc = init_triggers(shard, err)) == SQLITE_OK && !log_triggers)
+		rc = drop_log_triggers(shard, err);
+
+	sqlite3_close(shard);
+	return rc;
+}
+
+/**
+ * Copy the terminals and pads routed to a shard into it, 
+ * updating those already there, and optionally their ships.
+ */
+static int copy_to_shard(sqlite3*& db, char*& err, int shard, bool ships)
+{
+	char* attach = sqlite3_mprintf("ATTACH DATABASE %Q AS shard_db;", shard_path(db, shard).c_str());
+	int rc = sqlite3_exec(db, attach, nullptr, nullptr, &err);
+
+	sqlite3_free(attach);
+
+	if (rc != SQLITE_OK)
+		return rc;
+
+	std::ostringstream ss;
+	ss << "BEGIN IMMEDIATE;"
+		"\nINSERT INTO shard_db.terminals (terminal_id, name)"
+		"\n    SELECT terminal_id, name FROM terminals JOIN terminal_shards USING (terminal_id)"
+		"\n    WHERE shard = " << shard <<
+		"\n    ON CONFLICT (terminal_id) DO UPDATE SET name = excluded.name;"
+		"\nINSERT INTO shard_db.pads (pad_id, terminal_id, max_weight, cost_hour, cost_day)"
+		"\n    SELECT pad_id, terminal_id, max_weight, cost_hour, cost_day"
+		"\n    FROM pads JOIN terminal_shards USING (terminal_id)"
+		"\n    WHERE shard = " << shard <<
+		"\n    ON CONFLICT (pad_id) DO UPDATE SET terminal_id = excluded.terminal_id,"
+		"\n    max_weight = excluded.max_weight, cost_hour = excluded.cost_hour,"
+		"\n    cost_day = excluded.cost_day;";
+
+	if (ships)
+	{
+		ss << "\nINSERT INTO shard_db.ships (ship_id, pad_id, license, manufacturer, weight, date)"
+			"\n    SELECT ship_id, pad_id, license, manufacturer, weight, date"
+			"\n    FROM ships JOIN pads USING (pad_id) JOIN terminal_shards USING (terminal_id)"
+			"\n    WHERE shard = " << shard << ";";
+	}
+
+	// Pads changed, so a snapshot of the shard's pads is out of date.
+	ss << "\nUPDATE shard_db.meta SET value = value + 1 WHERE key = 'data_version';"
+		"\nCOMMIT;";
+
+	if ((rc = sqlite3_exec(db, ss.str().c_str(), nullptr, nullptr, &err)) != SQLITE_OK)
+		sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+
+	sqlite3_exec(db, "DETACH DATABASE shard_db;", nullptr, nullptr, nullptr);
+
+	return rc;
+}
+
+int split_shards(sqlite3*& db, char*& err, int count, 
+		const std::vector<std::pair<int, int>>& groups)
+{
+	const bool log_triggers = has_log_triggers(db);
+	int rc = SQLITE_OK;
+	int created = 0;
+
+	if (get_shard_count(db) > 0)
+	{
+		err = sqlite3_mprintf("The database is already sharded");
+		return SQLITE_ERROR;
+	}
+
+	std::ostringstream ss;
+	ss << "BEGIN IMMEDIATE;"
+		"\nDROP TABLE IF EXISTS terminal_shards;"
+		"\nCREATE TABLE terminal_shards"
+		"\n("
+		"\n    terminal_id INTEGER PRIMARY KEY,"
+		"\n    shard INTEGER NOT NULL"
+		"\n);"
+		"\nINSERT INTO terminal_shards (terminal_id, shard)"
+		"\n    SELECT terminal_id, (terminal_id - 1) % " << count << " FROM terminals;";
+
+	for (const auto& group : groups)
+	{
+		ss << "\nUPDATE terminal_shards SET shard = " << group.second 
+			<< " WHERE terminal_id = " << group.first << ";";
+	}
+
+	ss << "\nCOMMIT;";
+
+	// Shards are filled one at a time, since only a few 
+	// databases can be attached at once.
+	for (; created < count; created++)
+	{
+		if ((rc = init_shard(shard_path(db, created), err)) != SQLITE_OK)
+			break;
+	}
+
+	if (rc == SQLITE_OK && (rc = sqlite3_exec(db, ss.str().c_str(), nullptr, nullptr, &err)) != SQLITE_OK)
+		sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+
+	for (int shard = 0; shard < count && rc == SQLITE_OK; shard++)
+	{
+		if ((rc = copy_to_shard(db, err, shard, true)) == SQLITE_OK)
+			rc = init_shard_triggers(shard_path(db, shard), log_triggers, err);
+	}
+
+	// The ships have moved, without leaving the log triggers to log them undocking.
+	if (rc == SQLITE_OK 
+			&& ((rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, nullptr, &err)) != SQLITE_OK
+			|| (rc = drop_log_triggers(db, err)) != SQLITE_OK
+			|| (rc = sqlite3_exec(db, "DELETE FROM ships;", nullptr, nullptr, &err)) != SQLITE_OK
+			|| (log_triggers && (rc = init_triggers(db, err)) != SQLITE_OK)
+			|| (rc = bump_data_version(db, err)) != SQLITE_OK
+			|| (rc = sqlite3_exec(db, 
+					("INSERT OR REPLACE INTO meta (key, value) VALUES ('shards', " 
+					 + std::to_string(count) + ");").c_str(), nullptr, nullptr, &err)) != SQLITE_OK
+			|| (rc = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, &err)) != SQLITE_OK))
+		sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+
+	if (rc == SQLITE_OK)
+		return SQLITE_OK;
+
+	// Leave things as they were.
+	sqlite3_exec(db, "DROP TABLE IF EXISTS terminal_shards;", nullptr, nullptr, nullptr);
+
+	for (int shard = 0; shard < created; shard++)
+		remove_shard(shard_path(db, shard));
+
+	return rc;
+}
+
+int sync_shards(sqlite3*& db, char*& err)
+{
+	const int count = get_shard_count(db);
+	int rc;
+
+	if (count == 0)
+		return SQLITE_OK;
+
+	std::ostringstream ss;
+	ss << "INSERT INTO terminal_shards (terminal_id, shard)"
+		"\n    SELECT terminal_id, (terminal_id - 1) % " << count << " FROM terminals"
+		"\n    WHERE terminal_id NOT IN (SELECT terminal_id FROM terminal_shards);";
+
+	if ((rc = sqlite3_exec(db, ss.str().c_str(), nullptr, nullptr, &err)) != SQLITE_OK)
+		return rc;
+
+	for (int shard = 0; shard < count; shard++)
+	{
+		if ((rc = copy_to_shard(db, err, shard, false)) != SQLITE_OK)
+			return rc;
+	}
+
+	return SQLITE_OK;
+}
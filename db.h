@@ -24,8 +24,18 @@
 
 #pragma once
 
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
 #include <sqlite3.h>
 
+/// The database schema version this build expects, kept in PRAGMA user_version.
+/// Version 1 stored dates as text, version 2 as INTEGER epoch milliseconds,
+/// version 3 added the meta table, and version 4 indexed the docking log
+/// and added the docking_log_all view over it and its archives.
+constexpr int schema_version = 4;
+
 /**
  * Set a PRAGMA statement in the open DB.
  *
@@ -42,3 +52,243 @@
  * @return A SQLite response code.
  */
 int set_pragma(sqlite3*& db, char*& err, const char* pragma, const char* value);
+
+/**
+ * Get the schema version of the database.
+ * Databases from before the version was recorded are version 1.
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @return The schema version, or 0 if the database is empty.
+ */
+int get_schema_version(sqlite3*& db);
+
+/**
+ * Record that the database has the current schema version.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @return A SQLite response code.
+ */
+int set_schema_version(sqlite3*& db, char*& err);
+
+/**
+ * Migrate the database to the current schema version, 
+ * in a single transaction. Dates are converted to INTEGER
+ * epoch milliseconds, and the triggers are recreated as
+ * they were (with or without the log triggers). 
+ * The meta table, docking log index and view are added if they're missing.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @return A SQLite response code.
+ */
+int migrate_schema(sqlite3*& db, char*& err);
+
+/**
+ * Create the meta table, if it doesn't exist.
+ * It holds the data version, which is bumped by every
+ * transaction that changes pads or ships, so copies of 
+ * that data kept outside the database can be checked.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @return A SQLite response code.
+ */
+int init_meta(sqlite3*& db, char*& err);
+
+/**
+ * Get the data version of the database, see init_meta().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @return The data version, or 0 if there is none.
+ */
+uint64_t get_data_version(sqlite3*& db);
+
+/**
+ * Bump the data version of the database, see init_meta().
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @return A SQLite response code.
+ */
+int bump_data_version(sqlite3*& db, char*& err);
+
+/**
+ * Create the terminals table, if it doesn't exist.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @return A SQLite response code.
+ */
+int init_terminals(sqlite3*& db, char*& err);
+
+/**
+ * Create the landing pads table, if it doesn't exist.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @return A SQLite response code.
+ */
+int init_pads(sqlite3*& db, char*& err);
+
+/**
+ * Create the docked ships table, if it doesn't exist.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @return A SQLite response code.
+ */
+int init_ships(sqlite3*& db, char*& err);
+
+/**
+ * Create the docking log table, its (pad_id, date) index and the 
+ * docking_log_all view, if they don't exist. Until anything has been 
+ * archived, see archive_log(), the view only covers docking_log.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @return A SQLite response code.
+ */
+int init_log(sqlite3*& db, char*& err);
+
+/**
+ * Create the docking check and logging triggers, if they don't exist.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @return A SQLite response code.
+ */
+int init_triggers(sqlite3*& db, char*& err);
+
+/**
+ * Drop the docking log triggers, for databases whose
+ * docking log is written by the server instead.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @return A SQLite response code.
+ */
+int drop_log_triggers(sqlite3*& db, char*& err);
+
+/**
+ * Check whether the docking log triggers exist.
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @return True if either of the log triggers exists.
+ */
+bool has_log_triggers(sqlite3*& db);
+
+/**
+ * Add a terminal with the specified name.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @param name The terminal name.
+ * @return A SQLite response code.
+ */
+int add_terminal(sqlite3*& db, char*& err, char*& name);
+
+/**
+ * Add a landing pad with default fees to the specified terminal.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @param terminal_id The row ID of the terminal.
+ * @param max_weight The weight limit of the pad, in tonnes.
+ * @return A SQLite response code.
+ */
+int add_pad(sqlite3*& db, char*& err, int terminal_id, float max_weight);
+
+/**
+ * Add several terminals in a single transaction, with a prepared insert.
+ * Names that can't be added, such as duplicates, are reported and skipped.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @param names The terminal names.
+ * @param count The number of names.
+ * @param added Set to the number of terminals added.
+ * @return A SQLite response code.
+ */
+int add_terminals(sqlite3*& db, char*& err, char** names, int count, int& added);
+
+/**
+ * Add a number of identical landing pads to the specified terminal,
+ * in a single transaction with a prepared insert.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @param terminal_id The row ID of the terminal.
+ * @param max_weight The weight limit of the pads, in tonnes.
+ * @param count The number of pads to add.
+ * @param cost_hour The hourly tariff, or negative for the default.
+ * @param cost_day The daily tariff, or negative for the default.
+ * @return A SQLite response code, with no pads added on failure.
+ */
+int add_pads(sqlite3*& db, char*& err, int terminal_id, float max_weight, int count,
+		double cost_hour = -1, double cost_day = -1);
+
+/**
+ * Get the number of shard files the database is split into, 
+ * see split_shards().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @return The number of shards, or 0 if the database isn't sharded.
+ */
+int get_shard_count(sqlite3*& db);
+
+/**
+ * Get the path of a shard file, next to the database file.
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param shard The shard number, from 0.
+ * @return The shard file path.
+ */
+std::string shard_path(sqlite3*& db, int shard);
+
+/**
+ * Split the docked ships into the specified number of shard files,
+ * so that groups of terminals each have their own write lock.
+ * Each shard is a complete database, holding copies of its terminals
+ * and pads along with their ships. The database itself keeps every
+ * terminal and pad, and the terminal_shards table routing them to 
+ * shards, while the docking log so far stays where it is.
+ * Terminals go to shards in turn unless assigned explicitly.
+ * The shard count is recorded last, so the database is left as it
+ * was if anything fails on the way.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @param count The number of shards.
+ * @param groups Pairs of terminal ID and the shard that terminal must go to.
+ * @return A SQLite response code.
+ */
+int split_shards(sqlite3*& db, char*& err, int count, 
+		const std::vector<std::pair<int, int>>& groups);
+
+/**
+ * Bring the shards up to date with the terminals and pads of the database,
+ * after adding some or changing weight limits or tariffs. New terminals 
+ * go to shards in turn. Does nothing if the database isn't sharded.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @return A SQLite response code.
+ */
+int sync_shards(sqlite3*& db, char*& err);
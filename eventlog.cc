@@ -0,0 +1,293 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include "eventlog.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+
+#include "db.h"
+
+log_writer::~log_writer()
+{
+	if (_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			_stopping = true;
+		}
+
+		_filling.notify_all();
+		_thread.join();
+
+		if (_dropped > 0)
+			fprintf(stderr, "%lu docking log events were lost.\n", _dropped);
+	}
+
+	sqlite3_finalize(_insert);
+	sqlite3_close(_db);
+}
+
+int log_writer::start(const char* path, size_t capacity, 
+		std::chrono::milliseconds interval, log_durability durability)
+{
+	int rc;
+	char* err;
+
+	if ((rc = sqlite3_open_v2(path, &_db, 
+					SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, nullptr)) != SQLITE_OK)
+	{
+		fprintf(stderr, "Failed to open log connection: %s\n", sqlite3_errmsg(_db));
+		return rc;
+	}
+
+	// The log connection competes with the docking writer
+	// for the write lock, so it has to be willing to wait.
+	sqlite3_busy_timeout(_db, 5000);
+
+	const char* sync = (durability == log_durability::full) ? "FULL" 
+		: (durability == log_durability::normal) ? "NORMAL" : "OFF";
+
+	if ((rc = set_pragma(_db, err, "synchronous", sync)) != SQLITE_OK)
+	{
+		fprintf(stderr, "Failed to set log durability - %s\n", err);
+		sqlite3_free(err);
+		return rc;
+	}
+
+	if ((rc = sqlite3_prepare_v2(_db,
+					"INSERT INTO docking_log (pad_id, license, event, date) "
+					"VALUES (?1, ?2, ?3, ?4);",
+					-1, &_insert, nullptr)) != SQLITE_OK)
+	{
+		fprintf(stderr, "SQL Error %d preparing log insert - %s\n", rc, sqlite3_errmsg(_db));
+		return rc;
+	}
+
+	begin(capacity, interval, durability);
+
+	return SQLITE_OK;
+}
+
+int log_writer::start_journal(const std::string& dir, size_t segment_bytes, size_t capacity, 
+		std::chrono::milliseconds interval, log_durability durability)
+{
+	_journal = std::make_unique<journal_writer>();
+
+	if (_journal->open(dir, segment_bytes))
+		return EXIT_FAILURE;
+
+	begin(capacity, interval, durability);
+
+	return EXIT_SUCCESS;
+}
+
+void log_writer::begin(size_t capacity, std::chrono::milliseconds interval, 
+		log_durability durability)
+{
+	_ring.resize(std::max<size_t>(1, capacity));
+	_interval = interval;
+	_durability = durability;
+	_thread = std::thread(&log_writer::run, this);
+}
+
+void log_writer::append(int pad_id, const char* license, log_event_type type)
+{
+	const auto now = std::chrono::system_clock::now().time_since_epoch();
+
+	log_event event { pad_id, type, 
+		std::chrono::duration_cast<std::chrono::milliseconds>(now).count(), {} };
+	strncpy(event.license, license, max_license_len - 1);
+
+	std::unique_lock<std::mutex> lock(_lock);
+
+	if (_count == _ring.size())
+	{
+		if (_durability == log_durability::off)
+		{
+			_dropped++;
+			return;
+		}
+
+		// Wake the writer early, and wait for it to make room.
+		_filling.notify_one();
+		_drained.wait(lock, [this] { return _count < _ring.size() || _stopping; });
+
+		if (_count == _ring.size())
+			return;
+	}
+
+	_ring[(_head + _count) % _ring.size()] = event;
+	_count++;
+
+	// Don't wait for the interval if the buffer is filling up.
+	if (_count == _ring.size() / 2)
+		_filling.notify_one();
+}
+
+uint64_t log_writer::dropped() const
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	return _dropped;
+}
+
+void log_writer::run()
+{
+	std::vector<log_event> batch;
+	int attempts = 0;
+	std::unique_lock<std::mutex> lock(_lock);
+
+	while (true)
+	{
+		// A batch that failed to write is retried once an interval,
+		// and nothing more is taken from the ring until it's written.
+		// The ring fills up meanwhile, and holds up docking as it 
+		// would if the writer were slow, or drops events with off.
+		if (batch.empty())
+		{
+			_filling.wait_for(lock, _interval, [this] 
+			{ 
+				return _stopping || _count >= _ring.size() / 2; 
+			});
+
+			// Take everything out of the ring at once,
+			// so appends can carry on while we write.
+			for (; _count > 0; _count--)
+			{
+				batch.push_back(_ring[_head]);
+				_head = (_head + 1) % _ring.size();
+			}
+		}
+		else
+		{
+			_filling.wait_for(lock, _interval, [this] { return _stopping; });
+		}
+
+		const bool stopping = _stopping;
+
+		lock.unlock();
+		_drained.notify_all();
+
+		bool written = true;
+
+		if (!batch.empty())
+			written = _journal ? write_journal(batch) : write(batch);
+
+		lock.lock();
+
+		if (written)
+		{
+			batch.clear();
+			attempts = 0;
+		}
+		else if (stopping && ++attempts >= max_write_attempts)
+		{
+			fprintf(stderr, "Gave up on %lu log events.\n", batch.size());
+
+			_dropped += batch.size();
+			batch.clear();
+		}
+
+		if (stopping && _count == 0 && batch.empty())
+			break;
+	}
+}
+
+bool log_writer::write(const std::vector<log_event>& events)
+{
+	char* err;
+	int rc;
+
+	if ((rc = sqlite3_exec(_db, "BEGIN IMMEDIATE;", nullptr, nullptr, &err)) != SQLITE_OK)
+	{
+		fprintf(stderr, "Failed to write %lu log events, will retry - %s\n", events.size(), err);
+		sqlite3_free(err);
+		return false;
+	}
+
+	uint64_t failed = 0;
+
+	for (const log_event& event : events)
+	{
+		sqlite3_bind_int(_insert, 1, event.pad_id);
+		sqlite3_bind_text(_insert, 2, event.license, -1, SQLITE_STATIC);
+		sqlite3_bind_text(_insert, 3, 
+				(event.type == log_event_type::dock) ? "dock" : "undock", -1, SQLITE_STATIC);
+		sqlite3_bind_int64(_insert, 4, event.time);
+
+		if ((rc = sqlite3_step(_insert)) != SQLITE_DONE)
+		{
+			fprintf(stderr, "SQL Error %d writing log event - %s\n", rc, sqlite3_errmsg(_db));
+			failed++;
+		}
+
+		sqlite3_reset(_insert);
+	}
+
+	if ((rc = sqlite3_exec(_db, "COMMIT;", nullptr, nullptr, &err)) != SQLITE_OK)
+	{
+		fprintf(stderr, "Failed to commit %lu log events, will retry - %s\n", events.size(), err);
+		sqlite3_free(err);
+		sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+		return false;
+	}
+
+	// Events the database refused would only be refused again.
+	if (failed > 0)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		_dropped += failed;
+	}
+
+	return true;
+}
+
+bool log_writer::write_journal(const std::vector<log_event>& events)
+{
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		const log_event& event = events[i];
+
+		// The events before this one are journaled already,
+		// so retrying the batch would journal them twice.
+		if (_journal->append(event.time, event.pad_id, event.license, 
+					static_cast<uint8_t>(event.type)))
+		{
+			fprintf(stderr, "Failed to journal %lu log events.\n", events.size() - i);
+
+			std::lock_guard<std::mutex> lock(_lock);
+			_dropped += events.size() - i;
+			break;
+		}
+	}
+
+	// The pages are written back at the kernel's pace otherwise.
+	if (_durability != log_durability::off)
+		_journal->sync(_durability == log_durability::full);
+
+	return true;
+}
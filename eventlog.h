@@ -0,0 +1,199 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sqlite3.h>
+
+#include "journal.h"
+#include "protocol.h"
+
+/**
+ * The kinds of events in the docking log.
+ */
+enum class log_event_type
+{
+	dock,
+	undock
+};
+
+/**
+ * A single docking log entry, as buffered in memory.
+ */
+struct log_event
+{
+	int pad_id;
+	log_event_type type;
+
+	/// Milliseconds since the epoch, UTC.
+	int64_t time;
+
+	char license[max_license_len];
+};
+
+/**
+ * How hard the log writer tries not to lose events.
+ */
+enum class log_durability
+{
+	/// Drop events if the buffer overflows, and don't sync the log to disk.
+	off,
+
+	/// Hold up docking if the buffer overflows, sync the log at checkpoints.
+	normal,
+
+	/// Hold up docking if the buffer overflows, sync every flush.
+	full
+};
+
+/// How many times a failing write of the docking log is tried
+/// once the writer is stopping, before its events are given up.
+constexpr int max_write_attempts = 3;
+
+/**
+ * Writes the docking log from a background thread.
+ * Events are appended to an in-memory ring buffer, which is written
+ * in bulk on every flush interval, so the docking transactions don't
+ * carry a log insert each. The buffer goes either to the docking_log
+ * table, replacing the log triggers, or to a binary journal.
+ */
+class log_writer
+{
+	public:
+
+		/**
+		 * Create a stopped log writer.
+		 */
+		log_writer() = default;
+
+		/**
+		 * Flush any remaining events and stop the writer thread.
+		 */
+		~log_writer();
+
+		/**
+		 * Open a connection for the log and start the writer thread.
+		 *
+		 * @param path The database file path.
+		 * @param capacity The number of events the buffer holds.
+		 * @param interval How often to write the buffer to the database.
+		 * @param durability How hard to try not to lose events.
+		 * @return A SQLite response code.
+		 */
+		int start(const char* path, size_t capacity, 
+				std::chrono::milliseconds interval, log_durability durability);
+
+		/**
+		 * Open a journal and start the writer thread.
+		 *
+		 * @param dir The journal directory.
+		 * @param segment_bytes The size of journal segment files.
+		 * @param capacity The number of events the buffer holds.
+		 * @param interval How often to write the buffer to the journal.
+		 * @param durability How hard to try not to lose events.
+		 * @return A C exit code.
+		 */
+		int start_journal(const std::string& dir, size_t segment_bytes, size_t capacity, 
+				std::chrono::milliseconds interval, log_durability durability);
+
+		/**
+		 * @return True if the writer has been started.
+		 */
+		bool running() const { return _thread.joinable(); }
+
+		/**
+		 * Add an event to the log buffer. Thread safe.
+		 *
+		 * @param pad_id The pad docked to or undocked from.
+		 * @param license The ship license.
+		 * @param type The kind of event.
+		 */
+		void append(int pad_id, const char* license, log_event_type type);
+
+		/**
+		 * @return The number of events lost, because the buffer was full,
+		 * the database refused them, or they couldn't be written by the
+		 * time the writer was stopped.
+		 */
+		uint64_t dropped() const;
+
+	private:
+
+		/**
+		 * Set up the buffer and start the writer thread.
+		 */
+		void begin(size_t capacity, std::chrono::milliseconds interval, 
+				log_durability durability);
+
+		/**
+		 * The writer thread, which runs until the writer is stopped.
+		 */
+		void run();
+
+		/**
+		 * Write a batch of events to the database in one transaction.
+		 * Called on the writer thread with no locks held.
+		 *
+		 * @return False if the transaction failed, and should be retried.
+		 */
+		bool write(const std::vector<log_event>& events);
+
+		/**
+		 * Append a batch of events to the journal.
+		 * Called on the writer thread with no locks held.
+		 *
+		 * @return True, as whatever was journaled can't be retried.
+		 */
+		bool write_journal(const std::vector<log_event>& events);
+
+		sqlite3* _db = nullptr;
+		sqlite3_stmt* _insert = nullptr;
+
+		/// Set if events go to a journal instead of the database.
+		std::unique_ptr<journal_writer> _journal;
+
+		/// Ring buffer of events not yet written.
+		std::vector<log_event> _ring;
+		size_t _head = 0;
+		size_t _count = 0;
+
+		uint64_t _dropped = 0;
+		bool _stopping = false;
+
+		std::chrono::milliseconds _interval { 1000 };
+		log_durability _durability = log_durability::normal;
+
+		mutable std::mutex _lock;
+		std::condition_variable _filling;
+		std::condition_variable _drained;
+		std::thread _thread;
+};
@@ -0,0 +1,179 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/**
+ * The bucket layout of the latency histograms, in the style of HdrHistogram:
+ * values are counted in log-linear buckets, each power of two split into
+ * 64 sub-buckets, so any value from nanoseconds to hours is kept to within
+ * about 1.5% in a fixed 30 KiB, and finding the bucket is a couple of shifts.
+ */
+struct histogram_layout
+{
+	/// Sub-buckets per power of two, as a power of two.
+	static constexpr int sub_bits = 7;
+	static constexpr uint64_t half = uint64_t(1) << (sub_bits - 1);
+	static constexpr size_t bucket_count = (64 - sub_bits + 2) * half;
+
+	static size_t index_of(uint64_t value)
+	{
+		const int msb = 63 - __builtin_clzll(value | 1);
+		const int shift = (msb < sub_bits) ? 0 : msb - sub_bits + 1;
+
+		return shift * half + (value >> shift);
+	}
+
+	static uint64_t highest_in(size_t index)
+	{
+		const int shift = (index < 2 * half) ? 0 : index / half - 1;
+		const uint64_t sub = index - shift * half;
+
+		return ((sub + 1) << shift) - 1;
+	}
+};
+
+/**
+ * A latency histogram for a single thread, see histogram_layout.
+ */
+class latency_histogram
+{
+	public:
+
+		latency_histogram() : _counts(histogram_layout::bucket_count, 0) { }
+
+		/**
+		 * Count a value.
+		 */
+		void record(uint64_t value)
+		{
+			_counts[histogram_layout::index_of(value)]++;
+			_total++;
+
+			if (value > _max)
+				_max = value;
+		}
+
+		/**
+		 * Add the counts of another histogram to this one.
+		 */
+		void merge(const latency_histogram& other)
+		{
+			for (size_t i = 0; i < histogram_layout::bucket_count; i++)
+				_counts[i] += other._counts[i];
+
+			_total += other._total;
+
+			if (other._max > _max)
+				_max = other._max;
+		}
+
+		/**
+		 * @param quantile The quantile, from 0 to 1.
+		 * @return The highest value that may have been counted in the bucket
+		 *         the quantile falls in, or 0 if nothing was counted.
+		 */
+		uint64_t percentile(double quantile) const
+		{
+			const uint64_t rank = static_cast<uint64_t>(quantile * _total + 0.5);
+			uint64_t seen = 0;
+
+			for (size_t i = 0; i < histogram_layout::bucket_count; i++)
+			{
+				if ((seen += _counts[i]) >= rank && seen > 0)
+					return std::min(histogram_layout::highest_in(i), _max);
+			}
+
+			return _max;
+		}
+
+		uint64_t count() const { return _total; }
+		uint64_t max() const { return _max; }
+
+	private:
+
+		friend class atomic_histogram;
+
+		std::vector<uint64_t> _counts;
+		uint64_t _total = 0;
+		uint64_t _max = 0;
+};
+
+/**
+ * A latency histogram that any number of threads can record into
+ * without locks, see histogram_layout. Counts are relaxed atomics,
+ * so a snapshot taken while others record may be off by the values
+ * being recorded at that moment.
+ */
+class atomic_histogram
+{
+	public:
+
+		atomic_histogram() : _counts(new std::atomic<uint64_t>[histogram_layout::bucket_count])
+		{
+			for (size_t i = 0; i < histogram_layout::bucket_count; i++)
+				_counts[i].store(0, std::memory_order_relaxed);
+		}
+
+		~atomic_histogram() { delete[] _counts; }
+
+		atomic_histogram(const atomic_histogram&) = delete;
+		atomic_histogram& operator=(const atomic_histogram&) = delete;
+
+		/**
+		 * Count a value.
+		 */
+		void record(uint64_t value)
+		{
+			_counts[histogram_layout::index_of(value)].fetch_add(1, std::memory_order_relaxed);
+
+			uint64_t max = _max.load(std::memory_order_relaxed);
+
+			while (value > max && !_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+				;
+		}
+
+		/**
+		 * Copy the counts so far into a histogram, to read them from.
+		 */
+		void snapshot(latency_histogram& into) const
+		{
+			into._total = 0;
+
+			for (size_t i = 0; i < histogram_layout::bucket_count; i++)
+				into._total += (into._counts[i] = _counts[i].load(std::memory_order_relaxed));
+
+			into._max = _max.load(std::memory_order_relaxed);
+		}
+
+	private:
+
+		std::atomic<uint64_t>* _counts;
+		std::atomic<uint64_t> _max { 0 };
+};
@@ -0,0 +1,630 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include "import.h"
+#include "db.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+/// The first bytes of a binary import stream.
+static const char binary_magic[8] = { 'S', 'P', 'K', 'I', 'M', 'P', '0', '1' };
+
+/// The ships inserted after ?1 that the check_before_dock trigger would have refused.
+#define IMPORT_OVERWEIGHT \
+	" FROM ships WHERE ship_id > ?1" \
+	" AND (NOT EXISTS (SELECT 1 FROM pads WHERE pad_id = ships.pad_id)" \
+	" OR weight > (SELECT max_weight FROM pads WHERE pad_id = ships.pad_id));"
+
+/**
+ * One record of the import stream, see import_format.
+ * Reused from record to record, so the strings keep their capacity.
+ */
+struct import_record
+{
+	char kind = 0;
+	int64_t id = 0;
+	int64_t terminal_id = 0;
+
+	/// The terminal name, or the license of a ship.
+	std::string name;
+	std::string manufacturer;
+	double weight = 0;
+	double cost_hour = -1;
+	double cost_day = -1;
+	int64_t date = 0;
+};
+
+enum class read_result
+{
+	record,
+	malformed,
+	end,
+	failed
+};
+
+/**
+ * Reads records from an import stream, one at a time.
+ */
+struct import_reader
+{
+	import_reader(FILE* in, import_format format) : in(in), format(format) { }
+
+	FILE* in;
+	import_format format;
+
+	/// The line (CSV) or record (binary) last read, from 1.
+	size_t position = 0;
+
+	/// Why the last record was malformed or reading failed.
+	std::string error;
+
+	char* line = nullptr;
+	size_t capacity = 0;
+
+	std::vector<std::string> fields;
+	size_t field_count = 0;
+
+	~import_reader() { free(line); }
+};
+
+/**
+ * Split a CSV line into the reader's fields, unquoting quoted ones.
+ *
+ * @return False if a quoted field isn't closed, or has text after it.
+ */
+static bool split_csv(import_reader& reader, const char* p)
+{
+	reader.field_count = 0;
+
+	for (;;)
+	{
+		if (reader.field_count == reader.fields.size())
+			reader.fields.emplace_back();
+
+		std::string& field = reader.fields[reader.field_count++];
+		field.clear();
+
+		if (*p == '"')
+		{
+			for (p++; *p != '"' || p[1] == '"'; p++)
+			{
+				if (*p == '\0')
+					return false;
+
+				// A doubled quote is a quote.
+				if (*p == '"')
+					p++;
+
+				field += *p;
+			}
+
+			if (*++p != ',' && *p != '\0')
+				return false;
+		}
+		else
+		{
+			for (; *p != ',' && *p != '\0'; p++)
+				field += *p;
+		}
+
+		if (*p == '\0')
+			return true;
+
+		p++;
+	}
+}
+
+/**
+ * Parse a whole field as an integer.
+ *
+ * @param optional Whether an empty field is allowed, and read as 0.
+ */
+static bool parse_integer(const std::string& field, int64_t& value, bool optional)
+{
+	if (field.empty())
+	{
+		value = 0;
+		return optional;
+	}
+
+	char* end;
+	value = strtoll(field.c_str(), &end, 10);
+
+	return *end == '\0';
+}
+
+/**
+ * Parse a whole field as a number.
+ *
+ * @param optional Whether an empty field is allowed, and read as -1.
+ */
+static bool parse_real(const std::string& field, double& value, bool optional)
+{
+	if (field.empty())
+	{
+		value = -1;
+		return optional;
+	}
+
+	char* end;
+	value = strtod(field.c_str(), &end);
+
+	return *end == '\0';
+}
+
+static read_result read_csv(import_reader& reader, import_record& record)
+{
+	ssize_t length;
+
+	// Skip blank lines and comments.
+	do
+	{
+		if ((length = getline(&reader.line, &reader.capacity, reader.in)) < 0)
+			return ferror(reader.in) ? read_result::failed : read_result::end;
+
+		reader.position++;
+
+		while (length > 0 && (reader.line[length - 1] == '\n' || reader.line[length - 1] == '\r'))
+			reader.line[--length] = '\0';
+	}
+	while (length == 0 || reader.line[0] == '#');
+
+	if (!split_csv(reader, reader.line))
+	{
+		reader.error = "unterminated quote";
+		return read_result::malformed;
+	}
+
+	const auto& f = reader.fields;
+	const size_t n = reader.field_count;
+
+	if (f[0] == "terminal" && n == 3)
+	{
+		record.kind = 'T';
+		record.name = f[2];
+
+		if (parse_integer(f[1], record.id, true) && !record.name.empty())
+			return read_result::record;
+	}
+	else if (f[0] == "pad" && n >= 4 && n <= 6)
+	{
+		record.kind = 'P';
+		record.cost_hour = -1;
+		record.cost_day = -1;
+
+		if (parse_integer(f[1], record.id, true)
+				&& parse_integer(f[2], record.terminal_id, false)
+				&& parse_real(f[3], record.weight, false)
+				&& (n < 5 || parse_real(f[4], record.cost_hour, true))
+				&& (n < 6 || parse_real(f[5], record.cost_day, true)))
+			return read_result::record;
+	}
+	else if (f[0] == "ship" && (n == 5 || n == 6))
+	{
+		record.kind = 'S';
+		record.name = f[2];
+		record.manufacturer = f[3];
+		record.date = 0;
+
+		if (parse_integer(f[1], record.id, false) && !record.name.empty()
+				&& parse_real(f[4], record.weight, false)
+				&& (n < 6 || parse_integer(f[5], record.date, true)))
+			return read_result::record;
+	}
+	else
+	{
+		reader.error = "unknown record '" + f[0] + "' or wrong number of fields";
+		return read_result::malformed;
+	}
+
+	reader.error = "missing or invalid field";
+	return read_result::malformed;
+}
+
+static bool read_exact(FILE* in, void* data, size_t size)
+{
+	return fread(data, 1, size, in) == size;
+}
+
+static bool read_string(FILE* in, std::string& value)
+{
+	uint16_t length;
+
+	if (!read_exact(in, &length, sizeof(length)))
+		return false;
+
+	value.resize(length);
+
+	return length == 0 || read_exact(in, &value[0], length);
+}
+
+static read_result read_binary(import_reader& reader, import_record& record)
+{
+	FILE* in = reader.in;
+
+	if (reader.position == 0)
+	{
+		char magic[sizeof(binary_magic)];
+
+		if (!read_exact(in, magic, sizeof(magic)) || memcmp(magic, binary_magic, sizeof(magic)) != 0)
+		{
+			reader.error = "not a binary import stream";
+			return read_result::failed;
+		}
+	}
+
+	if (!read_exact(in, &record.kind, 1))
+		return ferror(in) ? read_result::failed : read_result::end;
+
+	reader.position++;
+
+	bool complete;
+
+	// A record that can't be read leaves no way of finding the next one.
+	switch (record.kind)
+	{
+		case 'T':
+			complete = read_exact(in, &record.id, sizeof(record.id))
+				&& read_string(in, record.name);
+			break;
+		case 'P':
+			complete = read_exact(in, &record.id, sizeof(record.id))
+				&& read_exact(in, &record.terminal_id, sizeof(record.terminal_id))
+				&& read_exact(in, &record.weight, sizeof(record.weight))
+				&& read_exact(in, &record.cost_hour, sizeof(record.cost_hour))
+				&& read_exact(in, &record.cost_day, sizeof(record.cost_day));
+			break;
+		case 'S':
+			complete = read_exact(in, &record.id, sizeof(record.id))
+				&& read_string(in, record.name)
+				&& read_string(in, record.manufacturer)
+				&& read_exact(in, &record.weight, sizeof(record.weight))
+				&& read_exact(in, &record.date, sizeof(record.date));
+			break;
+		default:
+			reader.error = "unknown record kind";
+			return read_result::failed;
+	}
+
+	if (!complete)
+	{
+		reader.error = "truncated record";
+		return read_result::failed;
+	}
+
+	if ((record.kind == 'T' || record.kind == 'S') && record.name.empty())
+	{
+		reader.error = (record.kind == 'T') ? "empty terminal name" : "empty license";
+		return read_result::malformed;
+	}
+
+	return read_result::record;
+}
+
+/**
+ * The prepared statements of an import, finalized when it ends.
+ */
+struct import_statements
+{
+	sqlite3_stmt* terminal = nullptr;
+
+	/// Pad inserts, by which tariffs are given (bit 0 hourly, bit 1 daily).
+	sqlite3_stmt* pad[4] = {};
+
+	sqlite3_stmt* ship = nullptr;
+	sqlite3_stmt* last_ship = nullptr;
+	sqlite3_stmt* overweight = nullptr;
+	sqlite3_stmt* remove_overweight = nullptr;
+
+	~import_statements()
+	{
+		sqlite3_finalize(terminal);
+
+		for (sqlite3_stmt* stmt : pad)
+			sqlite3_finalize(stmt);
+
+		sqlite3_finalize(ship);
+		sqlite3_finalize(last_ship);
+		sqlite3_finalize(overweight);
+		sqlite3_finalize(remove_overweight);
+	}
+
+	int prepare(sqlite3* db)
+	{
+		int rc;
+
+		if ((rc = sqlite3_prepare_v2(db,
+						"INSERT INTO terminals (terminal_id, name) VALUES (?1, ?2);",
+						-1, &terminal, nullptr)) != SQLITE_OK
+				|| (rc = sqlite3_prepare_v2(db,
+						"INSERT INTO ships (pad_id, license, manufacturer, weight, date)"
+						" VALUES (?1, ?2, ?3, ?4, ?5);",
+						-1, &ship, nullptr)) != SQLITE_OK
+				|| (rc = sqlite3_prepare_v2(db, "SELECT IFNULL(MAX(ship_id), 0) FROM ships;",
+						-1, &last_ship, nullptr)) != SQLITE_OK
+				|| (rc = sqlite3_prepare_v2(db, "SELECT pad_id, license, weight" IMPORT_OVERWEIGHT,
+						-1, &overweight, nullptr)) != SQLITE_OK
+				|| (rc = sqlite3_prepare_v2(db, "DELETE" IMPORT_OVERWEIGHT,
+						-1, &remove_overweight, nullptr)) != SQLITE_OK)
+			return rc;
+
+		// Tariffs left out take the column defaults, as in add_pads().
+		for (int given = 0; given < 4; given++)
+		{
+			std::string sql = "INSERT INTO pads (pad_id, terminal_id, max_weight";
+			sql += (given & 1) ? ", cost_hour" : "";
+			sql += (given & 2) ? ", cost_day" : "";
+			sql += ") VALUES (?1, ?2, ?3";
+			sql += (given & 1) ? ", ?4" : "";
+			sql += (given & 2) ? ", ?5" : "";
+			sql += ");";
+
+			if ((rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &pad[given], nullptr)) != SQLITE_OK)
+				return rc;
+		}
+
+		return SQLITE_OK;
+	}
+};
+
+/**
+ * Bind an ID, or NULL for the database to assign one.
+ */
+static void bind_id(sqlite3_stmt* stmt, int index, int64_t id)
+{
+	if (id == 0)
+		sqlite3_bind_null(stmt, index);
+	else
+		sqlite3_bind_int64(stmt, index, id);
+}
+
+/**
+ * Insert a record. Ships are only inserted, not checked, see import_rows().
+ *
+ * @return The statement that was stepped, with its result in rc.
+ */
+static sqlite3_stmt* insert_record(import_statements& stmts, const import_record& record, int& rc)
+{
+	sqlite3_stmt* stmt = nullptr;
+
+	switch (record.kind)
+	{
+		case 'T':
+			stmt = stmts.terminal;
+			bind_id(stmt, 1, record.id);
+			sqlite3_bind_text(stmt, 2, record.name.c_str(), record.name.size(), SQLITE_STATIC);
+			break;
+		case 'P':
+			stmt = stmts.pad[(record.cost_hour >= 0) | (record.cost_day >= 0) << 1];
+			bind_id(stmt, 1, record.id);
+			sqlite3_bind_int64(stmt, 2, record.terminal_id);
+			sqlite3_bind_double(stmt, 3, record.weight);
+
+			if (record.cost_hour >= 0)
+				sqlite3_bind_double(stmt, 4, record.cost_hour);
+
+			if (record.cost_day >= 0)
+				sqlite3_bind_double(stmt, 5, record.cost_day);
+			break;
+		case 'S':
+			stmt = stmts.ship;
+			sqlite3_bind_int64(stmt, 1, record.id);
+			sqlite3_bind_text(stmt, 2, record.name.c_str(), record.name.size(), SQLITE_STATIC);
+
+			if (record.manufacturer.empty())
+				sqlite3_bind_null(stmt, 3);
+			else
+				sqlite3_bind_text(stmt, 3, record.manufacturer.c_str(),
+						record.manufacturer.size(), SQLITE_STATIC);
+
+			sqlite3_bind_double(stmt, 4, record.weight);
+			sqlite3_bind_int64(stmt, 5, (record.date != 0) ? record.date :
+					std::chrono::duration_cast<std::chrono::milliseconds>(
+						std::chrono::system_clock::now().time_since_epoch()).count());
+			break;
+	}
+
+	rc = sqlite3_step(stmt);
+	sqlite3_reset(stmt);
+
+	return stmt;
+}
+
+/**
+ * Remove the ships inserted by this transaction that
+ * check_before_dock would have refused, reporting each one.
+ *
+ * @param first The last ship ID before the transaction.
+ * @param removed Set to the number of ships removed.
+ */
+static int remove_overweight(sqlite3* db, import_statements& stmts, int64_t first, size_t& removed)
+{
+	int rc;
+
+	sqlite3_bind_int64(stmts.overweight, 1, first);
+
+	while ((rc = sqlite3_step(stmts.overweight)) == SQLITE_ROW)
+	{
+		fprintf(stderr, "Rejected ship %s - landing pad %lld does not exist "
+				"or weight limit exceeded (%.1f t).\n",
+				sqlite3_column_text(stmts.overweight, 1),
+				sqlite3_column_int64(stmts.overweight, 0),
+				sqlite3_column_double(stmts.overweight, 2));
+	}
+
+	sqlite3_reset(stmts.overweight);
+
+	if (rc != SQLITE_DONE)
+		return rc;
+
+	sqlite3_bind_int64(stmts.remove_overweight, 1, first);
+	rc = sqlite3_step(stmts.remove_overweight);
+	sqlite3_reset(stmts.remove_overweight);
+
+	removed = sqlite3_changes(db);
+
+	return (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+}
+
+int import_rows(sqlite3*& db, char*& err, FILE* in, import_format format, size_t batch,
+		const std::function<void(const import_stats&)>& progress, import_stats& stats)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const bool log_triggers = has_log_triggers(db);
+	const bool sharded = get_shard_count(db) > 0;
+
+	import_statements stmts;
+	import_reader reader { in, format };
+	import_record record;
+
+	int rc;
+
+	err = nullptr;
+	stats = import_stats();
+
+	if ((rc = stmts.prepare(db)) != SQLITE_OK)
+	{
+		err = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+		return rc;
+	}
+
+	bool more = true;
+
+	while (more)
+	{
+		size_t terminals = 0, pads = 0, ships = 0, records = 0;
+		int64_t first = 0;
+
+		// The triggers come back before the commit, so nobody else ever misses them.
+		if ((rc = sqlite3_exec(db,
+						"BEGIN IMMEDIATE;"
+						"\nDROP TRIGGER IF EXISTS check_before_dock;",
+						nullptr, nullptr, &err)) != SQLITE_OK
+				|| (rc = drop_log_triggers(db, err)) != SQLITE_OK)
+			break;
+
+		if (sqlite3_step(stmts.last_ship) == SQLITE_ROW)
+			first = sqlite3_column_int64(stmts.last_ship, 0);
+
+		sqlite3_reset(stmts.last_ship);
+
+		while (records < batch)
+		{
+			const read_result result = (format == import_format::csv) ?
+				read_csv(reader, record) : read_binary(reader, record);
+
+			if (result == read_result::end)
+			{
+				more = false;
+				break;
+			}
+
+			if (result == read_result::failed)
+			{
+				rc = SQLITE_ERROR;
+				err = sqlite3_mprintf("Failed to read record %lu: %s", reader.position,
+						reader.error.empty() ? strerror(errno) : reader.error.c_str());
+				break;
+			}
+
+			records++;
+			stats.records++;
+
+			if (result == read_result::malformed)
+			{
+				fprintf(stderr, "Rejected %s %lu - %s\n",
+						(format == import_format::csv) ? "line" : "record",
+						reader.position, reader.error.c_str());
+				stats.rejected++;
+				continue;
+			}
+
+			if (record.kind == 'S' && sharded)
+			{
+				fprintf(stderr, "Rejected ship %s - the database is sharded.\n", record.name.c_str());
+				stats.rejected++;
+				continue;
+			}
+
+			int step;
+			sqlite3_stmt* stmt = insert_record(stmts, record, step);
+
+			// A failing insert only undoes itself, the others carry on.
+			if (step != SQLITE_DONE)
+			{
+				fprintf(stderr, "Rejected %s %lu - %s\n",
+						(format == import_format::csv) ? "line" : "record",
+						reader.position, sqlite3_errmsg(db));
+				stats.rejected++;
+			}
+			else if (record.kind == 'T')
+				terminals++;
+			else if (record.kind == 'P')
+				pads++;
+			else
+				ships++;
+
+			sqlite3_clear_bindings(stmt);
+		}
+
+		size_t removed = 0;
+
+		// Nothing read, nothing to commit.
+		if (rc != SQLITE_OK || records == 0)
+			break;
+
+		if ((ships > 0 && (rc = remove_overweight(db, stmts, first, removed)) != SQLITE_OK)
+				|| (rc = init_triggers(db, err)) != SQLITE_OK
+				|| (!log_triggers && (rc = drop_log_triggers(db, err)) != SQLITE_OK)
+				|| (rc = bump_data_version(db, err)) != SQLITE_OK
+				|| (rc = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, &err)) != SQLITE_OK)
+			break;
+
+		stats.terminals += terminals;
+		stats.pads += pads;
+		stats.ships += ships - removed;
+		stats.rejected += removed;
+		stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if (progress)
+			progress(stats);
+	}
+
+	if (rc != SQLITE_OK && err == nullptr)
+		err = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+
+	// Undoes the unfinished transaction, if there is one.
+	if (!sqlite3_get_autocommit(db))
+		sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	return rc;
+}
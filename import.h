@@ -0,0 +1,122 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#include <cstdint>
+#include <functional>
+#include <sqlite3.h>
+
+/**
+ * The formats import_rows() reads.
+ *
+ * Both are a stream of terminal, pad and ship records, in any order as long
+ * as every pad comes after its terminal and every ship after its pad.
+ *
+ * CSV has one record per line, with fields quoted if they hold commas or
+ * quotes. Blank lines and lines starting with # are skipped.
+ *
+ *     terminal,[TERMINAL ID],<NAME>
+ *     pad,[PAD ID],<TERMINAL ID>,<MAX WEIGHT>,[COST HOUR],[COST DAY]
+ *     ship,<PAD ID>,<LICENSE>,[MANUFACTURER],<WEIGHT>,[DATE]
+ *
+ * IDs left out are assigned by the database, tariffs left out take the
+ * column defaults, and ships without a date (in epoch milliseconds)
+ * are docked now.
+ *
+ * The binary format starts with the 8 bytes "SPKIMP01", followed by records
+ * of a one byte kind ('T', 'P' or 'S') and fixed fields in the byte order
+ * of the machine, with strings as a uint16_t length and that many bytes:
+ *
+ *     T: int64_t terminal_id, string name
+ *     P: int64_t pad_id, int64_t terminal_id, double max_weight,
+ *        double cost_hour, double cost_day
+ *     S: int64_t pad_id, string license, string manufacturer,
+ *        double weight, int64_t date
+ *
+ * Here a zero ID, a negative tariff, an empty manufacturer
+ * or a zero date stand for a field left out.
+ */
+enum class import_format
+{
+	csv,
+	binary
+};
+
+/**
+ * What import_rows() has done so far.
+ */
+struct import_stats
+{
+	/// Rows committed to each table.
+	size_t terminals = 0;
+	size_t pads = 0;
+	size_t ships = 0;
+
+	/// Records skipped, because they were malformed or broke a constraint.
+	size_t rejected = 0;
+
+	/// Records read from the stream.
+	size_t records = 0;
+
+	/// Seconds since the import started.
+	double seconds = 0;
+
+	/**
+	 * @return The number of rows committed.
+	 */
+	size_t rows() const { return terminals + pads + ships; }
+};
+
+/**
+ * Stream terminals, pads and ships into the database, in transactions
+ * of at most batch records, with one prepared insert per table.
+ * Only the current record is held in memory, whatever the size of the stream.
+ *
+ * Each transaction drops the docking triggers while it inserts, so neither
+ * check_before_dock nor the log triggers run per ship, and imported ships
+ * aren't logged as docking. Before committing, it checks every ship it
+ * inserted against its pad's weight limit, as check_before_dock would have,
+ * removes those that are too heavy, and creates the triggers again as they
+ * were. Since DDL is transactional, other connections never see the
+ * triggers missing. The data version is bumped by every transaction.
+ *
+ * Records that are malformed or break a constraint are reported and skipped,
+ * and the rest are still imported. Ships can't be imported into a sharded
+ * database, see split_shards(), so import them before sharding.
+ * The err pointer must be freed on failure, see set_pragma().
+ *
+ * @param db The SQLite DB connection, expected to be open.
+ * @param err The error char string returned by SQLite.
+ * @param in The stream to read.
+ * @param format The format of the stream.
+ * @param batch The most records per transaction.
+ * @param progress Called after every committed transaction, may be empty.
+ * @param stats Set to what was imported, including on failure.
+ * @return A SQLite response code. Transactions committed before a failure stay committed.
+ */
+int import_rows(sqlite3*& db, char*& err, FILE* in, import_format format, size_t batch,
+		const std::function<void(const import_stats&)>& progress, import_stats& stats);
@@ -0,0 +1,385 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include "journal.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+static const char journal_magic[8] = { 'S', 'P', 'J', 'R', 'N', 'L', '1', '\0' };
+
+/**
+ * Get the path of a numbered segment file.
+ */
+static std::string segment_path(const std::string& dir, uint32_t segment)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "segment-%08u.jrn", segment);
+
+	return (fs::path(dir) / name).string();
+}
+
+/**
+ * List the segment numbers in a journal directory, in order.
+ */
+static std::vector<uint32_t> list_segments(const std::string& dir)
+{
+	std::vector<uint32_t> segments;
+	std::error_code ec;
+
+	for (const auto& entry : fs::directory_iterator(dir, ec))
+	{
+		unsigned segment;
+
+		if (sscanf(entry.path().filename().c_str(), "segment-%8u.jrn", &segment) == 1)
+			segments.push_back(segment);
+	}
+
+	std::sort(segments.begin(), segments.end());
+	return segments;
+}
+
+license_table::~license_table()
+{
+	if (_file)
+		fclose(_file);
+}
+
+int license_table::open(const std::string& path, bool writable)
+{
+	long valid = 0;
+	bool found = false;
+
+	if (FILE* in = fopen(path.c_str(), "rb"))
+	{
+		found = true;
+
+		// Each license is stored as a length byte and its characters.
+		char buf[256];
+		int len;
+
+		while ((len = fgetc(in)) != EOF && fread(buf, 1, len, in) == static_cast<size_t>(len))
+		{
+			_ids.emplace(std::string(buf, len), _licenses.size());
+			_licenses.emplace_back(buf, len);
+			valid = ftell(in);
+		}
+
+		fclose(in);
+	}
+
+	if (!writable)
+		return EXIT_SUCCESS;
+
+	// Drop a license cut short by a crash, or the ones appended
+	// after it would be misread. That may be the first one.
+	if (found && truncate(path.c_str(), valid) < 0)
+	{
+		fprintf(stderr, "Failed to repair license table %s.\n", path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	if ((_file = fopen(path.c_str(), "ab")) == nullptr)
+	{
+		fprintf(stderr, "Failed to open license table %s.\n", path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+uint32_t license_table::intern(const char* license)
+{
+	std::string key(license, strnlen(license, 255));
+	auto it = _ids.find(key);
+
+	if (it != _ids.end())
+		return it->second;
+
+	const uint32_t id = _licenses.size();
+
+	// Records are written straight into a shared mapping, so they
+	// survive the process being killed. The license has to reach the
+	// file before the first record using its index does, or it'd be
+	// lost while the record isn't, and the index reused for another.
+	if (_file)
+	{
+		fputc(key.size(), _file);
+		fwrite(key.data(), 1, key.size(), _file);
+		fflush(_file);
+	}
+
+	_ids.emplace(key, id);
+	_licenses.push_back(std::move(key));
+
+	return id;
+}
+
+const char* license_table::get(uint32_t id) const
+{
+	return (id < _licenses.size()) ? _licenses[id].c_str() : "";
+}
+
+void license_table::flush(bool wait)
+{
+	if (_file == nullptr)
+		return;
+
+	fflush(_file);
+
+	if (wait)
+		fsync(fileno(_file));
+}
+
+journal_writer::~journal_writer()
+{
+	unmap();
+
+	if (_lock > -1)
+		close(_lock);
+}
+
+int journal_writer::open(const std::string& dir, size_t segment_bytes)
+{
+	std::error_code ec;
+	fs::create_directories(dir, ec);
+
+	if (ec)
+	{
+		fprintf(stderr, "Failed to create journal directory %s - %s\n", 
+				dir.c_str(), ec.message().c_str());
+		return EXIT_FAILURE;
+	}
+
+	_dir = dir;
+	_segment_bytes = std::max(segment_bytes, sizeof(journal_header) + sizeof(journal_record));
+
+	// Two writers would overwrite each other's records.
+	const std::string lock_path = (fs::path(dir) / "lock").string();
+
+	if ((_lock = ::open(lock_path.c_str(), O_RDWR | O_CREAT, 0644)) < 0
+			|| flock(_lock, LOCK_EX | LOCK_NB) < 0)
+	{
+		fprintf(stderr, "Journal %s is in use by another process.\n", dir.c_str());
+		return EXIT_FAILURE;
+	}
+
+	if (_licenses.open((fs::path(dir) / "licenses").string(), true))
+		return EXIT_FAILURE;
+
+	std::vector<uint32_t> segments = list_segments(dir);
+
+	return map(segments.empty() ? 0 : segments.back());
+}
+
+int journal_writer::map(uint32_t segment)
+{
+	const std::string path = segment_path(_dir, segment);
+	const int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+	if (fd < 0)
+	{
+		fprintf(stderr, "Failed to open journal segment %s.\n", path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	struct stat st {};
+	const bool fresh = (fstat(fd, &st) == 0 && st.st_size == 0);
+
+	// New segments get their full size up front, so 
+	// appending never has to grow the file or the mapping.
+	if (fresh && ftruncate(fd, _segment_bytes) < 0)
+	{
+		fprintf(stderr, "Failed to size journal segment %s.\n", path.c_str());
+		::close(fd);
+		return EXIT_FAILURE;
+	}
+
+	const size_t size = fresh ? _segment_bytes : st.st_size;
+	void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if (map == MAP_FAILED)
+	{
+		fprintf(stderr, "Failed to map journal segment %s.\n", path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	_segment = segment;
+	_mapped = size;
+	_header = static_cast<journal_header*>(map);
+	_records = reinterpret_cast<journal_record*>(_header + 1);
+
+	if (fresh)
+	{
+		memcpy(_header->magic, journal_magic, sizeof(journal_magic));
+		_header->capacity = (size - sizeof(journal_header)) / sizeof(journal_record);
+		_header->count = 0;
+	}
+	else if (memcmp(_header->magic, journal_magic, sizeof(journal_magic)) != 0)
+	{
+		fprintf(stderr, "%s is not a journal segment.\n", path.c_str());
+		unmap();
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+void journal_writer::unmap()
+{
+	if (_header == nullptr)
+		return;
+
+	msync(_header, _mapped, MS_SYNC);
+	munmap(_header, _mapped);
+
+	_header = nullptr;
+	_records = nullptr;
+}
+
+int journal_writer::append(int64_t time, int pad_id, const char* license, uint8_t event)
+{
+	if (_header == nullptr)
+		return EXIT_FAILURE;
+
+	if (_header->count >= _header->capacity)
+	{
+		// Rotate to a fresh segment.
+		const uint32_t next = _segment + 1;
+
+		unmap();
+
+		if (map(next))
+			return EXIT_FAILURE;
+	}
+
+	const uint64_t n = _header->count;
+
+	journal_record& rec = _records[n];
+	rec = journal_record {};
+	rec.time = time;
+	rec.pad_id = pad_id;
+	rec.license_id = _licenses.intern(license);
+	rec.event = event;
+
+	if (n == 0 || time < _header->min_time)
+		_header->min_time = time;
+
+	if (n == 0 || time > _header->max_time)
+		_header->max_time = time;
+
+	// Readers trust the count, so it goes up only once the record is in place.
+	__atomic_store_n(&_header->count, n + 1, __ATOMIC_RELEASE);
+
+	return EXIT_SUCCESS;
+}
+
+void journal_writer::sync(bool wait)
+{
+	_licenses.flush(wait);
+
+	if (_header)
+		msync(_header, _mapped, wait ? MS_SYNC : MS_ASYNC);
+}
+
+int journal_reader::open(const std::string& dir)
+{
+	if (!fs::is_directory(dir))
+	{
+		fprintf(stderr, "No journal found at %s.\n", dir.c_str());
+		return EXIT_FAILURE;
+	}
+
+	for (uint32_t segment : list_segments(dir))
+		_segments.push_back(segment_path(dir, segment));
+
+	return _licenses.open((fs::path(dir) / "licenses").string(), false);
+}
+
+long journal_reader::scan(int pad_id, int64_t from, int64_t to, const visitor& visit) const
+{
+	long matches = 0;
+
+	for (const std::string& path : _segments)
+	{
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		struct stat st {};
+
+		if (fd < 0 || fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(journal_header))
+		{
+			fprintf(stderr, "Failed to open journal segment %s.\n", path.c_str());
+
+			if (fd > -1)
+				::close(fd);
+
+			return -1;
+		}
+
+		void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+
+		if (map == MAP_FAILED)
+		{
+			fprintf(stderr, "Failed to map journal segment %s.\n", path.c_str());
+			return -1;
+		}
+
+		const journal_header* header = static_cast<const journal_header*>(map);
+		const journal_record* records = reinterpret_cast<const journal_record*>(header + 1);
+
+		const uint64_t fits = (st.st_size - sizeof(journal_header)) / sizeof(journal_record);
+		const uint64_t count = std::min(fits, __atomic_load_n(&header->count, __ATOMIC_ACQUIRE));
+
+		if (memcmp(header->magic, journal_magic, sizeof(journal_magic)) != 0)
+			fprintf(stderr, "%s is not a journal segment, skipped.\n", path.c_str());
+		else if (count > 0 && header->min_time <= to && header->max_time >= from)
+		{
+			for (uint64_t i = 0; i < count; i++)
+			{
+				const journal_record& rec = records[i];
+
+				if ((pad_id < 0 || rec.pad_id == pad_id) && rec.time >= from && rec.time <= to)
+				{
+					visit(rec, _licenses.get(rec.license_id));
+					matches++;
+				}
+			}
+		}
+
+		munmap(map, st.st_size);
+	}
+
+	return matches;
+}
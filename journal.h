@@ -0,0 +1,226 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A docking event, as stored in the journal.
+ */
+struct journal_record
+{
+	/// Milliseconds since the epoch, UTC.
+	int64_t time;
+
+	int32_t pad_id;
+
+	/// Index into the journal license table.
+	uint32_t license_id;
+
+	/// A log_event_type value.
+	uint8_t event;
+
+	uint8_t reserved[7];
+};
+
+static_assert(sizeof(journal_record) == 24, "Journal records are stored as is.");
+
+/**
+ * The head of every journal segment file, followed by its records.
+ */
+struct journal_header
+{
+	char magic[8];
+
+	/// The number of records the segment has room for.
+	uint64_t capacity;
+
+	/// The number of records written, updated after each record.
+	uint64_t count;
+
+	/// The earliest and latest record times, for skipping segments.
+	int64_t min_time;
+	int64_t max_time;
+
+	uint8_t reserved[24];
+};
+
+static_assert(sizeof(journal_header) == 64, "Journal headers are stored as is.");
+
+/**
+ * Interned ship licenses, kept in a file next to the segments.
+ * Each license is stored once and referred to by its index.
+ */
+class license_table
+{
+	public:
+
+		~license_table();
+
+		/**
+		 * Load the table, and keep the file open for
+		 * appending new licenses if writable is set.
+		 *
+		 * @param path The license file path.
+		 * @param writable Whether licenses will be added.
+		 * @return A C exit code.
+		 */
+		int open(const std::string& path, bool writable);
+
+		/**
+		 * Get the index of a license, adding it if it's new.
+		 * New licenses are handed to the file straight away.
+		 *
+		 * @param license The license string.
+		 * @return The license index.
+		 */
+		uint32_t intern(const char* license);
+
+		/**
+		 * @param id A license index.
+		 * @return The license, or an empty string if it's unknown.
+		 */
+		const char* get(uint32_t id) const;
+
+		/**
+		 * Write new licenses back to disk.
+		 *
+		 * @param wait Whether to block until they are on disk.
+		 */
+		void flush(bool wait);
+
+	private:
+
+		FILE* _file = nullptr;
+		std::vector<std::string> _licenses;
+		std::unordered_map<std::string, uint32_t> _ids;
+};
+
+/**
+ * Appends docking events to memory-mapped journal segments.
+ * Segments are created at a fixed size and a new one is
+ * started when the last one is full. Only one writer may
+ * have a journal open at a time.
+ */
+class journal_writer
+{
+	public:
+
+		~journal_writer();
+
+		/**
+		 * Open a journal directory, creating it if needed,
+		 * and continue the last segment in it.
+		 *
+		 * @param dir The journal directory.
+		 * @param segment_bytes The size of new segment files.
+		 * @return A C exit code.
+		 */
+		int open(const std::string& dir, size_t segment_bytes);
+
+		/**
+		 * Append an event to the journal.
+		 *
+		 * @param time Milliseconds since the epoch.
+		 * @param pad_id The pad docked to or undocked from.
+		 * @param license The ship license.
+		 * @param event A log_event_type value.
+		 * @return A C exit code.
+		 */
+		int append(int64_t time, int pad_id, const char* license, uint8_t event);
+
+		/**
+		 * Write the appended records back to the segment file.
+		 *
+		 * @param wait Whether to block until they are on disk.
+		 */
+		void sync(bool wait);
+
+	private:
+
+		/**
+		 * Map a segment, creating it if it doesn't exist.
+		 */
+		int map(uint32_t segment);
+
+		/**
+		 * Write back and unmap the current segment.
+		 */
+		void unmap();
+
+		std::string _dir;
+		size_t _segment_bytes = 0;
+		int _lock = -1;
+
+		uint32_t _segment = 0;
+		size_t _mapped = 0;
+		journal_header* _header = nullptr;
+		journal_record* _records = nullptr;
+
+		license_table _licenses;
+};
+
+/**
+ * Reads docking history from a journal directory,
+ * without going through the database.
+ */
+class journal_reader
+{
+	public:
+
+		/// Called for each matching record, with its license.
+		using visitor = std::function<void(const journal_record&, const char*)>;
+
+		/**
+		 * Open a journal directory for reading.
+		 *
+		 * @param dir The journal directory.
+		 * @return A C exit code.
+		 */
+		int open(const std::string& dir);
+
+		/**
+		 * Visit the records of a pad within a time range, 
+		 * in the order they were written.
+		 *
+		 * @param pad_id The pad to look for, or -1 for all pads.
+		 * @param from The earliest time, in milliseconds since the epoch.
+		 * @param to The latest time, in milliseconds since the epoch.
+		 * @param visit Called for each matching record.
+		 * @return The number of matching records, or -1 on failure.
+		 */
+		long scan(int pad_id, int64_t from, int64_t to, const visitor& visit) const;
+
+	private:
+
+		std::vector<std::string> _segments;
+		license_table _licenses;
+};
@@ -0,0 +1,518 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include "occupancy.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <mutex>
+
+/// Milliseconds per day.
+static constexpr double day_ms = 24 * 60 * 60 * 1000.0;
+
+/**
+ * Compute a parking fee the way the fee query does,
+ * with ROUND() written as floor(x + 0.5) for the 
+ * non-negative spans we expect. Kept branch-free 
+ * on the rounding so loops over it can be vectorized.
+ *
+ * @param days The time docked, in days.
+ * @param cost_hour The hourly tariff.
+ * @param cost_day The daily tariff.
+ * @return The fee, before truncation to whole credits.
+ */
+static inline double compute_fee(double days, double cost_hour, double cost_day)
+{
+	const double hourly = std::floor((days * 24 + 0.5) + 0.5) * cost_hour;
+	const double daily = std::floor((days + 0.5) + 0.5) * cost_day;
+
+	return (days > 1) ? daily : hourly;
+}
+
+int pad_index::load(sqlite3* db)
+{
+	return load(db, { db });
+}
+
+int pad_index::load(sqlite3* db, const std::vector<sqlite3*>& ships)
+{
+	std::unique_lock<std::shared_mutex> lock(_lock);
+
+	sqlite3_stmt* stmt;
+	int rc;
+
+	_pad_ids.clear();
+	_max_weights.clear();
+	_cost_hours.clear();
+	_cost_days.clear();
+
+	// Pads are loaded in ID order, so the leftmost fitting slot is 
+	// the same pad that a table scan with LIMIT 1 would have found.
+	if ((rc = sqlite3_prepare_v2(db, 
+					"SELECT pad_id, max_weight, cost_hour, cost_day FROM pads ORDER BY pad_id;",
+					-1, &stmt, nullptr)) != SQLITE_OK)
+	{
+		fprintf(stderr, "SQL Error %d loading pads - %s\n", rc, sqlite3_errmsg(db));
+		return rc;
+	}
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		_pad_ids.push_back(sqlite3_column_int(stmt, 0));
+		_max_weights.push_back(sqlite3_column_double(stmt, 1));
+		_cost_hours.push_back(sqlite3_column_double(stmt, 2));
+		_cost_days.push_back(sqlite3_column_double(stmt, 3));
+	}
+
+	sqlite3_finalize(stmt);
+
+	if (rc != SQLITE_DONE)
+	{
+		fprintf(stderr, "SQL Error %d loading pads - %s\n", rc, sqlite3_errmsg(db));
+		return rc;
+	}
+
+	_occupied.assign(_pad_ids.size(), false);
+	_docked_at.assign(_pad_ids.size(), 0);
+
+	build_slots();
+
+	for (sqlite3* shard : ships)
+	{
+		if ((rc = load_ships(shard)) != SQLITE_OK)
+			return rc;
+	}
+
+	build_trees();
+
+	return SQLITE_OK;
+}
+
+/**
+ * The head of a pad snapshot file. It's followed by the pad
+ * arrays, doubles first: weight limits, hourly tariffs,
+ * daily tariffs and docking times, then the pad IDs and
+ * finally one occupancy byte per pad.
+ */
+struct snapshot_header
+{
+	char magic[8];
+
+	/// The schema version the snapshot was taken from.
+	uint32_t schema;
+	uint32_t reserved;
+
+	/// The data version the snapshot was taken at.
+	uint64_t data_version;
+
+	/// The number of pads.
+	uint64_t count;
+
+	uint8_t padding[32];
+};
+
+static_assert(sizeof(snapshot_header) == 64, "Snapshot headers are stored as is.");
+
+static const char snapshot_magic[8] = { 'S', 'P', 'S', 'N', 'A', 'P', '1', '\0' };
+
+/**
+ * @return The size of a snapshot of the specified number of pads.
+ */
+static size_t snapshot_size(size_t count)
+{
+	return sizeof(snapshot_header) + count * (4 * sizeof(double) + sizeof(int32_t) + 1);
+}
+
+int pad_index::save_snapshot(const std::string& path, int schema, uint64_t data_version) const
+{
+	std::shared_lock<std::shared_mutex> lock(_lock);
+
+	const size_t count = _pad_ids.size();
+
+	snapshot_header header {};
+	memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+	header.schema = schema;
+	header.data_version = data_version;
+	header.count = count;
+
+	std::vector<int32_t> ids(_pad_ids.begin(), _pad_ids.end());
+	std::vector<uint8_t> occupied(_occupied.begin(), _occupied.end());
+
+	// Written aside and renamed over the old one, so a crash
+	// halfway through leaves the previous snapshot intact.
+	const std::string temp = path + ".tmp";
+	FILE* file = fopen(temp.c_str(), "wb");
+
+	if (file == nullptr)
+	{
+		fprintf(stderr, "Failed to write snapshot %s.\n", temp.c_str());
+		return EXIT_FAILURE;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(_max_weights.data(), sizeof(double), count, file) == count
+		&& fwrite(_cost_hours.data(), sizeof(double), count, file) == count
+		&& fwrite(_cost_days.data(), sizeof(double), count, file) == count
+		&& fwrite(_docked_at.data(), sizeof(double), count, file) == count
+		&& fwrite(ids.data(), sizeof(int32_t), count, file) == count
+		&& fwrite(occupied.data(), 1, count, file) == count;
+
+	ok = (fflush(file) == 0) && ok;
+	ok = (fsync(fileno(file)) == 0) && ok;
+	ok = (fclose(file) == 0) && ok;
+
+	if (!ok || rename(temp.c_str(), path.c_str()) < 0)
+	{
+		fprintf(stderr, "Failed to write snapshot %s.\n", path.c_str());
+		unlink(temp.c_str());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int pad_index::load_snapshot(const std::string& path, int schema, uint64_t data_version)
+{
+	const int fd = ::open(path.c_str(), O_RDONLY);
+
+	if (fd < 0)
+		return EXIT_FAILURE;
+
+	struct stat st {};
+
+	if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(snapshot_header))
+	{
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return EXIT_FAILURE;
+
+	const snapshot_header* header = static_cast<const snapshot_header*>(map);
+	const size_t count = header->count;
+
+	// Anything written since the snapshot makes it useless.
+	if (memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) != 0
+			|| header->schema != static_cast<uint32_t>(schema)
+			|| header->data_version != data_version
+			|| count > static_cast<size_t>(st.st_size)
+			|| snapshot_size(count) != static_cast<size_t>(st.st_size))
+	{
+		munmap(map, st.st_size);
+		return EXIT_FAILURE;
+	}
+
+	const double* doubles = reinterpret_cast<const double*>(header + 1);
+	const int32_t* ids = reinterpret_cast<const int32_t*>(doubles + 4 * count);
+	const uint8_t* occupied = reinterpret_cast<const uint8_t*>(ids + count);
+
+	std::unique_lock<std::shared_mutex> lock(_lock);
+
+	_max_weights.assign(doubles, doubles + count);
+	_cost_hours.assign(doubles + count, doubles + 2 * count);
+	_cost_days.assign(doubles + 2 * count, doubles + 3 * count);
+	_docked_at.assign(doubles + 3 * count, doubles + 4 * count);
+	_pad_ids.assign(ids, ids + count);
+	_occupied.assign(occupied, occupied + count);
+
+	munmap(map, st.st_size);
+
+	build_slots();
+	build_trees();
+
+	return EXIT_SUCCESS;
+}
+
+int pad_index::load_ships(sqlite3* db)
+{
+	sqlite3_stmt* stmt;
+	int rc;
+
+	if ((rc = sqlite3_prepare_v2(db, "SELECT pad_id, date FROM ships;", 
+					-1, &stmt, nullptr)) != SQLITE_OK)
+	{
+		fprintf(stderr, "SQL Error %d loading ships - %s\n", rc, sqlite3_errmsg(db));
+		return rc;
+	}
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const int id = sqlite3_column_int(stmt, 0);
+
+		if (id >= 0 && static_cast<size_t>(id) < _slots.size() && _slots[id] > -1)
+		{
+			_occupied[_slots[id]] = true;
+			_docked_at[_slots[id]] = sqlite3_column_int64(stmt, 1);
+		}
+	}
+
+	sqlite3_finalize(stmt);
+
+	if (rc != SQLITE_DONE)
+	{
+		fprintf(stderr, "SQL Error %d loading ships - %s\n", rc, sqlite3_errmsg(db));
+		return rc;
+	}
+
+	return SQLITE_OK;
+}
+
+void pad_index::build_slots()
+{
+	int max_id = 0;
+
+	for (int id : _pad_ids)
+		max_id = std::max(max_id, id);
+
+	_slots.assign(max_id + 1, -1);
+
+	for (size_t i = 0; i < _pad_ids.size(); i++)
+	{
+		if (_pad_ids[i] >= 0)
+			_slots[_pad_ids[i]] = i;
+	}
+}
+
+void pad_index::build_trees()
+{
+	// Build the tree bottom-up, with a power of two leaves.
+	_leaves = 1;
+
+	while (_leaves < _pad_ids.size())
+		_leaves *= 2;
+
+	_tree.assign(2 * _leaves, no_pad);
+
+	for (size_t i = 0; i < _pad_ids.size(); i++)
+		_tree[_leaves + i] = _occupied[i] ? no_pad : _max_weights[i];
+
+	for (size_t node = _leaves - 1; node > 0; node--)
+		_tree[node] = std::max(_tree[2 * node], _tree[2 * node + 1]);
+
+	// Rank the pads by weight limit for best-fit allocation.
+	_by_weight.resize(_pad_ids.size());
+	_rank_weights.resize(_pad_ids.size());
+	_ranks.resize(_pad_ids.size());
+
+	for (size_t i = 0; i < _by_weight.size(); i++)
+		_by_weight[i] = i;
+
+	std::stable_sort(_by_weight.begin(), _by_weight.end(), [this](int a, int b)
+	{
+		return _max_weights[a] < _max_weights[b];
+	});
+
+	_free_ranks.assign(2 * _leaves, false);
+
+	for (size_t rank = 0; rank < _by_weight.size(); rank++)
+	{
+		const int slot = _by_weight[rank];
+
+		_ranks[slot] = rank;
+		_rank_weights[rank] = _max_weights[slot];
+		_free_ranks[_leaves + rank] = !_occupied[slot];
+	}
+
+	for (size_t node = _leaves - 1; node > 0; node--)
+		_free_ranks[node] = _free_ranks[2 * node] || _free_ranks[2 * node + 1];
+}
+
+int pad_index::first_fit(double weight) const
+{
+	std::shared_lock<std::shared_mutex> lock(_lock);
+
+	if (_tree.size() < 2 || !(_tree[1] > weight))
+		return -1;
+
+	// Some pad under each visited node fits,
+	// so prefer the left (lower ID) child whenever it does.
+	size_t node = 1;
+
+	while (node < _leaves)
+		node = (_tree[2 * node] > weight) ? 2 * node : 2 * node + 1;
+
+	return _pad_ids[node - _leaves];
+}
+
+int pad_index::best_fit(double weight) const
+{
+	std::shared_lock<std::shared_mutex> lock(_lock);
+
+	// The first rank with a limit above the weight, like max_weight > weight.
+	const size_t rank = std::upper_bound(_rank_weights.begin(), 
+			_rank_weights.end(), weight) - _rank_weights.begin();
+
+	if (rank >= _rank_weights.size())
+		return -1;
+
+	const long free_rank = next_free_rank(rank);
+
+	return (free_rank < 0) ? -1 : _pad_ids[_by_weight[free_rank]];
+}
+
+bool pad_index::exists(int id) const
+{
+	std::shared_lock<std::shared_mutex> lock(_lock);
+
+	return id >= 0 && static_cast<size_t>(id) < _slots.size() && _slots[id] > -1;
+}
+
+bool pad_index::is_free(int id) const
+{
+	std::shared_lock<std::shared_mutex> lock(_lock);
+
+	if (id < 0 || static_cast<size_t>(id) >= _slots.size() || _slots[id] < 0)
+		return true;
+
+	return !_occupied[_slots[id]];
+}
+
+void pad_index::set_occupied(int id, bool occupied, int64_t docked_at)
+{
+	std::unique_lock<std::shared_mutex> lock(_lock);
+
+	if (id < 0 || static_cast<size_t>(id) >= _slots.size() || _slots[id] < 0)
+		return;
+
+	const size_t slot = _slots[id];
+
+	_occupied[slot] = occupied;
+	_docked_at[slot] = occupied ? docked_at : 0;
+	update(slot);
+}
+
+int pad_index::seconds_docked(int id, int64_t now) const
+{
+	std::shared_lock<std::shared_mutex> lock(_lock);
+
+	if (id < 0 || static_cast<size_t>(id) >= _slots.size() || _slots[id] < 0 
+			|| !_occupied[_slots[id]])
+		return -1;
+
+	return static_cast<int>((now - _docked_at[_slots[id]]) / 1000);
+}
+
+int pad_index::fee(int id, int64_t now) const
+{
+	std::shared_lock<std::shared_mutex> lock(_lock);
+
+	if (id < 0 || static_cast<size_t>(id) >= _slots.size() || _slots[id] < 0 
+			|| !_occupied[_slots[id]])
+		return -1;
+
+	const size_t slot = _slots[id];
+	const double days = (now - _docked_at[slot]) / day_ms;
+
+	return static_cast<int>(compute_fee(days, _cost_hours[slot], _cost_days[slot]));
+}
+
+size_t pad_index::fees(int64_t now, std::vector<int>& pad_ids, std::vector<int>& fees) const
+{
+	std::shared_lock<std::shared_mutex> lock(_lock);
+
+	const size_t count = _pad_ids.size();
+	const double* docked_at = _docked_at.data();
+	const double* cost_hours = _cost_hours.data();
+	const double* cost_days = _cost_days.data();
+
+	// Compute a fee for every pad over the tariff arrays, 
+	// which leaves the compiler a plain loop to vectorize,
+	// then keep the ones with a ship docked.
+	std::vector<double> all(count);
+	double* out = all.data();
+
+	for (size_t i = 0; i < count; i++)
+		out[i] = compute_fee((now - docked_at[i]) / day_ms, cost_hours[i], cost_days[i]);
+
+	pad_ids.clear();
+	fees.clear();
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (_occupied[i])
+		{
+			pad_ids.push_back(_pad_ids[i]);
+			fees.push_back(static_cast<int>(out[i]));
+		}
+	}
+
+	return pad_ids.size();
+}
+
+size_t pad_index::size() const
+{
+	std::shared_lock<std::shared_mutex> lock(_lock);
+
+	return _pad_ids.size();
+}
+
+void pad_index::update(size_t slot)
+{
+	size_t node = _leaves + slot;
+	_tree[node] = _occupied[slot] ? no_pad : _max_weights[slot];
+
+	for (node /= 2; node > 0; node /= 2)
+		_tree[node] = std::max(_tree[2 * node], _tree[2 * node + 1]);
+
+	node = _leaves + _ranks[slot];
+	_free_ranks[node] = !_occupied[slot];
+
+	for (node /= 2; node > 0; node /= 2)
+		_free_ranks[node] = _free_ranks[2 * node] || _free_ranks[2 * node + 1];
+}
+
+long pad_index::next_free_rank(size_t rank) const
+{
+	size_t node = _leaves + rank;
+
+	// Climb until a right sibling has something free...
+	if (!_free_ranks[node])
+	{
+		while (node > 1 && ((node & 1) || !_free_ranks[node + 1]))
+			node /= 2;
+
+		if (node <= 1)
+			return -1;
+
+		node++;
+	}
+
+	// ...then walk down to its leftmost free leaf.
+	while (node < _leaves)
+		node = _free_ranks[2 * node] ? 2 * node : 2 * node + 1;
+
+	return node - _leaves;
+}
@@ -0,0 +1,261 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+/**
+ * An in-memory index of landing pads and their occupancy,
+ * so dock queries can be answered without touching the database.
+ *
+ * Pads are kept in slots ordered by pad ID, with a max-tree
+ * over the weight limit of every free pad on top. Finding the
+ * first free pad that fits a ship walks down the tree,
+ * which is O(log n) in the number of pads.
+ *
+ * The pads are also ranked by weight limit, with a tree marking
+ * which ranks are free. Finding the smallest free pad that fits
+ * a ship is a binary search for the first rank that fits,
+ * followed by a walk to the next free rank, also O(log n).
+ *
+ * Each pad also keeps its tariffs and the time its ship docked,
+ * so fees are computed here rather than by the database.
+ *
+ * The index is loaded from the database once (or from a snapshot
+ * of itself), and must be kept coherent by reporting every 
+ * successful dock and undock to it.
+ * All methods are thread safe.
+ */
+class pad_index
+{
+	public:
+
+		/**
+		 * Load all pads and docked ships from the database.
+		 *
+		 * @param db An open sqlite3 database connection.
+		 * @return A SQLite response code.
+		 */
+		int load(sqlite3* db);
+
+		/**
+		 * Load all pads from one database, and the docked ships
+		 * from several, for databases split into shards.
+		 *
+		 * @param pads The database holding every pad.
+		 * @param ships The databases holding the docked ships.
+		 * @return A SQLite response code.
+		 */
+		int load(sqlite3* pads, const std::vector<sqlite3*>& ships);
+
+		/**
+		 * Load the index from a snapshot file, if the snapshot
+		 * was taken at the specified schema and data version.
+		 *
+		 * @param path The snapshot file path.
+		 * @param schema The current schema version.
+		 * @param data_version The current data version of the database.
+		 * @return A C exit code, failing if the snapshot
+		 * is missing, damaged or out of date.
+		 */
+		int load_snapshot(const std::string& path, int schema, uint64_t data_version);
+
+		/**
+		 * Write the index to a snapshot file, replacing it atomically.
+		 * The index must be in sync with the specified data version.
+		 *
+		 * @param path The snapshot file path.
+		 * @param schema The current schema version.
+		 * @param data_version The data version the index is in sync with.
+		 * @return A C exit code.
+		 */
+		int save_snapshot(const std::string& path, int schema, uint64_t data_version) const;
+
+		/**
+		 * Find the free pad with the lowest ID which
+		 * can take a ship of the specified weight.
+		 *
+		 * @param weight The ship weight.
+		 * @return A free pad ID, or -1 if none was found.
+		 */
+		int first_fit(double weight) const;
+
+		/**
+		 * Find the free pad with the lowest weight limit
+		 * which can take a ship of the specified weight,
+		 * preferring the lowest ID among equal limits.
+		 * This leaves larger pads free for heavier ships.
+		 *
+		 * @param weight The ship weight.
+		 * @return A free pad ID, or -1 if none was found.
+		 */
+		int best_fit(double weight) const;
+
+		/**
+		 * Check whether a pad exists.
+		 *
+		 * @param id The pad ID.
+		 * @return True if the pad exists.
+		 */
+		bool exists(int id) const;
+
+		/**
+		 * Check whether a pad is free.
+		 * Pads that don't exist are reported as free, just like
+		 * a query for ships docked there would.
+		 *
+		 * @param id The pad ID.
+		 * @return True if no ship is docked at the pad.
+		 */
+		bool is_free(int id) const;
+
+		/**
+		 * Mark a pad as occupied or free.
+		 * Unknown pad IDs are ignored.
+		 *
+		 * @param id The pad ID.
+		 * @param occupied True if a ship docked, false if it undocked.
+		 * @param docked_at When the ship docked, in milliseconds 
+		 * since the epoch, as stored in the database.
+		 */
+		void set_occupied(int id, bool occupied, int64_t docked_at = 0);
+
+		/**
+		 * Get the number of seconds the ship at a pad has been docked.
+		 *
+		 * @param id The pad ID.
+		 * @param now The current time, in milliseconds since the epoch.
+		 * @return The number of seconds, or -1 if no ship is docked.
+		 */
+		int seconds_docked(int id, int64_t now) const;
+
+		/**
+		 * Get the current parking fee of the ship at a pad.
+		 * Each started hour costs the hourly tariff of the pad,
+		 * and past one day, each started day the daily tariff.
+		 *
+		 * @param id The pad ID.
+		 * @param now The current time, in milliseconds since the epoch.
+		 * @return The fee, or -1 if no ship is docked.
+		 */
+		int fee(int id, int64_t now) const;
+
+		/**
+		 * Get the current parking fee of every docked ship.
+		 * The fees are computed over all pads in one pass.
+		 *
+		 * @param now The current time, in milliseconds since the epoch.
+		 * @param pad_ids Set to the IDs of the occupied pads.
+		 * @param fees Set to the fee at each of those pads.
+		 * @return The number of docked ships.
+		 */
+		size_t fees(int64_t now, std::vector<int>& pad_ids, std::vector<int>& fees) const;
+
+		/**
+		 * @return The number of pads in the index.
+		 */
+		size_t size() const;
+
+	private:
+
+		/// Sentinel tree value for a slot with no free pad.
+		static constexpr double no_pad = -std::numeric_limits<double>::infinity();
+
+		/**
+		 * Mark the pads with ships in the database as occupied.
+		 * The caller must hold the write lock.
+		 */
+		int load_ships(sqlite3* db);
+
+		/**
+		 * Map pad IDs to slots, from the loaded pad IDs.
+		 * The caller must hold the write lock.
+		 */
+		void build_slots();
+
+		/**
+		 * Build both allocation trees from the loaded pads.
+		 * The caller must hold the write lock.
+		 */
+		void build_trees();
+
+		/**
+		 * Recompute the tree from a changed slot up to the root.
+		 * The caller must hold the write lock.
+		 */
+		void update(size_t slot);
+
+		/**
+		 * Find the first free rank at or after the specified one.
+		 * The caller must hold a lock.
+		 *
+		 * @return The rank, or -1 if none is free.
+		 */
+		long next_free_rank(size_t rank) const;
+
+		/// Pad ID of each slot.
+		std::vector<int> _pad_ids;
+
+		/// Weight limit of each slot.
+		std::vector<double> _max_weights;
+
+		/// Whether each slot is occupied.
+		std::vector<bool> _occupied;
+
+		/// Hourly and daily tariff of each slot.
+		std::vector<double> _cost_hours;
+		std::vector<double> _cost_days;
+
+		/// When the ship at each slot docked, in milliseconds since the epoch.
+		std::vector<double> _docked_at;
+
+		/// Slot of each pad ID, or -1.
+		std::vector<int> _slots;
+
+		/// Max-tree over the weight limits of free pads,
+		/// with leaves starting at index _leaves.
+		std::vector<double> _tree;
+		size_t _leaves = 0;
+
+		/// Slots ordered by weight limit, then pad ID.
+		std::vector<int> _by_weight;
+
+		/// Weight limit of each rank, ascending.
+		std::vector<double> _rank_weights;
+
+		/// Rank of each slot.
+		std::vector<int> _ranks;
+
+		/// Tree marking whether any rank below a node is free,
+		/// with leaves starting at index _leaves.
+		std::vector<char> _free_ranks;
+
+		mutable std::shared_mutex _lock;
+};
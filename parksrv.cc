@@ -5,453 +5,1445 @@
 #include <cstdlib>
 #include <cerrno>
 #include <unistd.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <sys/types.h>  
 #include <sys/socket.h>  
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <netinet/in.h>  
 
+#include <algorithm>
+#include <chrono>
 #include <functional>
+#include <future>
 #include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "db.h"
 #include "protocol.h"
+#include "statements.h"
 
-parking_server::parking_server(sqlite3*& db)
-	: _db(db)
+/**
+ * A response produced outside of its event loop,
+ * waiting to be queued on the connection.
+ */
+struct completion
 {
-}
+	int fd;
+	uint64_t serial;
+	size_t length;
+	char data[max_response_len];
+};
 
-parking_server::~parking_server()
+struct parking_server::worker
 {
-}
+	worker(size_t limit, std::atomic<size_t>& total)
+		: clients(limit, total), wake(eventfd(0, EFD_NONBLOCK)),
+		spare(::open("/dev/null", O_RDONLY | O_CLOEXEC))
+	{
+	}
+
+	~worker()
+	{
+		if (epfd > -1)
+			close(epfd);
 
+		if (listener > -1)
+			close(listener);
 
-/**
- * This function is run once for every returned row from a SQL query,
- * and sets the variable 'var' equal to the first column as an integer.
- *
- * @param var The input variable which will be set.
- * @return This function always returns EXIT_SUCCESS.
- */
-static int get_first_as_integer(void* var, int, char** argv, char**)
+		if (wake > -1)
+			close(wake);
+
+		if (spare > -1)
+			close(spare);
+	}
+
+	int listener = -1;
+	int epfd = -1;
+	connection_table clients;
+	char data[buffer_size];
+
+	/// Connections with responses queued during this iteration.
+	std::vector<int> flush_list;
+
+	/// Readable when other threads have left completed responses.
+	int wake;
+
+	/// Held open so that a client can still be accepted, and turned 
+	/// away, when the process has run out of descriptors.
+	int spare;
+
+	std::mutex completions_lock;
+	std::vector<completion> completions;
+	std::vector<completion> delivering;
+};
+
+struct parking_server::shard
 {
-	*reinterpret_cast<int*>(var) = atoi(argv[0]);
-	return EXIT_SUCCESS;
+	shard(sqlite3* db, bool owned)
+		: connection(owned ? db : nullptr, sqlite3_close_v2), db(db), commits(db, db_lock)
+	{
+	}
+
+	/// Closes the connection after everything using it, if it's the shard's own.
+	std::unique_ptr<sqlite3, int (*)(sqlite3*)> connection;
+
+	sqlite3* db;
+
+	/// Serializes all use of the shard connection.
+	std::mutex db_lock;
+
+	/// The data version the pad index was loaded at.
+	uint64_t loaded_version = 0;
+
+	/// Prepared statements on the shard connection.
+	statement_cache statements;
+
+	/// Read-only connections for queries that don't need the writer.
+	reader_pool readers;
+
+	/// Moves old docking log entries to the archive tables, if enabled.
+	log_archiver archive;
+
+	/// Batches docking writes into shared transactions.
+	/// Declared last, so it's stopped before the rest go away.
+	commit_queue commits;
+};
+
+parking_server::parking_server(sqlite3*& db, const server_options& options)
+	: _db(db), _options(options), _request_log(options.request_log), _connected(0), _stopped(false),
+	_stop_event(eventfd(0, EFD_NONBLOCK))
+{
+	const int version = get_schema_version(_db);
+
+	// Empty databases fail below, and are told to initialize.
+	if (version != 0 && version != schema_version)
+	{
+		fprintf(stderr, "The database schema is version %d, but version %d is needed.\n"
+				"Please run spacepark-config migrate to upgrade it.\n", version, schema_version);
+		_ready = false;
+		return;
+	}
+
+	_ready = (open_shards() == SQLITE_OK);
+
+	if (!_ready)
+		return;
+
+	// Snapshots are taken between batches, when the pad index
+	// has caught up with everything the batches committed.
+	// With several shards, the first writer to get there takes it.
+	const auto snapshot = [this](uint64_t)
+	{
+		std::unique_lock<std::mutex> lock(_snapshot_lock, std::try_to_lock);
+		const auto now = std::chrono::steady_clock::now();
+
+		if (lock && _options.snapshot_interval > 0 
+				&& now - _last_snapshot >= std::chrono::seconds(_options.snapshot_interval))
+		{
+			_last_snapshot = now;
+			save_snapshot();
+		}
+	};
+
+	for (auto& s : _shards)
+	{
+		if (!_options.snapshot_path.empty())
+			s->commits.on_commit(snapshot);
+	}
+
+	for (auto& s : _shards)
+		_ready = _ready && (s->statements.prepare(s->db) == SQLITE_OK);
+
+	_ready = _ready && (load_pads() == SQLITE_OK);
+
+	for (auto& s : _shards)
+	{
+		_ready = _ready && (s->commits.start(std::chrono::microseconds(_options.commit_window), 
+					_options.commit_batch, s->loaded_version) == SQLITE_OK);
+	}
+
+	// In-memory and temporary databases can't be shared between connections.
+	const char* path = sqlite3_db_filename(_db, "main");
+
+	const bool file = (path && path[0] != '\0');
+
+	for (auto& s : _shards)
+	{
+		const char* shard_path = sqlite3_db_filename(s->db, "main");
+
+		if (_ready && file && _options.read_connections > 0)
+			_ready = (s->readers.open(shard_path, _options.read_connections) == SQLITE_OK);
+	}
+
+	if (!_ready || _options.logging == log_mode::trigger)
+		return;
+
+	const auto interval = std::chrono::milliseconds(_options.log_interval);
+
+	bool triggers = false;
+
+	for (auto& s : _shards)
+		triggers = triggers || has_log_triggers(s->db);
+
+	// Both writing the log would log everything twice.
+	if (triggers)
+	{
+		fprintf(stderr, "The docking log triggers must be dropped for async logging, "
+				"run spacepark-config log async.\n");
+		_ready = false;
+	}
+	else if (_options.logging == log_mode::journal)
+	{
+		_ready = (_log.start_journal(_options.journal_dir, 
+					static_cast<size_t>(_options.journal_segment) << 20,
+					_options.log_buffer, interval, _options.log_sync) == EXIT_SUCCESS);
+	}
+	else if (!file)
+	{
+		fprintf(stderr, "Async logging needs a database file.\n");
+		_ready = false;
+	}
+	else
+	{
+		_ready = (_log.start(path, _options.log_buffer, interval, 
+					_options.log_sync) == SQLITE_OK);
+	}
 }
 
-/**
- * This function is similar to get_first_as_integer(),
- * but returns 1 (i.e EXIT_FAILURE) if the column
- * was evaluated to 0.
- * @param var The input variable which will be set.
- * @return 1 if var is 0, 0 otherwise.
- */
-static int get_first_as_integer_not_zero(void* var, int, char** argv, char**)
+parking_server::~parking_server()
 {
-	return (*reinterpret_cast<int*>(var) = atoi(argv[0])) == 0;
+	// Leave a snapshot for a quick start next time, unless this
+	// was a one-off command that didn't change anything.
+	if (_ready && !_options.snapshot_path.empty())
+	{
+		bool written = _served;
+
+		for (auto& s : _shards)
+		{
+			s->commits.drain();
+			written = written || (s->commits.version() != s->loaded_version);
+		}
+
+		if (written && !save_snapshot())
+			fprintf(stderr, "The database was changed by another process, "
+					"the pads will be reloaded on the next start.\n");
+	}
+
+	close(_stop_event);
 }
 
-/**
- * This function will always return failure,
- * causing SQLite to report SQLITE_ABORT
- * -- functioning as a sort of EXISTS-equivalent
- */
-static int row_exists_callback(void*, int, char**, char**)
+int parking_server::start_archivers()
 {
-	return EXIT_FAILURE;	
+	const char* path = sqlite3_db_filename(_db, "main");
+	const auto interval = std::chrono::seconds(_options.archive_interval);
+
+	// In-memory databases have no other connection to archive with.
+	if (_options.log_retention <= 0 || path == nullptr || path[0] == '\0')
+		return SQLITE_OK;
+
+	int rc;
+
+	// The directory's own log is archived last.
+	for (auto& s : _shards)
+	{
+		if (s->db != _db && (rc = s->archive.start(sqlite3_db_filename(s->db, "main"), 
+						_options.log_retention, _options.archive_batch, interval)) != SQLITE_OK)
+			return rc;
+	}
+
+	return _archive.start(path, _options.log_retention, _options.archive_batch, interval);
 }
 
-int parking_server::get_free_dock(float weight) const
+int parking_server::open_shards()
 {
-	char* statement;
-	char* err;
+	const int count = get_shard_count(_db);
 
-	int dock = -1;
-	int c, rc;
+	if (count == 0)
+	{
+		_shards.push_back(std::make_unique<shard>(_db, false));
+		return SQLITE_OK;
+	}
 
-	if ((c = asprintf(&statement,
-			"SELECT pad_id FROM pads "
-			"WHERE pad_id NOT IN ("
-			"SELECT pad_id FROM ships) "
-			"AND max_weight > %f "
-			"LIMIT 1;", weight)) > 0)
+	for (int i = 0; i < count; i++)
 	{
+		const std::string path = shard_path(_db, i);
+		sqlite3* db;
+		char* err;
+		int rc;
+
+		if ((rc = sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr)) != SQLITE_OK)
+		{
+			fprintf(stderr, "Failed to open shard %s: %s\n", path.c_str(), sqlite3_errmsg(db));
+			sqlite3_close(db);
+			return rc;
+		}
 
-		if ((rc = sqlite3_exec(_db, statement,
-				get_first_as_integer_not_zero,
-				&dock, 
-				&err)) > 0)
+		_shards.push_back(std::make_unique<shard>(db, true));
+
+		// Set up like the main connection, see server.cc.
+		if ((rc = set_pragma(db, err, "foreign_keys", "ON")) != SQLITE_OK
+				|| (rc = set_pragma(db, err, "journal_mode", "WAL")) != SQLITE_OK)
 		{
-			fprintf(stderr, "SQL Error %d in get_free_dock - %s\n", rc, err);
+			fprintf(stderr, "Failed to configure shard %s - %s\n", path.c_str(), err);
 			sqlite3_free(err);
+			return rc;
 		}
+
+		sqlite3_busy_timeout(db, 5000);
+
+		if (get_schema_version(db) != schema_version)
+		{
+			fprintf(stderr, "Shard %s has schema version %d, but version %d is needed.\n", 
+					path.c_str(), get_schema_version(db), schema_version);
+			return SQLITE_ERROR;
+		}
+	}
+
+	sqlite3_stmt* stmt;
+	int rc;
+
+	if ((rc = sqlite3_prepare_v2(_db, 
+					"SELECT pad_id, shard FROM pads JOIN terminal_shards USING (terminal_id);",
+					-1, &stmt, nullptr)) != SQLITE_OK)
+	{
+		fprintf(stderr, "SQL Error %d loading shard routes - %s\n", rc, sqlite3_errmsg(_db));
+		return rc;
+	}
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const int id = sqlite3_column_int(stmt, 0);
+		const int shard = sqlite3_column_int(stmt, 1);
+
+		if (id < 0 || shard < 0 || shard >= count)
+			continue;
+
+		if (static_cast<size_t>(id) >= _routes.size())
+			_routes.resize(id + 1, 0);
+
+		_routes[id] = static_cast<uint16_t>(shard);
 	}
 
-	free(statement);
+	sqlite3_finalize(stmt);
+
+	if (rc != SQLITE_DONE)
+	{
+		fprintf(stderr, "SQL Error %d loading shard routes - %s\n", rc, sqlite3_errmsg(_db));
+		return rc;
+	}
 
-	return dock;
+	fprintf(stdout, "Opened %d shards.\n", count);
+
+	return SQLITE_OK;
 }
 
-bool parking_server::dock_is_free(int id) const
+parking_server::shard& parking_server::route(int id) const
+{
+	if (id >= 0 && static_cast<size_t>(id) < _routes.size())
+		return *_shards[_routes[id]];
+
+	return *_shards.front();
+}
+
+uint64_t parking_server::data_version() const
 {
-	// No range check here! We should do that.
-	// In fact, this whole method is pretty stupid.
+	uint64_t version = _directory_version;
 
-	char* statement;
-	char* err;
- 
-	int c;
-	int rc = -1;
+	for (auto& s : _shards)
+		version += s->commits.version();
+
+	return version;
+}
 
-	if ((c = asprintf(&statement, "SELECT pad_id FROM ships WHERE pad_id = %d;", id)) > 0)
+bool parking_server::save_snapshot()
+{
+	// Someone else bumped the version, so the index may be missing
+	// their changes and there's no version it's known to match.
+	for (auto& s : _shards)
 	{
-		if ((rc = sqlite3_exec(_db, statement, row_exists_callback, nullptr, &err)) != SQLITE_OK)
-		{
-			sqlite3_free(err);
-		}
-		
-		free(statement);
+		if (s->commits.stale())
+			return false;
 	}
 
-	// If the response code is 0, then the callback hasn't aborted the query,
-	// and the range constraints haven't failed -- i.e. the dock is free!
-	return (rc == SQLITE_OK);
+	_pads.save_snapshot(_options.snapshot_path, schema_version, data_version());
+	return true;
 }
 
-int parking_server::get_seconds_docked(int id) const
+int parking_server::load_pads()
 {
-	char* statement;
-	char* err;
+	const bool sharded = (_shards.front()->db != _db);
+
+	std::vector<sqlite3*> ships;
+	int rc = SQLITE_OK;
+
+	// Read the versions and the pads in one read transaction per
+	// database, so the versions are the ones the pads were loaded at.
+	if (sharded && (rc = sqlite3_exec(_db, "BEGIN;", nullptr, nullptr, nullptr)) != SQLITE_OK)
+		return rc;
 
-	int seconds = -1;
+	_directory_version = sharded ? get_data_version(_db) : 0;
 
-	int c;
-	int rc = -1;
+	uint64_t version = _directory_version;
 
-	if ((c = asprintf(&statement, 
-					"SELECT CAST ("
-					"(JulianDay('NOW') - JulianDay(date)) * 24 * 60 * 60"
-					" AS INTEGER) "
-					"FROM ships "
-					"WHERE pad_id = %d;", id)) > 0)
+	for (auto& s : _shards)
 	{
-		if ((rc = sqlite3_exec(_db, statement, 
-						get_first_as_integer, &seconds, &err)) != SQLITE_OK)
+		if ((rc = sqlite3_exec(s->db, "BEGIN;", nullptr, nullptr, nullptr)) != SQLITE_OK)
+			break;
+
+		s->loaded_version = get_data_version(s->db);
+		version += s->loaded_version;
+		ships.push_back(s->db);
+	}
+
+	if (rc == SQLITE_OK)
+	{
+		_from_snapshot = !_options.snapshot_path.empty() 
+			&& _pads.load_snapshot(_options.snapshot_path, schema_version, version) == EXIT_SUCCESS;
+
+		if (!_from_snapshot)
+			rc = _pads.load(_db, ships);
+	}
+
+	if (rc == SQLITE_OK && sharded)
+		rc = load_licenses();
+
+	for (sqlite3* db : ships)
+		sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+
+	if (sharded)
+		sqlite3_exec(_db, "COMMIT;", nullptr, nullptr, nullptr);
+
+	_last_snapshot = std::chrono::steady_clock::now();
+
+	return rc;
+}
+
+int parking_server::load_licenses()
+{
+	std::lock_guard<std::mutex> lock(_licenses_lock);
+
+	for (auto& s : _shards)
+	{
+		sqlite3_stmt* stmt;
+		int rc;
+
+		if ((rc = sqlite3_prepare_v2(s->db, "SELECT license, pad_id FROM ships;", 
+						-1, &stmt, nullptr)) != SQLITE_OK)
 		{
-			fprintf(stderr, "SQL Error %d in get_seconds_docked - %s\nQuery: %s\n", rc, err, statement);
-			sqlite3_free(err);
+			fprintf(stderr, "SQL Error %d loading licenses - %s\n", rc, sqlite3_errmsg(s->db));
+			return rc;
+		}
+
+		while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+		{
+			const unsigned char* text = sqlite3_column_text(stmt, 0);
+
+			if (text)
+				_licenses.emplace(reinterpret_cast<const char*>(text), sqlite3_column_int(stmt, 1));
 		}
 
-		free(statement);
+		sqlite3_finalize(stmt);
+
+		if (rc != SQLITE_DONE)
+		{
+			fprintf(stderr, "SQL Error %d loading licenses - %s\n", rc, sqlite3_errmsg(s->db));
+			return rc;
+		}
 	}
 
-	return seconds;
+	return SQLITE_OK;
 }
 
-int parking_server::get_fee(int id) const
+bool parking_server::claim_license(const std::string& license, int id)
 {
-	char* statement;
-	char* err;
-
-	int fee = -1;
-
-	int c;
-	int rc = -1;
-
-	if ((c = asprintf(&statement, 
-					"WITH span AS ("
-					"\n    SELECT"
-					"\n    (JulianDay('NOW') - JulianDay(date))"
-					"\n    AS days"
-					"\n    FROM ships"
-					"\n    WHERE pad_id = %d"
-					"\n    )"
-					"\nSELECT"
-					"\nCASE"
-					"\n    WHEN days > 1 THEN"
-					"\n    ROUND(days + 0.5) * cost_day"
-					"\n    ELSE"
-					"\n    ROUND(days * 24 + 0.5) * cost_hour"
-					"\n    END fee"
-					"\nFROM pads, span"
-					"\nWHERE pad_id = %d", id, id)) > 0)
-	{
-		if ((rc = sqlite3_exec(_db, statement, 
-						get_first_as_integer, &fee, &err)) != SQLITE_OK)
-		{
-			fprintf(stderr, "SQL Error %d in get_fee - %s\nQuery: %s\n", rc, err, statement);
-			sqlite3_free(err);
-		}
+	// Unsharded, the database enforces it on its own.
+	if (_shards.front()->db == _db)
+		return true;
+
+	std::lock_guard<std::mutex> lock(_licenses_lock);
+
+	return _licenses.emplace(license, id).second;
+}
+
+void parking_server::release_license(const std::string& license, int id)
+{
+	if (_shards.front()->db == _db)
+		return;
+
+	std::lock_guard<std::mutex> lock(_licenses_lock);
+	auto it = _licenses.find(license);
+
+	// Only the claim of this pad, not one made since by a ship docking elsewhere.
+	if (it != _licenses.end() && it->second == id)
+		_licenses.erase(it);
+}
+
+int parking_server::get_free_dock(float weight) const
+{
+	// Answered from memory, no need to wait for the database.
+	if (_options.allocation == allocation_mode::best_fit)
+		return _pads.best_fit(weight);
+
+	return _pads.first_fit(weight);
+}
+
+bool parking_server::dock_is_free(int id) const
+{
+	return _pads.is_free(id);
+}
+
+/**
+ * @return The current time, in milliseconds since the epoch.
+ */
+static int64_t now_ms()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Run a query taking a pad ID and returning a single integer.
+ *
+ * @param db The connection the statement was prepared on.
+ * @param statement The prepared statement.
+ * @param id The pad ID to bind.
+ * @param now The current time in epoch milliseconds, to bind.
+ * @param name The calling method, for error messages.
+ * @return The first column of the first row, or -1 if there was none.
+ */
+static int query_pad_int(sqlite3* db, sqlite3_stmt* statement, int id, int64_t now, 
+		const char* name)
+{
+	scoped_statement stmt(statement);
+
+	int value = -1;
+	int rc;
+
+	sqlite3_bind_int(stmt, 1, id);
+	sqlite3_bind_int64(stmt, 2, now);
+
+	if ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+		value = sqlite3_column_int(stmt, 0);
+	else if (rc != SQLITE_DONE)
+		fprintf(stderr, "SQL Error %d in %s - %s\n", rc, name, sqlite3_errmsg(db));
+
+	return value;
+}
+
+int parking_server::get_seconds_docked(int id) const
+{
+	if (_options.native_fees)
+		return _pads.seconds_docked(id, now_ms());
 
-		free(statement);
+	shard& s = route(id);
+
+	// Read connections let this run alongside writes on other threads.
+	if (auto reader = s.readers.acquire())
+	{
+		return query_pad_int(reader.db(), reader.statements().get(query::seconds_docked), 
+				id, now_ms(), "get_seconds_docked");
 	}
 
-	return fee;
+	std::lock_guard<std::mutex> lock(s.db_lock);
+
+	return query_pad_int(s.db, s.statements.get(query::seconds_docked), id, now_ms(),
+			"get_seconds_docked");
 }
 
-int parking_server::dock_ship(int id, float weight, const char* license)
+int parking_server::get_fee(int id) const
+{
+	// The pad index has the tariffs and docking times, 
+	// so the fee doesn't need a trip through SQL.
+	if (_options.native_fees)
+		return _pads.fee(id, now_ms());
+
+	shard& s = route(id);
+
+	if (auto reader = s.readers.acquire())
+		return query_pad_int(reader.db(), reader.statements().get(query::fee), id, now_ms(), 
+				"get_fee");
+
+	std::lock_guard<std::mutex> lock(s.db_lock);
+
+	return query_pad_int(s.db, s.statements.get(query::fee), id, now_ms(), "get_fee");
+}
+
+size_t parking_server::get_fees(std::vector<int>& pad_ids, std::vector<int>& fees) const
 {
-	char* statement;
-	char* err;
+	return _pads.fees(now_ms(), pad_ids, fees);
+}
+
+void parking_server::dock_ship(int id, float weight, const char* license,
+		std::function<void(int)> done)
+{
+	write_op op;
+
+	// Stored as given, so the pad index and the database agree on fees.
+	const int64_t docked_at = now_ms();
 
-	int c, rc;
+	// Refused up front, or the same ship could dock in two shards.
+	if (!claim_license(license, id))
+	{
+		done(SQLITE_CONSTRAINT);
+		return;
+	}
+
+	// Each shard has its own writer, so only docking at 
+	// pads of the same shard shares a transaction.
+	shard& s = route(id);
+
+	op.execute = [this, &s, id, weight, docked_at, plate = std::string(license)]
+	{
+		return execute_dock(s, id, weight, plate.c_str(), docked_at);
+	};
 
-	if ((c = asprintf(&statement, 
-					"INSERT INTO ships (pad_id, weight, license, date) "
-					"VALUES (%d, %f, '%s', DATETIME('NOW'));", id, weight, license)) > 0)
+	op.complete = [this, id, docked_at, plate = std::string(license), done = std::move(done)](int rc)
 	{
-		if ((rc = sqlite3_exec(_db, statement, nullptr, nullptr, &err)) != SQLITE_OK)
+		if (rc == SQLITE_OK)
 		{
-			fprintf(stderr, "SQL Error %d in dock_ship - %s\nQuery: %s\n", rc, err, statement);
-			sqlite3_free(err);
+			_pads.set_occupied(id, true, docked_at);
+
+			if (_log.running())
+				_log.append(id, plate.c_str(), log_event_type::dock);
+		}
+		else
+		{
+			release_license(plate, id);
 		}
 
-		free(statement);
-	}
+		done(rc);
+	};
 
-	return rc;
+	s.commits.submit(std::move(op));
+}
+
+int parking_server::dock_ship(int id, float weight, const char* license)
+{
+	std::promise<int> result;
+
+	dock_ship(id, weight, license, [&result](int rc) { result.set_value(rc); });
+
+	return result.get_future().get();
+}
+
+void parking_server::undock_ship(int id, std::function<void(int)> done)
+{
+	undock_and_bill(id, [done = std::move(done)](int rc, int) { done(rc); });
 }
 
 int parking_server::undock_ship(int id)
 {
-	char* statement;
-	char* err;
-	
-	int c, rc;
+	int fee;
+
+	return undock_and_bill(id, fee);
+}
+
+void parking_server::undock_and_bill(int id, std::function<void(int, int)> done)
+{
+	/// What the delete found, passed from the write to its completion.
+	struct undocking
+	{
+		std::string license;
+		int fee = -1;
+	};
+
+	write_op op;
+
+	auto result = std::make_shared<undocking>();
+	shard& s = route(id);
+
+	op.execute = [this, &s, id, result] 
+	{ 
+		return execute_undock(s, id, now_ms(), result->license, result->fee); 
+	};
 
-	if ((c = asprintf(&statement,
-					"DELETE FROM ships WHERE pad_id = %d;", id)) > 0)
+	op.complete = [this, id, result, done = std::move(done)](int rc)
 	{
-		if ((rc = sqlite3_exec(_db, statement, nullptr, nullptr, &err)) != SQLITE_OK)
+		if (rc == EXIT_SUCCESS)
 		{
-			fprintf(stderr, "SQL Error %d in undock_ship - %s\nQuery: %s\n", rc, err, statement);
-			sqlite3_free(err);
+			_pads.set_occupied(id, false);
+			release_license(result->license, id);
+
+			if (_log.running())
+				_log.append(id, result->license.c_str(), log_event_type::undock);
 		}
 
-		free(statement);
+		// The fee only counts if the ship is actually gone.
+		done(rc, (rc == EXIT_SUCCESS) ? result->fee : -1);
+	};
+
+	s.commits.submit(std::move(op));
+}
+
+int parking_server::undock_and_bill(int id, int& fee)
+{
+	std::promise<int> result;
+
+	undock_and_bill(id, [&result, &fee](int rc, int bill) 
+	{ 
+		fee = bill;
+		result.set_value(rc); 
+	});
+
+	return result.get_future().get();
+}
+
+int parking_server::execute_dock(shard& s, int id, float weight, const char* license, 
+		int64_t docked_at)
+{
+	scoped_statement stmt(s.statements.get(query::dock));
+
+	int rc;
+
+	sqlite3_bind_int(stmt, 1, id);
+	sqlite3_bind_double(stmt, 2, weight);
+	sqlite3_bind_text(stmt, 3, license, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 4, docked_at);
+
+	if ((rc = sqlite3_step(stmt)) == SQLITE_DONE)
+		return SQLITE_OK;
+
+	fprintf(stderr, "SQL Error %d in dock_ship - %s\n", rc, sqlite3_errmsg(s.db));
+
+	return rc;
+}
+
+int parking_server::execute_undock(shard& s, int id, int64_t now, std::string& license, 
+		int& fee)
+{
+	scoped_statement stmt(s.statements.get(query::undock));
+
+	int rc;
+	bool deleted = false;
+
+	sqlite3_bind_int(stmt, 1, id);
+	sqlite3_bind_int64(stmt, 2, now);
+
+	// The deleted ship comes back as a row, with its fee.
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		const unsigned char* text = sqlite3_column_text(stmt, 0);
+		license = text ? reinterpret_cast<const char*>(text) : "";
+		fee = sqlite3_column_int(stmt, 1);
+		deleted = true;
+	}
+
+	if (rc != SQLITE_DONE)
+	{
+		fprintf(stderr, "SQL Error %d in undock_ship - %s\n", rc, sqlite3_errmsg(s.db));
+		return EXIT_FAILURE;
 	}
 
-	return (sqlite3_changes(_db) > 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+	return deleted ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-int parking_server::open(int begin, int end)
+int parking_server::listen_on(int& port, int end)
 {
 	int opt = true;
-	int master_socket, addrlen, new_socket, valread, sd;
-	int client_sockets[max_clients];
+	int listener;
 	struct sockaddr_in address {};
 
-	fd_set readfds;
-
-	for (int i = 0; i < max_clients; i++)
-		client_sockets[i] = 0;
-
-	if ((master_socket = socket(AF_INET, SOCK_STREAM, 0)) == 0)
+	if ((listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
 	{
 		fprintf(stderr, "Failed to create socket.\n");
-		return EXIT_FAILURE;
+		return -1;
 	}
 
-	if (setsockopt(master_socket, SOL_SOCKET, SO_REUSEADDR, 
+	// Every event loop binds its own listener to the same port,
+	// and the kernel balances new connections between them.
+	if (setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, 
+				reinterpret_cast<char*>(&opt), sizeof(opt)) < 0 
+			|| setsockopt(listener, SOL_SOCKET, SO_REUSEPORT,
 				reinterpret_cast<char*>(&opt), sizeof(opt)) < 0)
 	{
 		fprintf(stderr, "Failed to configure socket.\n");
-		return EXIT_FAILURE;
+		close(listener);
+		return -1;
 	}
 
-	int port = begin;
-
 	address.sin_family = AF_INET;
 	address.sin_addr.s_addr = INADDR_ANY;
 	address.sin_port = htons(port);
 
-	while (bind(master_socket, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0)
+	while (bind(listener, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0)
 	{
-		if (port > end)
+		if (++port > end)
 		{
 			fprintf(stderr, "Failed to bind port.\n");
-			return EXIT_FAILURE;
+			close(listener);
+			return -1;
 		}
 
-		address.sin_port = htons(port++);
+		address.sin_port = htons(port);
 	}
 
-	fprintf(stdout, "Listening on %d.\n", port);
-
-	if (listen(master_socket, 3) < 0)
+	if (listen(listener, SOMAXCONN) < 0)
 	{
 		fprintf(stderr, "Failed to start listening.\n");
-		return EXIT_FAILURE;
+		close(listener);
+		return -1;
 	}
 
-	addrlen = sizeof(address);
+	return listener;
+}
+
+int parking_server::accept_clients(worker& w)
+{
+	struct sockaddr_in address {};
+	socklen_t addrlen = sizeof(address);
+	int sd;
 
-	// Sockets are set up, enter main listening loop.
 	while (true)
 	{
-		// Clear socket set and add master socket.
-		FD_ZERO(&readfds);
-		FD_SET(master_socket, &readfds);
-		int max_sd = master_socket;
+		addrlen = sizeof(address);
+		sd = accept4(w.listener, reinterpret_cast<struct sockaddr*>(&address), &addrlen, SOCK_NONBLOCK);
+
+		if (sd < 0)
+		{
+			// The listener is edge-triggered, so the accept queue must be
+			// drained before returning, or the clients left in it will
+			// never be woken for.
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return EXIT_SUCCESS;
+
+			if ((errno == EMFILE || errno == ENFILE) && w.spare > -1)
+			{
+				// Out of descriptors: give up the spare one to take the
+				// client off the queue, and turn it away. Accepting fails
+				// for want of a descriptor even when the queue is empty,
+				// so only the spare tells when it's been drained.
+				close(w.spare);
+
+				sd = accept4(w.listener, nullptr, nullptr, SOCK_NONBLOCK);
+				const int error = errno;
+
+				if (sd > -1)
+				{
+					msg_head rsp { sizeof(msg_head), 0, msg_type::connection_refused };
+					send(sd, &rsp, sizeof(rsp), MSG_NOSIGNAL);
+					close(sd);
 
-		// Add client sockets to set.
-		for (int i = 0; i < max_clients; i++)
+					fprintf(stderr, "Out of descriptors, refused a connection.\n");
+				}
+
+				w.spare = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+				if (sd < 0 && (error == EAGAIN || error == EWOULDBLOCK))
+					return EXIT_SUCCESS;
+
+				continue;
+			}
+
+			// Without a spare, leave the clients queued, and re-arm the
+			// listener so it's woken for them again on the next wait.
+			if (errno == EMFILE || errno == ENFILE)
+			{
+				struct epoll_event ev {};
+				ev.events = EPOLLIN | EPOLLET;
+				ev.data.fd = w.listener;
+
+				epoll_ctl(w.epfd, EPOLL_CTL_MOD, w.listener, &ev);
+				return EXIT_SUCCESS;
+			}
+
+			fprintf(stderr, "Error when accepting connection.\n");
+			return EXIT_FAILURE;
+		}
+
+		if (w.clients.open(sd, address) == nullptr)
+		{
+			// Tell the client why instead of just hanging up on it.
+			msg_head rsp { sizeof(msg_head), 0, msg_type::connection_refused };
+			send(sd, &rsp, sizeof(rsp), MSG_NOSIGNAL);
+
+			fprintf(stderr, "Connection limit (%lu) reached, refused %s:%d.\n",
+					w.clients.limit(), inet_ntoa(address.sin_addr), ntohs(address.sin_port));
+
+			close(sd);
+			continue;
+		}
+
+		struct epoll_event ev {};
+		ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+		ev.data.fd = sd;
+
+		if (epoll_ctl(w.epfd, EPOLL_CTL_ADD, sd, &ev) < 0)
 		{
-			sd = client_sockets[i];
+			fprintf(stderr, "Failed to register connection (sdf %d).\n", sd);
+			w.clients.close(sd);
+			continue;
+		}
 
-			if (sd > 0)
-				FD_SET(sd, &readfds);
+		fprintf(stdout, "New connection (sdf %d) from %s:%d.\n", 
+				sd, inet_ntoa(address.sin_addr), ntohs(address.sin_port));
+	}
+}
+
+bool parking_server::receive(worker& w, connection& con)
+{
+	ssize_t valread, consumed;
 
-			if (sd > max_sd)
-				max_sd = sd;
+	while (true)
+	{
+		// Leave the rest in the socket until the client
+		// has read its responses -- flush() resumes reading.
+		if (con.tx_pending() >= send_queue_limit)
+		{
+			con.read_paused = true;
+			return true;
 		}
 
-		// Select a FD ready for I/O
-		const int activity = select(max_sd + 1, &readfds, nullptr, nullptr, nullptr);
+		// A return value of zero indicates EOS,
+		// so we can disconnect the client.
+		if ((valread = read(con.fd, w.data, buffer_size)) == 0)
+			return false;
+
+		if (valread < 0)
+		{
+			if (errno == EINTR)
+				continue;
 
-		if ((activity < 0) && (errno != EINTR))
-			fprintf(stderr, "A non-fatal selector error occurred!\n");
+			// Drained the socket, wait for the next edge.
+			return (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
 
-		// There is activity on the socket
-		// -- accept the connection and add it
-		// to a free client socked.
-		if (FD_ISSET(master_socket, &readfds))
+		if (con.rx.empty())
 		{
-			if ((new_socket = accept(master_socket, 
-							reinterpret_cast<struct sockaddr*>(&address),
-							reinterpret_cast<socklen_t*>(&addrlen))) < 0)
+			// Common case, handle the messages straight from the
+			// read buffer and only keep a trailing partial message.
+			if ((consumed = frame(w, con, w.data, valread)) < 0)
+				return false;
+
+			con.rx.assign(w.data + consumed, w.data + valread);
+		}
+		else
+		{
+			con.rx.insert(con.rx.end(), w.data, w.data + valread);
+
+			if ((consumed = frame(w, con, con.rx.data(), con.rx.size())) < 0)
+				return false;
+
+			con.rx.erase(con.rx.begin(), con.rx.begin() + consumed);
+		}
+	}
+}
+
+ssize_t parking_server::frame(worker& w, connection& con, const char* data, size_t length)
+{
+	size_t offset = 0;
+
+	while (length - offset >= sizeof(msg_head))
+	{
+		msg_head head {};
+		memcpy(&head, data + offset, sizeof(head));
+
+		// Without a sane length there's no way to find the
+		// next message, so the stream can't be recovered.
+		if (head.length < sizeof(msg_head) || head.length > max_message_len)
+		{
+			fprintf(stderr, "Invalid message length (%lu bytes) on sdf %d.\n", head.length, con.fd);
+			return -1;
+		}
+
+		if (length - offset < head.length)
+			break;
+
+		// A message too short for its type can't be answered,
+		// and a pipelining client would wait for it forever.
+		if (!dispatch(w, con, data + offset, head.length))
+		{
+			fprintf(stderr, "Message of type %d too short (%lu bytes) on sdf %d.\n", 
+					static_cast<int>(head.type), head.length, con.fd);
+			return -1;
+		}
+
+		offset += head.length;
+	}
+
+	return offset;
+}
+
+bool parking_server::dispatch(worker& w, connection& con, const char* data, size_t length)
+{
+	// Read the message head and decide what to do
+	// with the rest of the message.
+	msg_head head {};
+	memcpy(&head, data, sizeof(head));
+
+	const auto received = server_stats::clock::now();
+
+	switch (head.type)
+	{
+		case msg_type::dock_query:
+		{
+
+			// A client wants to know if there are any free
+			// landing pads!
+
+			size_t msg_bytes = sizeof(dock_query_msg);
+			size_t rsp_bytes = sizeof(dock_query_response_msg);
+
+			if (length < msg_bytes)
+				return false;
+
+			dock_query_msg msg {};
+			memcpy(&msg, data, msg_bytes); 
+
+			int dock = get_free_dock(msg.weight);
+
+			dock_query_response_msg rsp 
 			{
-				fprintf(stderr, "Error when accepting connection.\n");
-				return EXIT_FAILURE;
-			}
+				msg_head { rsp_bytes, msg.head.id, msg_type::dock_query_response }, 
+				dock	
+			};
+
+			reply(w, con, &rsp, rsp_bytes);
+			_stats.record(request_kind::dock_query, dock >= 0, server_stats::clock::now() - received);
+
+			if (_request_log.allow())
+				fprintf(stdout, "Query response (%lu bytes) queued.\n", rsp_bytes);
+
+			break;
+		}
+		case msg_type::dock_request:
+		{
+
+			// A client wants to register a docking ship!
+			// The write is committed along with others, and the
+			// response comes back to this loop once it's done.
 
-			fprintf(stdout, "New connection (sdf %d) from %s:%d.\n", 
-					new_socket, inet_ntoa(address.sin_addr), ntohs(address.sin_port));
+			size_t msg_bytes = sizeof(dock_change_request_msg);
 
-			for (int i = 0; i < max_clients; i++)
+			if (length < msg_bytes)
+				return false;
+
+			dock_change_request_msg msg {};
+			memcpy(&msg, data, msg_bytes); 
+			msg.license[max_license_len - 1] = '\0';
+
+			const int fd = con.fd;
+			const uint64_t serial = con.serial;
+			const unsigned id = msg.head.id;
+			shard& s = route(msg.dock_id);
+
+			dock_ship(msg.dock_id, msg.weight, msg.license, [this, &w, &s, fd, serial, id, received](int rc)
 			{
-				if (client_sockets[i] == 0)
+				size_t rsp_bytes = sizeof(dock_response_msg);
+
+				dock_response_msg rsp 
 				{
-					client_sockets[i] = new_socket;
-					break;
-				}
-			}
-		}
+					msg_head { rsp_bytes, id, msg_type::dock_response },
+					rc
+				};
+
+				complete(w, fd, serial, &rsp, rsp_bytes);
+				_stats.record(request_kind::dock_request, rc == SQLITE_OK, 
+						server_stats::clock::now() - received, s.commits.batch_time());
 
-		// Loop through all clients and act on those
-		// who are connected (i.e FD is set)
-		for (int i = 0; i < max_clients; i++)
+				if (_request_log.allow())
+					fprintf(stdout, "Dock request (%lu bytes) queued.\n", rsp_bytes);
+			});
+
+			break;
+		}
+		case msg_type::undock_request:
 		{
-			sd = client_sockets[i];
 
-			if (FD_ISSET(sd, &readfds))
+			// A client wants to register an undocking ship!
+
+			size_t msg_bytes = sizeof(dock_change_request_msg);
+
+			if (length < msg_bytes)
+				return false;
+
+			dock_change_request_msg msg {};
+			memcpy(&msg, data, msg_bytes); 
+
+			const int fd = con.fd;
+			const uint64_t serial = con.serial;
+			const unsigned id = msg.head.id;
+			shard& s = route(msg.dock_id);
+
+			// The fee comes back from the same statement that
+			// removes the ship, so nobody can undock it in between.
+			undock_and_bill(msg.dock_id, [this, &w, &s, fd, serial, id, received](int rc, int fee)
 			{
-				// A return value of zero indicates EOS,
-				// so we can disconnect the client.
-				if ((valread = read(sd, _data, buffer_size)) == 0)
+				size_t rsp_bytes = sizeof(undock_response_msg);
+
+				undock_response_msg rsp 
 				{
-					getpeername(sd, 
-							reinterpret_cast<struct sockaddr*>(&address),
-							reinterpret_cast<socklen_t*>(&addrlen));
+					msg_head { rsp_bytes, id, msg_type::undock_response },
+					rc,
+					fee
+				};
 
-					fprintf(stdout, "Disconnected %s:%d.\n",
-							inet_ntoa(address.sin_addr), ntohs(address.sin_port));
+				complete(w, fd, serial, &rsp, rsp_bytes);
+				_stats.record(request_kind::undock_request, rc == EXIT_SUCCESS, 
+						server_stats::clock::now() - received, s.commits.batch_time());
 
-					close(sd);
-					client_sockets[i] = 0;
-				}
-				else if (valread > -1)
-				{
+				if (_request_log.allow())
+					fprintf(stdout, "Undock request (%lu bytes) queued.\n", rsp_bytes);
+			});
 
-					// Read the message head and decide what to do
-					// with the rest of the message.
-					msg_head head {};
-					memcpy(&head, _data, valread);
+			break;
+		}
+		case msg_type::stats_request:
+		{
 
-					switch (head.type)
-					{
-						case msg_type::dock_query:
-						{
+			// Someone wants to know how we're doing! This is
+			// answered from the counters, not the database.
 
-							// A client wants to know if there are any free
-							// landing pads!
+			size_t rsp_bytes = sizeof(stats_response_msg);
 
-							size_t msg_bytes = sizeof(dock_query_msg);
-							size_t rsp_bytes = sizeof(dock_query_response_msg);
+			stats_response_msg rsp {};
+			rsp.head = msg_head { rsp_bytes, head.id, msg_type::stats_response };
+			_stats.summarize(rsp);
 
-							dock_query_msg msg {};
-							memcpy(&msg, _data, msg_bytes); 
+			reply(w, con, &rsp, rsp_bytes);
+			break;
+		}
+		default:
+			fprintf(stderr, "Unknown message type %d on sdf %d.\n", static_cast<int>(head.type), con.fd);
+			break;
+	}
 
-							int dock = get_free_dock(msg.weight);
+	return true;
+}
+
+void parking_server::complete(worker& w, int fd, uint64_t serial, const void* msg, size_t length)
+{
+	completion c { fd, serial, length, {} };
+	memcpy(c.data, msg, std::min(length, sizeof(c.data)));
+
+	bool wake;
+
+	{
+		std::lock_guard<std::mutex> lock(w.completions_lock);
+
+		wake = w.completions.empty();
+		w.completions.push_back(c);
+	}
+
+	// The loop empties the whole list when woken,
+	// so only the first completion needs to wake it.
+	const uint64_t one = 1;
+
+	if (wake && write(w.wake, &one, sizeof(one)) < 0)
+		fprintf(stderr, "Failed to wake event loop.\n");
+}
+
+void parking_server::deliver(worker& w)
+{
+	uint64_t count;
+
+	if (read(w.wake, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		fprintf(stderr, "Failed to read wake event.\n");
+
+	{
+		std::lock_guard<std::mutex> lock(w.completions_lock);
+		w.delivering.swap(w.completions);
+	}
 
-							dock_query_response_msg rsp 
-							{
-								msg_head { rsp_bytes, 0, msg_type::dock_query_response }, 
-								dock	
-							};
+	for (const completion& c : w.delivering)
+	{
+		connection* con = w.clients.get(c.fd);
 
-							if (send(sd, &rsp, rsp_bytes, 0) == static_cast<ssize_t>(rsp_bytes))
-								fprintf(stdout, "Query response (%lu bytes) sent.\n", rsp_bytes);
+		// The client may have gone, and someone else
+		// may even have been given the same descriptor.
+		if (con != nullptr && con->serial == c.serial)
+			reply(w, *con, c.data, c.length);
+	}
 
-							break;
-						}
-						case msg_type::dock_request:
-						{
+	w.delivering.clear();
+}
 
-							// A client wants to register a docking ship!
+void parking_server::reply(worker& w, connection& con, const void* msg, size_t length)
+{
+	const char* bytes = static_cast<const char*>(msg);
+	con.tx.insert(con.tx.end(), bytes, bytes + length);
 
-							size_t msg_bytes = sizeof(dock_change_request_msg);
-							size_t rsp_bytes = sizeof(dock_response_msg);
+	if (!con.flush_pending)
+	{
+		con.flush_pending = true;
+		w.flush_list.push_back(con.fd);
+	}
+}
 
-							dock_change_request_msg msg {};
-							memcpy(&msg, _data, msg_bytes); 
+bool parking_server::flush(worker& w, connection& con)
+{
+	con.flush_pending = false;
 
-							int rc = dock_ship(msg.dock_id, msg.weight, msg.license); 
+	while (con.tx_pending() > 0)
+	{
+		const ssize_t sent = send(con.fd, con.tx.data() + con.tx_sent, 
+				con.tx_pending(), MSG_NOSIGNAL);
 
-							dock_response_msg rsp 
-							{
-								msg_head { rsp_bytes, 0, msg_type::dock_response },
-								rc
-							};
+		if (sent < 0)
+		{
+			if (errno == EINTR)
+				continue;
 
-							if (send(sd, &rsp, rsp_bytes, 0) == static_cast<ssize_t>(rsp_bytes))
-								fprintf(stdout, "Dock request (%lu bytes) sent.\n", rsp_bytes);
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return false;
 
-							break;
-						}
-						case msg_type::undock_request:
-						{
+			// The socket is full, so wait for the client to catch up.
+			if (!con.wait_writable)
+			{
+				struct epoll_event ev {};
+				ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+				ev.data.fd = con.fd;
 
-							// A client wants to register an undocking ship!
+				if (epoll_ctl(w.epfd, EPOLL_CTL_MOD, con.fd, &ev) < 0)
+					return false;
 
-							size_t msg_bytes = sizeof(dock_change_request_msg);
-							size_t rsp_bytes = sizeof(undock_response_msg);
+				con.wait_writable = true;
+			}
 
-							dock_change_request_msg msg {};
-							memcpy(&msg, _data, msg_bytes); 
+			// Compact the queue so it doesn't grow without bound.
+			con.tx.erase(con.tx.begin(), con.tx.begin() + con.tx_sent);
+			con.tx_sent = 0;
 
-							int fee = get_fee(msg.dock_id);
-							int rc = undock_ship(msg.dock_id);
+			return true;
+		}
 
-							undock_response_msg rsp 
-							{
-								msg_head { rsp_bytes, 0, msg_type::undock_response },
-								rc,
-								fee
-							};
+		con.tx_sent += sent;
+	}
 
-							if (send(sd, &rsp, rsp_bytes, 0) == static_cast<ssize_t>(rsp_bytes))
-								fprintf(stdout, "Undock request (%lu bytes) sent.\n", rsp_bytes);
+	con.tx.clear();
+	con.tx_sent = 0;
 
-							break;
-						}
-						default:
-							break;
-					}
-				}
+	if (con.wait_writable)
+	{
+		struct epoll_event ev {};
+		ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+		ev.data.fd = con.fd;
+
+		if (epoll_ctl(w.epfd, EPOLL_CTL_MOD, con.fd, &ev) < 0)
+			return false;
+
+		con.wait_writable = false;
+	}
+
+	// The client caught up, so read what we left in the socket.
+	// With edge triggering, nobody will tell us about it again.
+	if (con.read_paused)
+	{
+		con.read_paused = false;
+
+		if (!receive(w, con))
+			return false;
+	}
+
+	return true;
+}
+
+void parking_server::disconnect(worker& w, connection& con)
+{
+	fprintf(stdout, "Disconnected %s:%d.\n",
+			inet_ntoa(con.address.sin_addr), ntohs(con.address.sin_port));
+
+	// Closing the descriptor also removes it from the epoll set.
+	w.clients.close(con.fd);
+}
+
+int parking_server::run(worker& w)
+{
+	struct epoll_event events[max_events];
+
+	// Only sockets with pending I/O are returned, so the cost
+	// of each wakeup depends on the ready sockets, not the connected ones.
+	while (!_stopped)
+	{
+		const int ready = epoll_wait(w.epfd, events, max_events, -1);
+
+		if (ready < 0)
+		{
+			if (errno != EINTR)
+				fprintf(stderr, "A non-fatal selector error occurred!\n");
+
+			continue;
+		}
+
+		for (int i = 0; i < ready; i++)
+		{
+			const int sd = events[i].data.fd;
+
+			if (sd == _stop_event)
+				break;
+
+			if (sd == w.wake)
+			{
+				deliver(w);
+				continue;
+			}
+
+			// There is activity on the listener
+			// -- accept the pending connections.
+			if (sd == w.listener)
+			{
+				if (accept_clients(w))
+					return EXIT_FAILURE;
+
+				continue;
 			}
+
+			connection* con = w.clients.get(sd);
+
+			if (con == nullptr)
+				continue;
+
+			bool alive = !(events[i].events & (EPOLLERR | EPOLLHUP));
+
+			if (alive && (events[i].events & EPOLLOUT))
+				alive = flush(w, *con);
+
+			if (alive && (events[i].events & (EPOLLIN | EPOLLRDHUP)))
+				alive = receive(w, *con);
+
+			if (!alive)
+				disconnect(w, *con);
+		}
+
+		// Send everything queued during this iteration, one syscall
+		// per connection no matter how many responses it got.
+		// Flushing may read (and queue) more, so index as we go.
+		for (size_t i = 0; i < w.flush_list.size(); i++)
+		{
+			connection* con = w.clients.get(w.flush_list[i]);
+
+			if (con != nullptr && con->flush_pending && !flush(w, *con))
+				disconnect(w, *con);
 		}
+
+		w.flush_list.clear();
 	}
 
 	return EXIT_SUCCESS;
 }
 
+int parking_server::open(int begin, int end)
+{
+	const size_t limit = _options.max_clients;
+	const int threads = std::max(1, _options.threads);
+
+	// Every client costs a descriptor, so make sure we're
+	// allowed to open as many as the connection limit.
+	struct rlimit lim {};
+
+	if (getrlimit(RLIMIT_NOFILE, &lim) == 0)
+	{
+		lim.rlim_cur = lim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &lim);
+
+		if (lim.rlim_cur < limit + 16)
+			fprintf(stderr, "Warning: descriptor limit (%lu) is below the connection limit (%lu).\n",
+					lim.rlim_cur, limit);
+	}
+
+	if (_stop_event < 0)
+	{
+		fprintf(stderr, "Failed to create stop event.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (start_archivers() != SQLITE_OK)
+		return EXIT_FAILURE;
+
+	std::vector<std::unique_ptr<worker>> workers;
+	int port = begin;
+
+	for (int i = 0; i < threads; i++)
+	{
+		auto w = std::make_unique<worker>(limit, _connected);
+
+		// The first listener picks a free port in the range,
+		// the rest join it on the same port.
+		if ((w->listener = listen_on(port, (i == 0) ? end : port)) < 0)
+			return EXIT_FAILURE;
+
+		if ((w->epfd = epoll_create1(0)) < 0)
+		{
+			fprintf(stderr, "Failed to create epoll instance.\n");
+			return EXIT_FAILURE;
+		}
+
+		struct epoll_event ev {};
+		ev.events = EPOLLIN | EPOLLET;
+		ev.data.fd = w->listener;
+
+		struct epoll_event stop_ev {};
+		stop_ev.events = EPOLLIN;
+		stop_ev.data.fd = _stop_event;
+
+		struct epoll_event wake_ev {};
+		wake_ev.events = EPOLLIN;
+		wake_ev.data.fd = w->wake;
+
+		if (w->wake < 0
+				|| epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->listener, &ev) < 0
+				|| epoll_ctl(w->epfd, EPOLL_CTL_ADD, _stop_event, &stop_ev) < 0
+				|| epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->wake, &wake_ev) < 0)
+		{
+			fprintf(stderr, "Failed to register listener.\n");
+			return EXIT_FAILURE;
+		}
+
+		workers.push_back(std::move(w));
+	}
+
+	if (_from_snapshot)
+		fprintf(stdout, "Loaded %lu pads from snapshot.\n", _pads.size());
+
+	fprintf(stdout, "Listening on %d (%d threads).\n", port, threads);
+	_served = true;
+
+	// The calling thread runs the first event loop itself.
+	std::vector<std::thread> pool;
+	std::atomic<int> rc { EXIT_SUCCESS };
+
+	for (int i = 1; i < threads; i++)
+	{
+		pool.emplace_back([this, &rc, &w = *workers[i]]
+		{
+			if (run(w))
+				rc = EXIT_FAILURE;
+		});
+	}
+
+	if (run(*workers[0]))
+		rc = EXIT_FAILURE;
+
+	// A failing loop takes the others down with it.
+	stop();
+
+	for (auto& t : pool)
+		t.join();
+
+	// Writes still in flight complete into the event loops,
+	// so let them finish before the loops go away.
+	for (auto& s : _shards)
+		s->commits.drain();
+
+	_stats.print(stdout);
+
+	return rc;
+}
+
+void parking_server::stop()
+{
+	// Only async-signal-safe calls in here!
+	const uint64_t one = 1;
+
+	_stopped = true;
+
+	if (write(_stop_event, &one, sizeof(one)) < 0)
+		return;
+}
@@ -25,14 +25,135 @@
 #pragma once
 
 // External
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <sqlite3.h>
 
+#include "archive.h"
+#include "committer.h"
+#include "connection.h"
+#include "eventlog.h"
+#include "occupancy.h"
+#include "readers.h"
+#include "statements.h"
+#include "stats.h"
+
 /// The size of the TCP receive buffer.
 constexpr int buffer_size = 1024;
 
-/// The maximum number of clients to accept simultanuously.
-constexpr int max_clients = 64;
+/// The maximum number of ready events handled per epoll wakeup.
+constexpr int max_events = 64;
+
+/// The largest response produced outside of an event loop.
+constexpr size_t max_response_len = 64;
+
+/// Stop reading from a client once this many response bytes are waiting
+/// to be sent to it, until it catches up.
+constexpr size_t send_queue_limit = 64 * 1024;
+
+/**
+ * How a free landing pad is chosen for a ship.
+ */
+enum class allocation_mode
+{
+	/// The free pad with the lowest ID that fits the ship.
+	first_fit,
+
+	/// The free pad with the lowest weight limit that fits the ship.
+	best_fit
+};
+
+/**
+ * How the docking log is written.
+ */
+enum class log_mode
+{
+	/// By the log triggers, in the same transaction as the docking.
+	trigger,
+
+	/// By the server, buffered and written in bulk from a background thread.
+	async,
+
+	/// By the server like async, but to a binary journal instead of the database.
+	journal
+};
+
+/**
+ * Runtime settings for the SPACEPARK server,
+ * usually read from the configuration file.
+ */
+struct server_options
+{
+	/// The maximum number of clients connected at once.
+	int max_clients = default_max_clients;
+
+	/// The number of event loop threads, each with its own listener.
+	int threads = 1;
+
+	/// How free pads are chosen for dock queries.
+	allocation_mode allocation = allocation_mode::first_fit;
+
+	/// The number of read-only database connections for fee and 
+	/// time queries. With none, reads share the writer connection.
+	int read_connections = 2;
+
+	/// Compute fees and docking times from the in-memory pad index,
+	/// rather than querying the database for them.
+	bool native_fees = true;
+
+	/// How long to gather docking writes into one transaction,
+	/// in microseconds, after the first one arrives.
+	int commit_window = 1000;
+
+	/// The maximum number of docking writes per transaction.
+	int commit_batch = 256;
+
+	/// Who writes the docking log.
+	log_mode logging = log_mode::trigger;
+
+	/// How often the buffered docking log is written, in milliseconds.
+	int log_interval = 1000;
+
+	/// The number of docking log events buffered between writes.
+	int log_buffer = 65536;
+
+	/// How hard the buffered docking log tries not to lose events.
+	log_durability log_sync = log_durability::normal;
+
+	/// The directory of the docking journal, in journal log mode.
+	std::string journal_dir;
+
+	/// The size of each journal segment file, in MiB.
+	int journal_segment = 64;
+
+	/// The number of days of history kept in docking_log before it's
+	/// moved to the monthly archive tables, or 0 to keep it all there.
+	int log_retention = 0;
+
+	/// How often docking_log is archived, in seconds.
+	int archive_interval = 3600;
+
+	/// The most docking log entries archived per transaction.
+	int archive_batch = 5000;
+
+	/// Where to keep a snapshot of the pad index for quick starts,
+	/// or empty to always load the pads from the database.
+	std::string snapshot_path;
+
+	/// How often to take a snapshot while docking goes on, in seconds.
+	/// With 0, a snapshot is only taken when the server closes.
+	int snapshot_interval = 300;
+
+	/// The most lines logged per second about handled requests,
+	/// or 0 to log none. Logging every request slows the server down.
+	int request_log = 0;
+};
 
 class parking_server
 {
@@ -40,16 +161,32 @@ class parking_server
 
 		/**
 		 * Create a new SPACEPARK server instance.
-		 * The database reference is expected to be opened alread.
+		 * The database reference is expected to be opened alread,
+		 * and is used for all writes. If the database is a file,
+		 * separate read-only connections are opened for reads.
+		 * If the database has been split into shards, it only 
+		 * serves as the directory of pads, and each shard file is
+		 * opened with a writer and read connections of its own.
 		 *
 		 * @param db An open sqlite3 database reference.
+		 * @param options The server settings.
 		 */
-		parking_server(sqlite3*& db);
+		parking_server(sqlite3*& db, const server_options& options = {});
 		~parking_server();
 
 		/**
-		 * Get the first suitable landing pad
-		 * for a spaceship of the specified weight.
+		 * Check whether the server could prepare its queries,
+		 * i.e. whether the database has been initialized.
+		 *
+		 * @return True if the server is ready for use.
+		 */
+		bool ready() const { return _ready; }
+
+		/**
+		 * Get a suitable landing pad for a spaceship 
+		 * of the specified weight, chosen according
+		 * to the configured allocation mode.
+		 * This is answered from the in-memory pad index.
 		 *
 		 * @param weight The ship weight.
 		 * @return A free dock id, or -1 if none was found.
@@ -58,6 +195,7 @@ class parking_server
 
 		/**
 		 * Check whether or not the specified dock is occupied.
+		 * This is answered from the in-memory pad index.
 		 *
 		 * @param id The dock ID to check.
 		 * @return True if dock is free, false otherwise.
@@ -89,10 +227,22 @@ class parking_server
 		 */
 		int get_fee(int id) const;
 
+		/**
+		 * Get the current parking fee of every docked ship,
+		 * computed in one pass over the in-memory pad index.
+		 *
+		 * @param pad_ids Set to the IDs of the occupied pads.
+		 * @param fees Set to the fee at each of those pads.
+		 * @return The number of docked ships.
+		 */
+		size_t get_fees(std::vector<int>& pad_ids, std::vector<int>& fees) const;
+
 		/**
 		 * Register a ship for docking at the specified pad,
 		 * checking whether the pad supports the ship weight,
 		 * and whether the ship is already docked elsewhere.
+		 * The write is committed together with other writes
+		 * arriving at the same time, and this blocks until it is.
 		 *
 		 * @param id The id of the pad being docked to.
 		 * @param weight The weight of the ship in tonnes.
@@ -101,17 +251,69 @@ class parking_server
 		 */
 		int dock_ship(int id, float weight, const char* license);
 
+		/**
+		 * Queue a ship for docking without waiting for it,
+		 * see dock_ship(int, float, const char*).
+		 *
+		 * @param id The id of the pad being docked to.
+		 * @param weight The weight of the ship in tonnes.
+		 * @param license The license string of the ship being docked.
+		 * @param done Called with a SQL response code once committed,
+		 * from the writer thread.
+		 */
+		void dock_ship(int id, float weight, const char* license, 
+				std::function<void(int)> done);
+
 		/**
 		 * Register a ship for undocking from the specified pad,
 		 * checking whether a ship exists at that pad.
+		 * The write is committed together with other writes
+		 * arriving at the same time, and this blocks until it is.
 		 *
 		 * @param id The id of the pad being undocked from.
-		 * @return A SQL response code.
+		 * @return A C exit code.
 		 */
 		int undock_ship(int id);
 
+		/**
+		 * Queue a ship for undocking without waiting for it,
+		 * see undock_ship(int).
+		 *
+		 * @param id The id of the pad being undocked from.
+		 * @param done Called with a C exit code once committed,
+		 * from the writer thread.
+		 */
+		void undock_ship(int id, std::function<void(int)> done);
+
+		/**
+		 * Undock the ship at the specified pad and bill it,
+		 * deleting the ship and computing its fee in the same
+		 * statement, so the fee is for the ship actually undocked.
+		 * The write is committed together with other writes
+		 * arriving at the same time, and this blocks until it is.
+		 *
+		 * @param id The id of the pad being undocked from.
+		 * @param fee Set to the final fee, or -1 if nothing was undocked.
+		 * @return A C exit code.
+		 */
+		int undock_and_bill(int id, int& fee);
+
+		/**
+		 * Queue a ship for undocking and billing without waiting 
+		 * for it, see undock_and_bill(int, int&).
+		 *
+		 * @param id The id of the pad being undocked from.
+		 * @param done Called with a C exit code and the final fee
+		 * (-1 on failure) once committed, from the writer thread.
+		 */
+		void undock_and_bill(int id, std::function<void(int, int)> done);
+
 		/**
 		 * Opens the parking server, using the specified port range.
+		 * One event loop is started per configured thread, all
+		 * listening on the same port through SO_REUSEPORT,
+		 * so the kernel spreads incoming connections across them.
+		 * Blocks until the server is stopped.
 		 *
 		 * @param begin Beginning of the port range.
 		 * @param end End of the port range.
@@ -119,8 +321,303 @@ class parking_server
 		 */
 		int open(int begin, int end);
 
+		/**
+		 * Ask all event loops to exit, making open() return.
+		 * This is async-signal-safe, and may be called from
+		 * a signal handler.
+		 */
+		void stop();
+
 	private:
 
+		/// State owned by a single event loop thread.
+		struct worker;
+
+		/// A database file holding ships, and everything writing to it.
+		struct shard;
+
+		/**
+		 * Open the shard files of a sharded database and load the 
+		 * routing of pads to shards. An unsharded database is 
+		 * the only shard, on the shared connection.
+		 *
+		 * @return A SQLite response code.
+		 */
+		int open_shards();
+
+		/**
+		 * Start archiving old docking log entries on the directory and
+		 * every shard, if a retention is set. Only a serving server
+		 * archives, so one-off commands finish without waiting on it.
+		 *
+		 * @return A SQLite response code.
+		 */
+		int start_archivers();
+
+		/**
+		 * Find the shard holding the ship at a pad.
+		 * Unknown pads go to the first shard, which rejects them.
+		 *
+		 * @param id The pad ID.
+		 * @return The shard.
+		 */
+		shard& route(int id) const;
+
+		/**
+		 * @return The data version of the whole park, summed over 
+		 * the directory and every shard, see init_meta().
+		 */
+		uint64_t data_version() const;
+
+		/**
+		 * Save the pad index to the snapshot, unless another process
+		 * has changed the database since it was loaded.
+		 *
+		 * @return Whether the snapshot was saved.
+		 */
+		bool save_snapshot();
+
+		/**
+		 * Load the pad index from the snapshot if it's up to date,
+		 * or from the database otherwise.
+		 *
+		 * @return A SQLite response code.
+		 */
+		int load_pads();
+
+		/**
+		 * Load the license of every docked ship, if sharded.
+		 * Must be called in a read transaction on every shard.
+		 *
+		 * @return A SQLite response code.
+		 */
+		int load_licenses();
+
+		/**
+		 * Claim a license for a ship about to dock, if sharded.
+		 * The UNIQUE constraint on ships.license only holds within
+		 * one shard file, so a ship docked at a pad of one shard
+		 * is refused here before it can dock at another.
+		 *
+		 * @param license The license of the docking ship.
+		 * @param id The pad it docks at.
+		 * @return False if the ship is already docked, or docking.
+		 */
+		bool claim_license(const std::string& license, int id);
+
+		/**
+		 * Release a license claimed for a pad, when the ship
+		 * failed to dock there or has undocked from it.
+		 *
+		 * @param license The license of the ship.
+		 * @param id The pad it was claimed for.
+		 */
+		void release_license(const std::string& license, int id);
+
+		/**
+		 * Create a non-blocking listener socket bound to
+		 * the first free port in the specified range.
+		 *
+		 * @param port Beginning of the port range, set to the bound port.
+		 * @param end End of the port range.
+		 * @return The listener socket, or -1 on failure.
+		 */
+		int listen_on(int& port, int end);
+
+		/**
+		 * Run an event loop until the server is stopped.
+		 *
+		 * @param w The event loop state.
+		 * @return A C exit code.
+		 */
+		int run(worker& w);
+
+		/**
+		 * Accept all pending connections on the listener
+		 * and register them with the epoll instance.
+		 * The listener is edge-triggered, so this drains
+		 * the accept queue until it would block.
+		 *
+		 * Clients beyond the connection limit are sent
+		 * a refusal message and disconnected, and so are
+		 * clients arriving when the process is out of descriptors.
+		 *
+		 * @param w The event loop accepting the connections.
+		 * @return A C exit code.
+		 */
+		int accept_clients(worker& w);
+
+		/**
+		 * Read everything available on a client socket
+		 * and handle each received message.
+		 * The client socket is edge-triggered, so this
+		 * reads until the socket would block.
+		 *
+		 * A message split across reads is kept in the connection
+		 * receive buffer until the rest of it arrives.
+		 *
+		 * @param w The event loop owning the socket.
+		 * @param con The client connection.
+		 * @return False if the client disconnected 
+		 * or broke the protocol, true otherwise.
+		 */
+		bool receive(worker& w, connection& con);
+
+		/**
+		 * Split received bytes into messages on their head length,
+		 * and handle every complete message.
+		 *
+		 * @param w The event loop owning the connection.
+		 * @param con The client connection to respond to.
+		 * @param data The received bytes.
+		 * @param length The number of bytes received.
+		 * @return The number of bytes consumed, or -1 if a message 
+		 * head is invalid or a message too short for its type.
+		 */
+		ssize_t frame(worker& w, connection& con, const char* data, size_t length);
+
+		/**
+		 * Handle a single received message and queue the response.
+		 *
+		 * @param w The event loop owning the connection.
+		 * @param con The client connection to respond to.
+		 * @param data The received message.
+		 * @param length The number of bytes received.
+		 * @return False if the message is too short for its type.
+		 */
+		bool dispatch(worker& w, connection& con, const char* data, size_t length);
+
+		/**
+		 * Insert a docking ship. Runs on the writer thread,
+		 * inside the batch transaction.
+		 *
+		 * @param s The shard holding the pad.
+		 * @param id The id of the pad being docked to.
+		 * @param weight The weight of the ship in tonnes.
+		 * @param license The license string of the ship being docked.
+		 * @param docked_at The docking time, in milliseconds since the epoch.
+		 * @return A SQL response code.
+		 */
+		int execute_dock(shard& s, int id, float weight, const char* license, int64_t docked_at);
+
+		/**
+		 * Delete an undocking ship. Runs on the writer thread,
+		 * inside the batch transaction.
+		 *
+		 * @param s The shard holding the pad.
+		 * @param id The id of the pad being undocked from.
+		 * @param now The current time, in milliseconds since the epoch.
+		 * @param license Set to the license of the undocked ship.
+		 * @param fee Set to the fee of the undocked ship.
+		 * @return A C exit code.
+		 */
+		int execute_undock(shard& s, int id, int64_t now, std::string& license, int& fee);
+
+		/**
+		 * Hand a response over to the event loop owning the client.
+		 * This is thread safe, and wakes the loop if needed.
+		 *
+		 * @param w The event loop owning the connection.
+		 * @param fd The client socket.
+		 * @param serial The serial number of the client connection.
+		 * @param msg The response message.
+		 * @param length The size of the response message.
+		 */
+		void complete(worker& w, int fd, uint64_t serial, const void* msg, size_t length);
+
+		/**
+		 * Queue the responses handed over by other threads
+		 * on their connections, if they're still connected.
+		 *
+		 * @param w The event loop.
+		 */
+		void deliver(worker& w);
+
+		/**
+		 * Append a response to the send queue of a connection.
+		 * Queues are flushed once per event loop iteration,
+		 * so responses to pipelined requests share a syscall.
+		 *
+		 * @param w The event loop owning the connection.
+		 * @param con The client connection.
+		 * @param msg The response message.
+		 * @param length The size of the response message.
+		 */
+		void reply(worker& w, connection& con, const void* msg, size_t length);
+
+		/**
+		 * Send as much of the send queue as the socket accepts.
+		 * If the socket is full, the connection waits for it
+		 * to become writable again.
+		 *
+		 * @param w The event loop owning the connection.
+		 * @param con The client connection.
+		 * @return False if the client should be disconnected, true otherwise.
+		 */
+		bool flush(worker& w, connection& con);
+
+		/**
+		 * Close a client connection, dropping anything still queued.
+		 *
+		 * @param w The event loop owning the connection.
+		 * @param con The client connection.
+		 */
+		void disconnect(worker& w, connection& con);
+
 		sqlite3*& _db;
-		char* _data[buffer_size];
+		server_options _options;
+
+		/// Pads and their occupancy, kept in sync with the database.
+		pad_index _pads;
+
+		/// Writes the docking log, if the triggers don't.
+		/// Outlives the commit queue, whose completions log to it.
+		log_writer _log;
+
+		/// Moves old docking log entries to the archive tables, if enabled.
+		log_archiver _archive;
+
+		/// Request counters and latencies, for stats requests.
+		server_stats _stats;
+
+		/// Limits the lines logged about handled requests.
+		rate_limiter _request_log;
+
+		/// The shard of each pad, by pad ID, if sharded.
+		std::vector<uint16_t> _routes;
+
+		/// The data version of the directory, if sharded.
+		uint64_t _directory_version = 0;
+
+		/// The pad of every docked or docking ship by license, if sharded.
+		std::unordered_map<std::string, int> _licenses;
+		std::mutex _licenses_lock;
+
+		/// When the last snapshot was taken, by any writer thread.
+		std::chrono::steady_clock::time_point _last_snapshot;
+		std::mutex _snapshot_lock;
+
+		/// The databases holding ships, each with its own writer.
+		/// Declared last of these, so they're stopped before the rest go away.
+		std::vector<std::unique_ptr<shard>> _shards;
+
+		/// Whether all statements were prepared and the pads loaded.
+		bool _ready;
+
+		/// Whether the pads were loaded from the snapshot.
+		bool _from_snapshot = false;
+
+		/// Whether the server was opened to clients, and 
+		/// should leave a snapshot behind when it closes.
+		bool _served = false;
+
+		/// Number of clients connected across all event loops.
+		std::atomic<size_t> _connected;
+
+		/// Set once the server has been asked to stop.
+		std::atomic<bool> _stopped;
+
+		/// Readable once the server has been asked to stop,
+		/// registered with every event loop.
+		int _stop_event;
 };
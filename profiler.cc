@@ -0,0 +1,251 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include "profiler.h"
+
+#include <cctype>
+#include <cstring>
+
+#include <algorithm>
+
+/// The profiler tracing new connections, see start().
+static sql_profiler* active_profiler = nullptr;
+
+thread_local sql_profiler::thread_profile* sql_profiler::_local = nullptr;
+
+/**
+ * Collapse whitespace and replace string and numeric literals with '?',
+ * so statements built with different values are counted together.
+ * Numbered parameters such as ?1 are left alone.
+ */
+static std::string normalize(const char* sql)
+{
+	std::string out;
+	bool space = false;
+
+	for (const char* c = sql; *c; c++)
+	{
+		if (isspace(static_cast<unsigned char>(*c)))
+		{
+			space = !out.empty();
+			continue;
+		}
+
+		if (space)
+		{
+			out += ' ';
+			space = false;
+		}
+
+		if (*c == '\'')
+		{
+			// Quotes are escaped by doubling them.
+			while (*++c)
+			{
+				if (*c == '\'' && *++c != '\'')
+					break;
+			}
+
+			out += '?';
+			c--;
+		}
+		else if (isdigit(static_cast<unsigned char>(*c)) && (out.empty() 
+					|| !(isalnum(static_cast<unsigned char>(out.back())) || out.back() == '_' || out.back() == '?')))
+		{
+			while (isalnum(static_cast<unsigned char>(c[1])) || c[1] == '.')
+				c++;
+
+			out += '?';
+		}
+		else
+		{
+			out += *c;
+		}
+	}
+
+	return out;
+}
+
+void sql_profiler::totals::add(uint64_t elapsed)
+{
+	calls++;
+	ns += elapsed;
+	max_ns = std::max(max_ns, elapsed);
+}
+
+sql_profiler::totals& sql_profiler::thread_profile::find(const char* sql)
+{
+	key.assign(sql);
+
+	auto it = statements.find(key);
+
+	if (it == statements.end())
+	{
+		it = statements.emplace(key, totals {}).first;
+		it->second.text = normalize(sql);
+		it->second.trigger = (strncmp(sql, "-- TRIGGER ", 11) == 0);
+	}
+
+	return it->second;
+}
+
+int sql_profiler::start()
+{
+	active_profiler = this;
+
+	return sqlite3_auto_extension(reinterpret_cast<void(*)(void)>(&sql_profiler::attach));
+}
+
+int sql_profiler::attach(sqlite3* db, char**, const sqlite3_api_routines*)
+{
+	// Statements are started and finished, and triggers start 
+	// with a statement event of their own.
+	return sqlite3_trace_v2(db, SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE, 
+			&sql_profiler::trace, active_profiler);
+}
+
+sql_profiler::thread_profile& sql_profiler::local()
+{
+	if (_local == nullptr)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+
+		_threads.push_back(std::make_unique<thread_profile>());
+		_local = _threads.back().get();
+	}
+
+	return *_local;
+}
+
+int sql_profiler::trace(unsigned type, void* context, void* p, void* x)
+{
+	thread_profile& t = static_cast<sql_profiler*>(context)->local();
+	sqlite3_stmt* stmt = static_cast<sqlite3_stmt*>(p);
+	const auto now = clock::now();
+
+	std::lock_guard<std::mutex> lock(t.lock);
+
+	// Whatever trigger this statement was running is done now.
+	if (t.trigger != nullptr && t.trigger_stmt == stmt)
+	{
+		t.trigger->add(std::chrono::duration_cast<std::chrono::nanoseconds>(now - t.trigger_start).count());
+		t.trigger = nullptr;
+	}
+
+	auto running = std::find_if(t.running.begin(), t.running.end(), 
+			[stmt](const auto& r) { return r.first == stmt; });
+
+	if (type == SQLITE_TRACE_STMT)
+	{
+		const char* sql = static_cast<const char*>(x);
+
+		if (strncmp(sql, "-- TRIGGER ", 11) == 0)
+		{
+			t.trigger = &t.find(sql);
+			t.trigger_stmt = stmt;
+			t.trigger_start = now;
+		}
+		else if (running != t.running.end())
+		{
+			running->second = now;
+		}
+		else
+		{
+			t.running.emplace_back(stmt, now);
+		}
+	}
+	else if (type == SQLITE_TRACE_PROFILE)
+	{
+		const char* sql = sqlite3_sql(stmt);
+		uint64_t elapsed = *static_cast<const sqlite3_int64*>(x);
+
+		if (running != t.running.end())
+		{
+			elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - running->second).count();
+			t.running.erase(running);
+		}
+
+		if (sql != nullptr)
+			t.find(sql).add(elapsed);
+	}
+
+	return 0;
+}
+
+void sql_profiler::print(FILE* out, size_t top) const
+{
+	std::unordered_map<std::string, totals> merged;
+
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+
+		for (const auto& t : _threads)
+		{
+			std::lock_guard<std::mutex> thread_lock(t->lock);
+
+			for (const auto& statement : t->statements)
+			{
+				totals& m = merged[statement.second.text];
+
+				m.text = statement.second.text;
+				m.trigger = statement.second.trigger;
+				m.calls += statement.second.calls;
+				m.ns += statement.second.ns;
+				m.max_ns = std::max(m.max_ns, statement.second.max_ns);
+			}
+		}
+	}
+
+	std::vector<const totals*> sorted;
+	uint64_t total_ns = 0;
+
+	for (const auto& m : merged)
+	{
+		sorted.push_back(&m.second);
+
+		// Triggers are already part of their statements.
+		if (!m.second.trigger)
+			total_ns += m.second.ns;
+	}
+
+	top = std::min(top, sorted.size());
+
+	std::partial_sort(sorted.begin(), sorted.begin() + top, sorted.end(), 
+			[](const totals* a, const totals* b) { return a->ns > b->ns; });
+
+	fprintf(out, "SQL profile, the top %lu of %lu statements by total time (%.1f ms in all):\n"
+			"%10s %12s %7s %10s %10s  %s\n", top, sorted.size(), total_ns / 1e6,
+			"calls", "total ms", "share", "mean us", "max us", "statement");
+
+	for (size_t i = 0; i < top; i++)
+	{
+		const totals& s = *sorted[i];
+
+		fprintf(out, "%10llu %12.1f %6.1f%% %10.1f %10.1f  %.100s%s\n", 
+				(unsigned long long) s.calls, s.ns / 1e6, 
+				(total_ns > 0) ? 100.0 * s.ns / total_ns : 0.0,
+				(s.calls > 0) ? s.ns / 1e3 / s.calls : 0.0, s.max_ns / 1e3, 
+				s.text.c_str(), (s.text.size() > 100) ? "..." : "");
+	}
+}
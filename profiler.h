@@ -0,0 +1,135 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sqlite3.h>
+
+/**
+ * Time spent in SQL statements, through sqlite3_trace_v2.
+ * Once started, every database connection the process opens is traced,
+ * and the time of each statement is added up under its normalized text,
+ * with literals replaced by '?'. Trigger bodies, such as check_before_dock
+ * and the log triggers, are counted on their own as "-- TRIGGER <name>".
+ *
+ * A statement is timed from its first step until it finishes or is reset,
+ * including whatever the caller does between rows. SQLite times them too,
+ * but only to the millisecond on most systems, so that is only used if
+ * the start of a statement was missed. A trigger is timed from its start
+ * until the next trigger or the end of the statement running it, so a
+ * BEFORE trigger includes the row change that follows it. Trigger time
+ * is also part of the time of its statement.
+ *
+ * Each thread adds up its own statements, so tracing takes no shared locks.
+ */
+class sql_profiler
+{
+	public:
+
+		using clock = std::chrono::steady_clock;
+
+		/**
+		 * Trace every database connection opened from now on.
+		 * Only one profiler can be started per process, 
+		 * and it must outlive all of the connections.
+		 *
+		 * @return A SQLite response code.
+		 */
+		int start();
+
+		/**
+		 * Print the statements that took the most time, in total.
+		 * Safe to call while statements are being traced.
+		 *
+		 * @param out The stream to print to.
+		 * @param top The number of statements to print.
+		 */
+		void print(FILE* out, size_t top) const;
+
+	private:
+
+		/// The time spent in one statement or trigger.
+		struct totals
+		{
+			std::string text;
+			bool trigger = false;
+			uint64_t calls = 0;
+			uint64_t ns = 0;
+			uint64_t max_ns = 0;
+
+			void add(uint64_t elapsed);
+		};
+
+		/// The statements traced by a single thread.
+		struct thread_profile
+		{
+			/// Held by the thread while tracing, and by whoever prints.
+			std::mutex lock;
+
+			/// By raw SQL text, normalized once when first seen.
+			std::unordered_map<std::string, totals> statements;
+
+			/// The statements started and not yet finished, usually one.
+			std::vector<std::pair<sqlite3_stmt*, clock::time_point>> running;
+
+			/// The trigger running, if any, and the statement running it.
+			totals* trigger = nullptr;
+			sqlite3_stmt* trigger_stmt = nullptr;
+			clock::time_point trigger_start;
+
+			/// Reused to look up statements without allocating.
+			std::string key;
+
+			totals& find(const char* sql);
+		};
+
+		/**
+		 * Registered with sqlite3_auto_extension, to trace a new connection.
+		 */
+		static int attach(sqlite3* db, char** err, const sqlite3_api_routines* api);
+
+		/**
+		 * The sqlite3_trace_v2 callback.
+		 */
+		static int trace(unsigned type, void* context, void* p, void* x);
+
+		/**
+		 * @return The statements of the calling thread.
+		 */
+		thread_profile& local();
+
+		/// The statements of the calling thread, once it has traced any.
+		static thread_local thread_profile* _local;
+
+		mutable std::mutex _lock;
+		std::vector<std::unique_ptr<thread_profile>> _threads;
+};
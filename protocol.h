@@ -1,7 +1,13 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 constexpr int max_license_len = 64;
 
+/// The largest message accepted by the server, in bytes.
+constexpr size_t max_message_len = 1024;
+
 enum class msg_type
 {
 	dock_query,
@@ -9,9 +15,18 @@ enum class msg_type
 	dock_request,
 	undock_request,
 	dock_response,
-	undock_response
+	undock_response,
+	connection_refused,
+	stats_request,
+	stats_response
 };
 
+/**
+ * Every message starts with this head. Messages are sent back to back
+ * on the stream, and the length (which includes the head) is used to
+ * find where one ends and the next begins. Responses echo the id
+ * of the request they answer, so requests can be pipelined.
+ */
 struct msg_head
 {
 	size_t length;
@@ -39,7 +54,7 @@ struct ship_data
 
 struct dock_query_msg
 {
-	msg_type head;
+	msg_head head;
 	float weight;
 };
 
@@ -70,4 +85,45 @@ struct undock_response_msg
 	int fee;
 };
 
+/// The number of request types counted in a stats response.
+constexpr int stats_request_kinds = 3;
+
+/**
+ * Percentiles of a latency histogram, in nanoseconds.
+ * Each is the upper bound of the histogram bucket it falls in,
+ * so they're accurate to about 1.5%.
+ */
+struct latency_summary
+{
+	uint64_t count;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+	uint64_t max;
+};
+
+/**
+ * Counters of one request type since the server started.
+ * The request latency runs from the request being read to its
+ * response being queued, and the SQLite portion is the time spent
+ * in the transaction that committed it (none for dock queries).
+ */
+struct request_stats
+{
+	uint64_t requests;
+	uint64_t failed;
+	latency_summary request;
+	latency_summary sqlite;
+};
 
+/**
+ * The answer to a stats request, which is a bare message head.
+ * Kinds are in the order dock query, dock request, undock request.
+ */
+struct stats_response_msg
+{
+	msg_head head;
+	uint64_t uptime_ms;
+	request_stats kinds[stats_request_kinds];
+};
@@ -0,0 +1,95 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include "readers.h"
+
+#include <cstdio>
+
+reader_pool::~reader_pool()
+{
+	for (auto& r : _readers)
+	{
+		// Statements must go before the connection.
+		r->statements.clear();
+		sqlite3_close(r->db);
+	}
+}
+
+int reader_pool::open(const char* path, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		auto r = std::make_unique<reader>();
+		int rc;
+
+		// Each connection is only ever used by one thread at a time,
+		// so SQLite doesn't need to lock it.
+		if ((rc = sqlite3_open_v2(path, &r->db, 
+						SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr)) != SQLITE_OK)
+		{
+			fprintf(stderr, "Failed to open read connection: %s\n", sqlite3_errmsg(r->db));
+			sqlite3_close(r->db);
+			return rc;
+		}
+
+		sqlite3_busy_timeout(r->db, 5000);
+
+		if ((rc = r->statements.prepare(r->db)) != SQLITE_OK)
+		{
+			r->statements.clear();
+			sqlite3_close(r->db);
+			return rc;
+		}
+
+		_idle.push_back(r.get());
+		_readers.push_back(std::move(r));
+	}
+
+	return SQLITE_OK;
+}
+
+reader_pool::lease reader_pool::acquire()
+{
+	if (_readers.empty())
+		return lease();
+
+	std::unique_lock<std::mutex> lock(_lock);
+
+	_available.wait(lock, [this] { return !_idle.empty(); });
+
+	reader* r = _idle.back();
+	_idle.pop_back();
+
+	return lease(this, r);
+}
+
+void reader_pool::release(reader* r)
+{
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		_idle.push_back(r);
+	}
+
+	_available.notify_one();
+}
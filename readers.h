@@ -0,0 +1,119 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <sqlite3.h>
+
+#include "statements.h"
+
+/**
+ * A pool of read-only connections to the database, each with its
+ * own prepared statements. With the database in WAL mode, readers
+ * don't wait for the writer (or each other), so read queries can 
+ * run in parallel with docking writes on other threads.
+ */
+class reader_pool
+{
+	private:
+
+		struct reader
+		{
+			sqlite3* db = nullptr;
+			statement_cache statements;
+		};
+
+	public:
+
+		/**
+		 * Exclusive use of a pooled reader, 
+		 * returned to the pool when destroyed.
+		 */
+		class lease
+		{
+			public:
+
+				lease() = default;
+				lease(reader_pool* pool, reader* r) : _pool(pool), _reader(r) { }
+				lease(lease&& other) : _pool(other._pool), _reader(other._reader) { other._reader = nullptr; }
+				~lease() { if (_reader) _pool->release(_reader); }
+
+				lease(const lease&) = delete;
+				lease& operator=(const lease&) = delete;
+				lease& operator=(lease&&) = delete;
+
+				/**
+				 * @return False if no reader was leased.
+				 */
+				explicit operator bool() const { return _reader != nullptr; }
+
+				sqlite3* db() const { return _reader->db; }
+				const statement_cache& statements() const { return _reader->statements; }
+
+			private:
+
+				reader_pool* _pool = nullptr;
+				reader* _reader = nullptr;
+		};
+
+		/**
+		 * Close all pooled connections.
+		 * No leases may be outstanding.
+		 */
+		~reader_pool();
+
+		/**
+		 * Open the specified number of read-only connections.
+		 *
+		 * @param path The database file path.
+		 * @param count The number of connections to open.
+		 * @return A SQLite response code.
+		 */
+		int open(const char* path, int count);
+
+		/**
+		 * Lease a reader, waiting for one to be returned if all are in use.
+		 *
+		 * @return The lease, which is empty if the pool has no connections.
+		 */
+		lease acquire();
+
+		/**
+		 * @return The number of pooled connections.
+		 */
+		size_t size() const { return _readers.size(); }
+
+	private:
+
+		void release(reader* r);
+
+		std::vector<std::unique_ptr<reader>> _readers;
+		std::vector<reader*> _idle;
+		std::mutex _lock;
+		std::condition_variable _available;
+};
@@ -26,9 +26,15 @@
 #include <math.h>
 #include <string.h>
 #include <ctype.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
 
 // STL
 #include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
 
 // Externals
 #include <sqlite3.h>
@@ -37,6 +43,8 @@
 // Relative
 #include "parksrv.h"
 #include "db.h"
+#include "journal.h"
+#include "profiler.h"
 
 namespace fs = std::filesystem;
 using namespace libconfig;
@@ -47,23 +55,68 @@ void print_usage()
 			"\nSpace-copyright 2142 - Tonto Turbo AB\n"
 			"\nUse this utility to launch a spacepark server, or invoke one-time commands.\n"
 			"\nusage:\tspacepark-server [-h] [-c <path>] [-p <begin-end>]"
-			"\n\t[-d <path>] <command> [<args>]"
+			"\n\t[-t <count>] [-d <path>] <command> [<args>]"
 		    "\noptions:"
 		    "\n\t-h:\t\tShows this help"
 			"\n\t-c <path>:\tSpecify the configuration path"
 			"\n\t-d <path>:\tSpecify the database file path\n"
-			"\n\t-p <begin-end>:\tSpecify the port range\n"
+			"\n\t-p <begin-end>:\tSpecify the port range"
+			"\n\t-t <count>:\tSpecify the number of server threads\n"
 			"\ncommands:\n"
 			"\n\topen\t\tOpen the server"
 			"\n\tdock\t\tDock a ship at a specified pad"
 			"\n\tundock\t\tUndock a ship from a specified pad"
 			"\n\tseconds\t\tGet number of seconds docked at pad"
 			"\n\tfee\t\tGet current parking fee for ship docked at pad"
+			"\n\tfees\t\tGet current parking fees for all docked ships"
 			"\n\tdump\t\tDump a DB table into stdout"
+			"\n\thistory\t\tPrint journaled docking events of a pad (or 'all')"
+			"\n\t\t\tbetween two optional UTC times, 'YYYY-MM-DD[ HH:MM:SS]'"
 			"\n"
 	      );
 }
 
+/// The running server, if any, so that signals can stop it.
+static parking_server* running_server = nullptr;
+
+static void stop_handler(int)
+{
+	if (running_server)
+		running_server->stop();
+}
+
+/// Traces every connection, if SQL profiling is on.
+/// Never goes away before the connections do.
+static sql_profiler profiler;
+
+/**
+ * Print the SQL profile whenever the process gets SIGUSR1.
+ * The signal is blocked in every thread started after this, 
+ * and waited for by a thread of its own, which can take locks 
+ * as it pleases, unlike a signal handler.
+ *
+ * @param top The number of statements to print.
+ */
+static void report_on_signal(size_t top)
+{
+	sigset_t usr1;
+	sigemptyset(&usr1);
+	sigaddset(&usr1, SIGUSR1);
+
+	pthread_sigmask(SIG_BLOCK, &usr1, nullptr);
+
+	std::thread([usr1, top]
+	{
+		int sig;
+
+		while (sigwait(&usr1, &sig) == 0)
+		{
+			profiler.print(stdout, top);
+			fflush(stdout);
+		}
+	}).detach();
+}
+
 static int dump_callback(void*, int argc, char** argv, char**)
 {
 	for (int i = 0; i < argc; i++)
@@ -73,6 +126,86 @@ static int dump_callback(void*, int argc, char** argv, char**)
 	return EXIT_SUCCESS;
 }
 
+/**
+ * Parse a UTC time in the format 'YYYY-MM-DD HH:MM:SS',
+ * where the time of day may be left out.
+ *
+ * @param text The time string.
+ * @param ms Set to milliseconds since the epoch.
+ * @return True if the time could be parsed.
+ */
+static bool parse_time(const char* text, int64_t& ms)
+{
+	struct tm tm {};
+	const char* end = strptime(text, "%Y-%m-%d %H:%M:%S", &tm);
+
+	if (end == nullptr)
+	{
+		tm = {};
+		end = strptime(text, "%Y-%m-%d", &tm);
+	}
+
+	if (end == nullptr || *end != '\0')
+		return false;
+
+	ms = static_cast<int64_t>(timegm(&tm)) * 1000;
+	return true;
+}
+
+/**
+ * Print the journaled docking events of a pad.
+ * Arguments are the pad ID (or 'all') and an optional time range.
+ *
+ * @param dir The journal directory.
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @return A C exit code.
+ */
+static int print_history(const std::string& dir, int argc, char* argv[])
+{
+	if (argc < 1)
+	{
+		fprintf(stderr, "Usage: spacepark-server history <PAD ID|all> [FROM] [TO]\n");
+		return EXIT_FAILURE;
+	}
+
+	const int pad_id = (strcmp(argv[0], "all") == 0) ? -1 : atoi(argv[0]);
+	int64_t from = INT64_MIN;
+	int64_t to = INT64_MAX;
+
+	if ((argc > 1 && !parse_time(argv[1], from)) || (argc > 2 && !parse_time(argv[2], to)))
+	{
+		fprintf(stderr, "Specify times as 'YYYY-MM-DD' or 'YYYY-MM-DD HH:MM:SS'.\n");
+		return EXIT_FAILURE;
+	}
+
+	journal_reader reader;
+
+	if (reader.open(dir))
+		return EXIT_FAILURE;
+
+	fprintf(stdout, "date\tpad_id\tevent\tlicense\n");
+
+	long count = reader.scan(pad_id, from, to, [](const journal_record& rec, const char* license)
+	{
+		char date[32];
+		const time_t seconds = rec.time / 1000;
+		struct tm tm {};
+
+		strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", gmtime_r(&seconds, &tm));
+
+		fprintf(stdout, "%s\t%d\t%s\t%s\n", date, rec.pad_id,
+				(rec.event == static_cast<uint8_t>(log_event_type::dock)) ? "dock" : "undock",
+				license);
+	});
+
+	if (count < 0)
+		return EXIT_FAILURE;
+
+	fprintf(stdout, "%ld event(s).\n", count);
+	return EXIT_SUCCESS;
+}
+
 int main(int argc, char* argv[])
 {
 
@@ -84,11 +217,15 @@ int main(int argc, char* argv[])
 	int port_begin = 0;
 	int port_end = 0;
 
+	server_options options;
+	int threads = 0;
+	int sql_profile = 0;
+
 	int c;
 
 	opterr = 0;
 
-	while ((c = getopt (argc, argv, "hc:d:p:")) != -1)
+	while ((c = getopt (argc, argv, "hc:d:p:t:")) != -1)
 	{
 		switch (c)
 		{
@@ -108,8 +245,15 @@ int main(int argc, char* argv[])
 					return EXIT_FAILURE;
 				}
 				break;
+			case 't':
+				if ((threads = atoi(optarg)) < 1)
+				{
+					fprintf(stderr, "Specify a thread count of at least 1.\n");
+					return EXIT_FAILURE;
+				}
+				break;
 			case '?':
-				if (optopt == 'c' || optopt == 'p')
+				if (optopt == 'c' || optopt == 'd' || optopt == 'p' || optopt == 't')
 					fprintf (stderr, "Option '-%c' requires an argument.\n", optopt);
 				else if (isprint (optopt))
 					fprintf (stderr, "Unknown option '-%c'.\n", optopt);
@@ -162,6 +306,144 @@ int main(int argc, char* argv[])
 				return EXIT_FAILURE;
 			}
 		}
+
+		// Optional settings keep their defaults if not configured.
+		cfg.lookupValue("max_clients", options.max_clients);
+		cfg.lookupValue("threads", options.threads);
+		cfg.lookupValue("read_connections", options.read_connections);
+		cfg.lookupValue("commit_window", options.commit_window);
+		cfg.lookupValue("commit_batch", options.commit_batch);
+		cfg.lookupValue("log_interval", options.log_interval);
+		cfg.lookupValue("log_buffer", options.log_buffer);
+		cfg.lookupValue("journal_dir", options.journal_dir);
+		cfg.lookupValue("journal_segment", options.journal_segment);
+		cfg.lookupValue("snapshot_path", options.snapshot_path);
+		cfg.lookupValue("snapshot_interval", options.snapshot_interval);
+		cfg.lookupValue("log_retention", options.log_retention);
+		cfg.lookupValue("archive_interval", options.archive_interval);
+		cfg.lookupValue("archive_batch", options.archive_batch);
+		cfg.lookupValue("request_log", options.request_log);
+		cfg.lookupValue("sql_profile", sql_profile);
+
+		std::string allocation;
+
+		if (cfg.lookupValue("allocation", allocation))
+		{
+			if (allocation == "first_fit")
+				options.allocation = allocation_mode::first_fit;
+			else if (allocation == "best_fit")
+				options.allocation = allocation_mode::best_fit;
+			else
+			{
+				fprintf(stderr, "Unknown allocation mode '%s', "
+						"use 'first_fit' or 'best_fit'.\n", allocation.c_str());
+				return EXIT_FAILURE;
+			}
+		}
+
+		std::string logging;
+
+		if (cfg.lookupValue("log_mode", logging))
+		{
+			if (logging == "trigger")
+				options.logging = log_mode::trigger;
+			else if (logging == "async")
+				options.logging = log_mode::async;
+			else if (logging == "journal")
+				options.logging = log_mode::journal;
+			else
+			{
+				fprintf(stderr, "Unknown log mode '%s', "
+						"use 'trigger', 'async' or 'journal'.\n", logging.c_str());
+				return EXIT_FAILURE;
+			}
+		}
+
+		std::string fee_engine;
+
+		if (cfg.lookupValue("fee_engine", fee_engine))
+		{
+			if (fee_engine == "native" || fee_engine == "sql")
+				options.native_fees = (fee_engine == "native");
+			else
+			{
+				fprintf(stderr, "Unknown fee engine '%s', "
+						"use 'native' or 'sql'.\n", fee_engine.c_str());
+				return EXIT_FAILURE;
+			}
+		}
+
+		std::string durability;
+
+		if (cfg.lookupValue("log_durability", durability))
+		{
+			if (durability == "off")
+				options.log_sync = log_durability::off;
+			else if (durability == "normal")
+				options.log_sync = log_durability::normal;
+			else if (durability == "full")
+				options.log_sync = log_durability::full;
+			else
+			{
+				fprintf(stderr, "Unknown log durability '%s', "
+						"use 'off', 'normal' or 'full'.\n", durability.c_str());
+				return EXIT_FAILURE;
+			}
+		}
+
+		if (threads > 0)
+			options.threads = threads;
+
+		if (options.max_clients < 1)
+		{
+			fprintf(stderr, "The connection limit must be at least 1.\n");
+			return EXIT_FAILURE;
+		}
+
+		if (options.threads < 1)
+		{
+			fprintf(stderr, "The thread count must be at least 1.\n");
+			return EXIT_FAILURE;
+		}
+
+		if (options.read_connections < 0)
+		{
+			fprintf(stderr, "The number of read connections can't be negative.\n");
+			return EXIT_FAILURE;
+		}
+
+		if (options.commit_window < 0 || options.commit_batch < 1)
+		{
+			fprintf(stderr, "The commit window can't be negative, "
+					"and the commit batch must be at least 1.\n");
+			return EXIT_FAILURE;
+		}
+
+		if (options.snapshot_interval < 0)
+		{
+			fprintf(stderr, "The snapshot interval can't be negative.\n");
+			return EXIT_FAILURE;
+		}
+
+		if (options.log_retention < 0 || options.archive_interval < 1 || options.archive_batch < 1)
+		{
+			fprintf(stderr, "The log retention can't be negative, and the archive "
+					"interval and batch must be at least 1.\n");
+			return EXIT_FAILURE;
+		}
+
+		if (options.log_interval < 1 || options.log_buffer < 1 || options.journal_segment < 1)
+		{
+			fprintf(stderr, "The log interval, log buffer and journal segment "
+					"must be at least 1.\n");
+			return EXIT_FAILURE;
+		}
+
+		if (options.request_log < 0 || sql_profile < 0)
+		{
+			fprintf(stderr, "The request log rate and SQL profile length can't be negative.\n");
+			return EXIT_FAILURE;
+		}
 	}
 	else
 	{
@@ -187,6 +469,34 @@ int main(int argc, char* argv[])
 		return EXIT_FAILURE;
 	}
 
+	// The journal lives next to the database unless configured.
+	if (options.journal_dir.empty())
+		options.journal_dir = db_path.string() + ".events";
+
+	// So does the pad snapshot, unless turned off with "none".
+	if (options.snapshot_path.empty())
+		options.snapshot_path = db_path.string() + ".snapshot";
+	else if (options.snapshot_path == "none")
+		options.snapshot_path.clear();
+
+	// History is read straight from the journal, and shouldn't
+	// need the database or compete with a running server for it.
+	if (optind < argc && strcmp(argv[optind], "history") == 0)
+		return print_history(options.journal_dir, argc - optind - 1, argv + optind + 1);
+
+	// Only connections opened after this are profiled.
+	if (sql_profile > 0)
+	{
+		if (profiler.start() != SQLITE_OK)
+		{
+			fprintf(stderr, "Failed to start the SQL profiler.\n");
+			return EXIT_FAILURE;
+		}
+
+		report_on_signal(sql_profile);
+		fprintf(stdout, "Profiling SQL statements, send SIGUSR1 for a report.\n");
+	}
+
 	sqlite3* db;
 
 	if (sqlite3_open(db_path.c_str(), &db))
@@ -213,12 +523,36 @@ int main(int argc, char* argv[])
 		return EXIT_FAILURE;
 	}
 
-	parking_server server(db);
+	// With a write-ahead log, readers don't block the writer and
+	// the writer doesn't block readers. The mode is stored in the
+	// database file, so this only does real work the first time.
+	if (set_pragma(db, err, "journal_mode", "WAL"))
+	{
+		fprintf(stderr, "Failed to enable WAL mode - %s\n", err);
+		sqlite3_free(err);
+	}
+
+	sqlite3_busy_timeout(db, 5000);
+
+	parking_server server(db, options);
+
+	if (!server.ready())
+	{
+		fprintf(stderr, "Failed to start the server, is the database initialized?\n"
+				"Please run spacepark-config init to initialize it.\n");
+
+		sqlite3_close(db);
+		return EXIT_FAILURE;
+	}
 
 	for (int index = optind; index < argc; index++)
 	{
 		if (strcmp(argv[index], "open") == 0)
 		{
+			running_server = &server;
+			signal(SIGINT, stop_handler);
+			signal(SIGTERM, stop_handler);
+
 			if (server.open(port_begin, port_end))
 				fprintf(stderr, "Server exited with an error.\n");
 			else
@@ -273,10 +607,10 @@ int main(int argc, char* argv[])
 			}
 
 			int id = atoi(argv[++index]);
-			int fee = server.get_fee(id);
-			int rc = server.undock_ship(id);
+			int fee;
+			int rc = server.undock_and_bill(id, fee);
 
-			if (rc == SQLITE_OK)
+			if (rc == EXIT_SUCCESS)
 				fprintf(stdout, "Undocked successfully, parking fee is %d credits.\n", fee);
 			else
 				fprintf(stderr, "Failed to undock.\n");
@@ -317,12 +651,29 @@ int main(int argc, char* argv[])
 
 			break;
 		}
+		else if (strcmp(argv[index], "fees") == 0)
+		{
+			std::vector<int> pads, fees;
+			const size_t count = server.get_fees(pads, fees);
+			long total = 0;
+
+			for (size_t i = 0; i < count; i++)
+			{
+				fprintf(stdout, "Ship at pad %d has a parking fee of %d credits.\n", 
+						pads[i], fees[i]);
+				total += fees[i];
+			}
+
+			fprintf(stdout, "%lu ships docked, %ld credits in total.\n", count, total);
+
+			break;
+		}
 		else if (strcmp(argv[index], "dump") == 0)
 		{
 			if (argc <= index + 1)
 			{
 				fprintf(stderr, "Usage: spacepark-server dump <TABLE>"
-						"\nterminals, pads, ships, docking_log\n");
+						"\nterminals, pads, ships, docking_log, docking_log_all\n");
 				break;
 			}
 
@@ -362,9 +713,14 @@ int main(int argc, char* argv[])
 		else print_usage();
 	}
 
+	if (sql_profile > 0)
+		profiler.print(stdout, sql_profile);
+
 	// Ensure we always close the DB connection.
 	// Make sure we reach this point or close it explicitly.
-	sqlite3_close(db);
+	// The server still holds prepared statements at this point,
+	// so let SQLite finish closing once they are finalized.
+	sqlite3_close_v2(db);
 	return EXIT_SUCCESS;
 
 } 
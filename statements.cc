@@ -0,0 +1,118 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include "statements.h"
+
+#include <cstdio>
+
+/// The SQL text of each query, in the order of the query enum.
+static const char* query_sql[] =
+{
+	// seconds_docked
+	"SELECT (?2 - date) / 1000 "
+	"FROM ships "
+	"WHERE pad_id = ?1;",
+
+	// fee
+	"WITH span AS ("
+	"\n    SELECT"
+	"\n    (?2 - date) / 86400000.0"
+	"\n    AS days"
+	"\n    FROM ships"
+	"\n    WHERE pad_id = ?1"
+	"\n    )"
+	"\nSELECT"
+	"\nCASE"
+	"\n    WHEN days > 1 THEN"
+	"\n    ROUND(days + 0.5) * cost_day"
+	"\n    ELSE"
+	"\n    ROUND(days * 24 + 0.5) * cost_hour"
+	"\n    END fee"
+	"\nFROM pads, span"
+	"\nWHERE pad_id = ?1;",
+
+	// dock
+	"INSERT INTO ships (pad_id, weight, license, date) "
+	"VALUES (?1, ?2, ?3, ?4);",
+
+	// undock, returning the license and the fee of the ship
+	"DELETE FROM ships WHERE pad_id = ?1"
+	"\nRETURNING license, ("
+	"\n    SELECT"
+	"\n    CASE"
+	"\n        WHEN days > 1 THEN"
+	"\n        ROUND(days + 0.5) * cost_day"
+	"\n        ELSE"
+	"\n        ROUND(days * 24 + 0.5) * cost_hour"
+	"\n        END"
+	"\n    FROM pads, (SELECT (?2 - date) / 86400000.0 AS days)"
+	"\n    WHERE pads.pad_id = ?1"
+	"\n    );"
+};
+
+static_assert(sizeof(query_sql) / sizeof(query_sql[0]) == static_cast<int>(query::count),
+		"Every query needs its SQL text.");
+
+statement_cache::statement_cache()
+	: _statements {}
+{
+}
+
+statement_cache::~statement_cache()
+{
+	clear();
+}
+
+void statement_cache::clear()
+{
+	for (sqlite3_stmt*& stmt : _statements)
+	{
+		sqlite3_finalize(stmt);
+		stmt = nullptr;
+	}
+}
+
+int statement_cache::prepare(sqlite3* db)
+{
+	for (int i = 0; i < static_cast<int>(query::count); i++)
+	{
+		sqlite3_finalize(_statements[i]);
+		_statements[i] = nullptr;
+
+		// These statements live as long as the server, so tell
+		// SQLite not to take them from its lookaside memory.
+		int rc = sqlite3_prepare_v3(db, query_sql[i], -1, 
+				SQLITE_PREPARE_PERSISTENT, &_statements[i], nullptr);
+
+		if (rc != SQLITE_OK)
+		{
+			fprintf(stderr, "SQL Error %d preparing statement - %s\nQuery: %s\n",
+					rc, sqlite3_errmsg(db), query_sql[i]);
+
+			return rc;
+		}
+	}
+
+	return SQLITE_OK;
+}
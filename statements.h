@@ -0,0 +1,119 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#pragma once
+
+#include <sqlite3.h>
+
+/**
+ * The queries run by the parking server.
+ * Each one is prepared once and reused.
+ */
+enum class query
+{
+	seconds_docked,
+	fee,
+	dock,
+	undock,
+	count
+};
+
+/**
+ * A set of prepared statements for a single database connection.
+ * Statements are prepared up front, so each call only binds
+ * its parameters and steps, instead of parsing and planning
+ * the SQL text again.
+ */
+class statement_cache
+{
+	public:
+
+		/**
+		 * Create an empty statement cache.
+		 */
+		statement_cache();
+
+		/**
+		 * Finalize all prepared statements.
+		 */
+		~statement_cache();
+
+		statement_cache(const statement_cache&) = delete;
+		statement_cache& operator=(const statement_cache&) = delete;
+
+		/**
+		 * Prepare all queries against the specified connection.
+		 *
+		 * @param db An open sqlite3 database connection.
+		 * @return A SQLite response code.
+		 */
+		int prepare(sqlite3* db);
+
+		/**
+		 * Finalize all prepared statements.
+		 * This must be done before closing the connection.
+		 */
+		void clear();
+
+		/**
+		 * Get a prepared statement, ready to be bound.
+		 *
+		 * @param q The query to get.
+		 * @return The prepared statement, or nullptr if not prepared.
+		 */
+		sqlite3_stmt* get(query q) const { return _statements[static_cast<int>(q)]; }
+
+	private:
+
+		sqlite3_stmt* _statements[static_cast<int>(query::count)];
+};
+
+/**
+ * Resets a cached statement and clears its bindings when leaving scope,
+ * so the statement never holds locks or stale parameters between uses.
+ */
+class scoped_statement
+{
+	public:
+
+		scoped_statement(sqlite3_stmt* stmt) : _stmt(stmt) { }
+
+		~scoped_statement()
+		{
+			if (_stmt)
+			{
+				sqlite3_reset(_stmt);
+				sqlite3_clear_bindings(_stmt);
+			}
+		}
+
+		scoped_statement(const scoped_statement&) = delete;
+		scoped_statement& operator=(const scoped_statement&) = delete;
+
+		operator sqlite3_stmt*() const { return _stmt; }
+
+	private:
+
+		sqlite3_stmt* _stmt;
+};
@@ -0,0 +1,132 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#include "stats.h"
+
+static const char* const kind_names[stats_request_kinds] =
+{
+	"dock_query", "dock_request", "undock_request"
+};
+
+static latency_summary summarize(const atomic_histogram& histogram, latency_histogram& snapshot)
+{
+	histogram.snapshot(snapshot);
+
+	return latency_summary
+	{
+		snapshot.count(),
+		snapshot.percentile(0.5),
+		snapshot.percentile(0.9),
+		snapshot.percentile(0.99),
+		snapshot.percentile(0.999),
+		snapshot.max()
+	};
+}
+
+server_stats::server_stats() : _started(clock::now())
+{
+}
+
+void server_stats::record(request_kind kind, bool ok, clock::duration request)
+{
+	counters& c = _kinds[static_cast<int>(kind)];
+
+	c.requests.fetch_add(1, std::memory_order_relaxed);
+
+	if (!ok)
+		c.failed.fetch_add(1, std::memory_order_relaxed);
+
+	c.request.record(std::chrono::duration_cast<std::chrono::nanoseconds>(request).count());
+}
+
+void server_stats::record(request_kind kind, bool ok, clock::duration request, clock::duration sqlite)
+{
+	record(kind, ok, request);
+
+	_kinds[static_cast<int>(kind)].sqlite.record(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(sqlite).count());
+}
+
+void server_stats::summarize(stats_response_msg& msg) const
+{
+	latency_histogram snapshot;
+
+	msg.uptime_ms = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - _started).count();
+
+	for (int i = 0; i < stats_request_kinds; i++)
+	{
+		msg.kinds[i].requests = _kinds[i].requests.load(std::memory_order_relaxed);
+		msg.kinds[i].failed = _kinds[i].failed.load(std::memory_order_relaxed);
+		msg.kinds[i].request = ::summarize(_kinds[i].request, snapshot);
+		msg.kinds[i].sqlite = ::summarize(_kinds[i].sqlite, snapshot);
+	}
+}
+
+void server_stats::print(FILE* out) const
+{
+	stats_response_msg msg {};
+	summarize(msg);
+
+	fprintf(out, "Request statistics over %.1f seconds (latency in microseconds):\n"
+			"%-16s %10s %8s %10s %10s %10s %10s %10s\n", msg.uptime_ms / 1000.0,
+			"", "requests", "failed", "p50", "p90", "p99", "p99.9", "max");
+
+	auto row = [out](const char* name, uint64_t requests, uint64_t failed, const latency_summary& s)
+	{
+		fprintf(out, "%-16s %10llu %8llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+				(unsigned long long) requests, (unsigned long long) failed,
+				s.p50 / 1000.0, s.p90 / 1000.0, s.p99 / 1000.0, s.p999 / 1000.0, s.max / 1000.0);
+	};
+
+	for (int i = 0; i < stats_request_kinds; i++)
+	{
+		const request_stats& k = msg.kinds[i];
+
+		if (k.requests == 0)
+			continue;
+
+		row(kind_names[i], k.requests, k.failed, k.request);
+
+		if (k.sqlite.count > 0)
+			row("  sqlite", k.sqlite.count, 0, k.sqlite);
+	}
+}
+
+bool rate_limiter::allow()
+{
+	if (_per_second <= 0)
+		return false;
+
+	const int64_t second = std::chrono::duration_cast<std::chrono::seconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+
+	int64_t counting = _second.load(std::memory_order_relaxed);
+
+	// Whoever moves the window on starts the count over. Threads 
+	// racing with it may get one more or less in, which is fine.
+	if (counting != second && _second.compare_exchange_strong(counting, second, std::memory_order_relaxed))
+		_count.store(0, std::memory_order_relaxed);
+
+	return _count.fetch_add(1, std::memory_order_relaxed) < _per_second;
+}
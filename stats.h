@@ -0,0 +1,135 @@
+/*
+ * This file is part of SPACEPARK.
+ *
+ * Developed for the VISMA graduate program code challenge.
+ * See the COPYRIGHT file at the top-level directory of this distribution
+ * for details of code ownership.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * If issues occur, contact me on fredrik.lind.96@gmail.com
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#include "histogram.h"
+#include "protocol.h"
+
+/**
+ * The requests the server keeps statistics for,
+ * in the order of stats_response_msg::kinds.
+ */
+enum class request_kind
+{
+	dock_query,
+	dock_request,
+	undock_request
+};
+
+/**
+ * Request counters and latency histograms for each request type,
+ * recorded into from every event loop and writer thread at once
+ * without taking any locks.
+ */
+class server_stats
+{
+	public:
+
+		using clock = std::chrono::steady_clock;
+
+		server_stats();
+
+		/**
+		 * Count a request answered without touching the database.
+		 *
+		 * @param kind The request type.
+		 * @param ok False if the request failed.
+		 * @param request The time from the request being read to the response being queued.
+		 */
+		void record(request_kind kind, bool ok, clock::duration request);
+
+		/**
+		 * Count a request written to the database.
+		 *
+		 * @param kind The request type.
+		 * @param ok False if the request failed.
+		 * @param request The time from the request being read to the response being queued.
+		 * @param sqlite The part of that spent in the transaction that committed it.
+		 */
+		void record(request_kind kind, bool ok, clock::duration request, clock::duration sqlite);
+
+		/**
+		 * Fill in the counters of a stats response.
+		 *
+		 * @param msg The response, whose head is left alone.
+		 */
+		void summarize(stats_response_msg& msg) const;
+
+		/**
+		 * Print a table of the counters and latency percentiles.
+		 *
+		 * @param out The stream to print to.
+		 */
+		void print(FILE* out) const;
+
+	private:
+
+		struct counters
+		{
+			std::atomic<uint64_t> requests { 0 };
+			std::atomic<uint64_t> failed { 0 };
+			atomic_histogram request;
+			atomic_histogram sqlite;
+		};
+
+		counters _kinds[stats_request_kinds];
+		const clock::time_point _started;
+};
+
+/**
+ * Lets through at most a number of events per second, 
+ * from any number of threads, such as lines of a log
+ * that would otherwise flood the output under load.
+ */
+class rate_limiter
+{
+	public:
+
+		/**
+		 * @param per_second The number of events let through per second,
+		 * or 0 to let none through.
+		 */
+		explicit rate_limiter(int per_second) : _per_second(per_second) { }
+
+		/**
+		 * Count an event.
+		 *
+		 * @return True if the event should go ahead.
+		 */
+		bool allow();
+
+	private:
+
+		const int _per_second;
+
+		/// The second being counted, since the clock epoch.
+		std::atomic<int64_t> _second { -1 };
+		std::atomic<int> _count { 0 };
+};